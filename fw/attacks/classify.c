@@ -0,0 +1,410 @@
+/*
+ * fw/attacks/classify.c - Incremental classification of received frames
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * We parse the IEEE 802.15.4 MAC header and, in data frames, the Zigbee NWK
+ * header while the bytes come out of the frame buffer, and stop reading as
+ * soon as a rule has decided. The cost thus depends on the headers, not on
+ * the length of the frame. Frames that hide their command, because they are
+ * secured or truncated, match no rule. Of the hub's secured NWK frames, we
+ * only pick up the frame counter.
+ *
+ * With IRQ_RX_START enabled, classify_start does the same while the frame is
+ * still arriving, reading each byte as soon as it has landed in the frame
+ * buffer. Frames no rule wants are dropped after their header, and for the
+ * others the decision is ready when TRX_END comes. This busy-waits in the RF
+ * interrupt for the airtime of the header, up to about 1 ms, so only the
+ * hijacking attack, which answers frames on the spot, uses it. Selecting
+ * that attack enables IRQ_RX_START.
+ *
+ * The hijack only answers the victim's Data Requests and TC Rejoin Requests.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <avr/pgmspace.h>
+
+#include "at86rf230.h"
+#include "spi.h"
+#include "board.h"
+#include "attack.h"
+#include "frame.h"
+#include "classify.h"
+
+
+extern uint8_t rejoin_full_flag;
+extern uint8_t beacon_request_flag;
+extern uint8_t tc_rejoin_request_flag;
+extern uint8_t data_request_flag;
+
+extern ieee802154_addr hub_addr;
+extern ieee802154_addr victim_addr;
+
+
+/* IEEE 802.15.4 frame control field */
+
+#define	FCF_TYPE_MASK		0x0007
+#define	FCF_TYPE_DATA		1
+#define	FCF_TYPE_CMD		3
+#define	FCF_SECURITY		0x0008
+#define	FCF_PAN_COMP		0x0040
+#define	FCF_DST_SHIFT		10
+#define	FCF_VERSION_SHIFT	12
+#define	FCF_SRC_SHIFT		14
+
+#define	ADDR_NONE		0
+#define	ADDR_SHORT		2
+#define	ADDR_LONG		3
+
+/* Zigbee NWK frame control field */
+
+#define	NWK_TYPE_MASK		0x0003
+#define	NWK_TYPE_CMD		1
+#define	NWK_MULTICAST		0x0100
+#define	NWK_SECURITY		0x0200
+#define	NWK_SRC_ROUTE		0x0400
+#define	NWK_DST_IEEE		0x0800
+#define	NWK_SRC_IEEE		0x1000
+
+#define	RULE_ARGS		4	/* payload bytes a rule can look at */
+
+#define	BYTE_TICKS	(32*TIMER_TICKS_PER_US)	/* airtime of one byte */
+#define	LAND_TICKS	(2*TIMER_TICKS_PER_US)	/* until it is in the buffer */
+
+
+enum rule_layer {
+	LAYER_NONE = 0,		/* nothing we can classify */
+	LAYER_MAC,		/* MAC command frame */
+	LAYER_NWK,		/* unsecured NWK command in a MAC data frame */
+};
+
+enum rule_match {
+	MATCH_ANY = 0,
+	MATCH_SRC_VICTIM,	/* MAC source is victim_addr, short or long */
+	MATCH_SRC_HUB,		/* MAC source is hub_addr, short or long */
+};
+
+struct rule {
+	uint8_t layer;		/* enum rule_layer */
+	uint8_t cmd;		/* command identifier */
+	uint8_t match;		/* enum rule_match */
+	uint8_t arg;		/* payload byte after cmd to check, 1-based */
+	uint8_t value;		/* what it must be, if arg is non-zero */
+	uint8_t *flag;		/* set on a match ... */
+	uint8_t set;		/* ... to this value */
+};
+
+
+/* the first rule that matches wins */
+
+static const struct rule rules[] PROGMEM = {
+	/* TC Rejoin Response, by status */
+	{ LAYER_NWK,	0x07,	MATCH_ANY,	3, 0x00, &rejoin_full_flag, 0 },
+	{ LAYER_NWK,	0x07,	MATCH_ANY,	3, 0x01, &rejoin_full_flag, 1 },
+	/* Beacon Request */
+	{ LAYER_MAC,	0x07,	MATCH_ANY,	0, 0, &beacon_request_flag, 1 },
+	/* Data Request */
+	{ LAYER_MAC,	0x04,	MATCH_SRC_VICTIM, 0, 0, &data_request_flag, 1 },
+	/* TC Rejoin Request */
+	{ LAYER_NWK,	0x06,	MATCH_SRC_VICTIM, 0, 0, &tc_rejoin_request_flag, 1 },
+};
+
+#define	N_RULES	(sizeof(rules)/sizeof(*rules))
+
+
+/* ----- Reading the frame buffer ------------------------------------------ */
+
+
+static uint8_t psdu_len;		/* PSDU bytes without FCS */
+static uint8_t pos;			/* PSDU bytes read so far */
+static uint8_t head[FRAME_MAX-1];	/* the first ones, for frame_readback */
+static bool pacing = 0;			/* the frame is still arriving */
+static uint64_t psdu_t0;		/* RX_START, when pacing */
+
+
+/* read n bytes to buf, or just skip them if buf is NULL */
+
+static bool get(uint8_t *buf, uint16_t n)
+{
+	uint8_t room, b;
+
+	if (n > psdu_len-pos)
+		return 0;
+
+	/* PSDU byte i is complete (i+1) byte times after RX_START */
+	if (pacing)
+		while (timer_read() < psdu_t0+(pos+n)*BYTE_TICKS+LAND_TICKS)
+			_delay_us(1);
+
+	/* what fits into head is read in one go */
+	room = pos < sizeof(head) ? sizeof(head)-pos : 0;
+	if (room > n)
+		room = n;
+	if (room) {
+		spi_recv_block(head+pos, room);
+		if (buf) {
+			memcpy(buf, head+pos, room);
+			buf += room;
+		}
+		pos += room;
+		n -= room;
+	}
+
+	while (n--) {
+		b = spi_recv();
+		pos++;
+		if (buf)
+			*buf++ = b;
+	}
+	return 1;
+}
+
+
+/* ----- Header parsing ---------------------------------------------------- */
+
+
+struct header {
+	uint8_t layer;		/* enum rule_layer */
+	uint8_t cmd;
+	uint8_t src_mode;	/* MAC source addressing mode */
+	uint8_t src[8];		/* MAC source address, little-endian */
+};
+
+
+static uint8_t addr_size(uint8_t mode)
+{
+	switch (mode) {
+	case ADDR_SHORT:
+		return 2;
+	case ADDR_LONG:
+		return 8;
+	default:
+		return 0;
+	}
+}
+
+
+static bool match(const struct header *h, uint8_t how)
+{
+	switch (how) {
+	case MATCH_ANY:
+		return 1;
+	case MATCH_SRC_VICTIM:
+		if (h->src_mode == ADDR_SHORT)
+			return !memcmp(h->src, &victim_addr.short_addr, 2);
+		if (h->src_mode == ADDR_LONG)
+			return !memcmp(h->src, &victim_addr.long_addr, 8);
+		return 0;
+	case MATCH_SRC_HUB:
+		if (h->src_mode == ADDR_SHORT)
+			return !memcmp(h->src, &hub_addr.short_addr, 2);
+		if (h->src_mode == ADDR_LONG)
+			return !memcmp(h->src, &hub_addr.long_addr, 8);
+		return 0;
+	default:
+		return 0;
+	}
+}
+
+
+static void parse(struct header *h)
+{
+	uint8_t buf[5];
+	uint16_t fcf, nwk;
+	uint8_t dst_mode, n;
+	uint32_t counter;
+
+	h->layer = LAYER_NONE;
+
+	/* frame control, sequence number */
+	if (!get(buf, 3))
+		return;
+	fcf = buf[0] | buf[1] << 8;
+	if ((fcf & FCF_SECURITY) || (fcf >> FCF_VERSION_SHIFT & 3) > 1)
+		return;
+
+	/* destination PAN and address */
+	dst_mode = fcf >> FCF_DST_SHIFT & 3;
+	if (dst_mode != ADDR_NONE && !get(NULL, 2+addr_size(dst_mode)))
+		return;
+
+	/* source PAN, unless compressed, and address */
+	h->src_mode = fcf >> FCF_SRC_SHIFT & 3;
+	if (h->src_mode != ADDR_NONE) {
+		if (!(fcf & FCF_PAN_COMP) && !get(NULL, 2))
+			return;
+		if (!get(h->src, addr_size(h->src_mode)))
+			return;
+	}
+
+	switch (fcf & FCF_TYPE_MASK) {
+	case FCF_TYPE_CMD:
+		if (get(&h->cmd, 1))
+			h->layer = LAYER_MAC;
+		return;
+	case FCF_TYPE_DATA:
+		break;
+	default:
+		return;
+	}
+
+	/* NWK frame control */
+	if (!get(buf, 2))
+		return;
+	nwk = buf[0] | buf[1] << 8;
+	if (nwk & NWK_SECURITY) {
+		if (!match(h, MATCH_SRC_HUB))
+			return;
+	} else if ((nwk & NWK_TYPE_MASK) != NWK_TYPE_CMD) {
+		return;
+	}
+
+	/* destination, source, radius, sequence number, optional fields */
+	n = 6;
+	if (nwk & NWK_DST_IEEE)
+		n += 8;
+	if (nwk & NWK_SRC_IEEE)
+		n += 8;
+	if (nwk & NWK_MULTICAST)
+		n++;
+	if (!get(NULL, n))
+		return;
+
+	/* relay count, relay index, relay list */
+	if (nwk & NWK_SRC_ROUTE)
+		if (!get(buf, 2) || !get(NULL, 2*buf[0]))
+			return;
+
+	/* security control and frame counter */
+	if (nwk & NWK_SECURITY) {
+		if (get(buf, 5)) {
+			memcpy(&counter, buf+1, 4);
+			frame_counter_seen(counter);
+		}
+		return;
+	}
+
+	if (get(&h->cmd, 1))
+		h->layer = LAYER_NWK;
+}
+
+
+/* ----- Rules ------------------------------------------------------------- */
+
+
+static bool decide(struct rule *r)
+{
+	struct header h;
+	uint8_t args[RULE_ARGS];
+	uint8_t n_args = 0;
+	uint8_t i;
+
+	parse(&h);
+	for (i = 0; h.layer != LAYER_NONE && i != N_RULES; i++) {
+		memcpy_P(r, rules+i, sizeof(*r));
+		if (r->layer != h.layer || r->cmd != h.cmd ||
+		    !match(&h, r->match))
+			continue;
+		if (r->arg) {
+			while (n_args < r->arg && get(args+n_args, 1))
+				n_args++;
+			if (n_args < r->arg || args[r->arg-1] != r->value)
+				continue;
+		}
+		return 1;
+	}
+	return 0;
+}
+
+
+static uint8_t begin(void)
+{
+	uint8_t phr;
+
+	spi_begin();
+	spi_io(AT86RF230_BUF_READ);
+	phr = spi_recv();
+	psdu_len = phr < 2 || phr > MAX_PSDU ? 0 : phr-2;
+	pos = 0;
+	return phr;
+}
+
+
+/* ----- Frame start trigger ----------------------------------------------- */
+
+
+static bool early = 0;		/* decided on the frame being received */
+static bool early_hit;
+static struct rule early_rule;
+static uint8_t early_phr;
+static uint64_t early_end;	/* when its TRX_END is due */
+
+
+void classify_start(void)
+{
+	psdu_t0 = timer_extend(irq_tcnt);
+	early_phr = begin();
+	pacing = 1;
+	early_hit = decide(&early_rule);
+	pacing = 0;
+	spi_end();
+
+	early_end = psdu_t0+early_phr*BYTE_TICKS;
+	early = 1;
+}
+
+
+/*
+ * A frame RX_AACK rejects raises RX_START but no TRX_END, so make sure the
+ * decision belongs to the frame that just ended.
+ */
+
+static bool early_done(void)
+{
+	uint64_t t;
+
+	if (!early)
+		return 0;
+	early = 0;
+	t = timer_extend(irq_tcnt);
+	return t+BYTE_TICKS >= early_end && t <= early_end+BYTE_TICKS;
+}
+
+
+/* ----- Classification at TRX_END ----------------------------------------- */
+
+
+bool classify_frame(void)
+{
+	struct rule r;
+	uint8_t phr;
+	bool hit;
+
+	if (early_done()) {
+		frame_overwritten(early_phr);
+		if (early_hit)
+			*early_rule.flag = early_rule.set;
+		return early_hit;
+	}
+
+	phr = begin();
+	hit = decide(&r);
+	if (hit)
+		*r.flag = r.set;
+
+	if (pos <= sizeof(head))
+		frame_readback(phr, head, pos);
+	else
+		frame_overwritten(phr);
+	spi_end();
+
+	return hit;
+}
@@ -0,0 +1,31 @@
+/*
+ * fw/attacks/classify.h - Incremental classification of received frames
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef CLASSIFY_H
+#define	CLASSIFY_H
+
+#include <stdbool.h>
+
+
+/*
+ * classify_frame reads the frame in the frame buffer after TRX_END, header
+ * field by header field, and stops as soon as the first rule that applies
+ * has set its attack flag. It returns whether a rule applied.
+ */
+
+bool classify_frame(void);
+
+/*
+ * classify_start does the reading at RX_START instead, as the frame arrives.
+ * The next classify_frame then only applies the decision.
+ */
+
+void classify_start(void);
+
+#endif /* !CLASSIFY_H */
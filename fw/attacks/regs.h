@@ -0,0 +1,30 @@
+/*
+ * fw/attacks/regs.h - Register batches
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef REGS_H
+#define	REGS_H
+
+#include <stdint.h>
+
+
+struct reg_set {
+	uint8_t reg;
+	uint8_t value;
+};
+
+
+/*
+ * reg_batch writes a list of registers, but skips the ones that already hold
+ * the value. Reconfiguring RX_AACK for the next target then only costs the
+ * address bytes that actually change.
+ */
+
+void reg_batch(const struct reg_set *set, uint8_t n);
+
+#endif /* !REGS_H */
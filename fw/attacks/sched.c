@@ -0,0 +1,109 @@
+/*
+ * fw/attacks/sched.c - Cooperative scheduling of attack steps
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * Instead of busy-waiting between the frames of an attack, each attack is a
+ * chain of tasks with deadlines, and the CPU sleeps until the earliest one.
+ * Several attacks can thus run side by side, while the RF interrupt keeps
+ * answering the frames that need an immediate response.
+ *
+ * Compare unit A belongs to timer_at, so we wake up with compare unit B.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include <avr/io.h>
+#include <avr/sleep.h>
+#include <avr/interrupt.h>
+
+#include "board.h"
+#include "sched.h"
+
+
+static struct task *tasks = NULL;	/* queued tasks, by deadline */
+
+
+ISR(TIMER1_COMPB_vect)
+{
+	/* we only need to wake up */
+}
+
+
+void task_at(struct task *task, uint64_t when)
+{
+	struct task **anchor;
+
+	task_cancel(task);
+	task->when = when;
+	for (anchor = &tasks; *anchor; anchor = &(*anchor)->next)
+		if ((*anchor)->when > when)
+			break;
+	task->next = *anchor;
+	*anchor = task;
+	task->queued = 1;
+}
+
+
+void task_in(struct task *task, uint32_t us)
+{
+	task_at(task, timer_read()+(uint64_t) us*TIMER_TICKS_PER_US);
+}
+
+
+void task_cancel(struct task *task)
+{
+	struct task **anchor;
+
+	if (!task->queued)
+		return;
+	for (anchor = &tasks; *anchor != task; anchor = &(*anchor)->next);
+	*anchor = task->next;
+	task->queued = 0;
+}
+
+
+/*
+ * Like for timer_at, the compare unit matches the low 16 bits of the deadline
+ * once per overflow period, so we may wake up a few times before it is due.
+ */
+
+void sched_poll(void)
+{
+	struct task *task = tasks;
+
+	if (task && timer_read() >= task->when) {
+		tasks = task->next;
+		task->queued = 0;
+		task->fn(task->user);
+		return;
+	}
+
+	cli();
+	if (task) {
+		OCR1B = task->when;
+		TIFR1 = 1 << OCF1B;
+		TIMSK1 |= 1 << OCIE1B;
+	} else {
+		TIMSK1 &= ~(1 << OCIE1B);
+	}
+
+	/* too late for the compare unit to catch it */
+	if (task && timer_read() >= task->when) {
+		sei();
+		return;
+	}
+
+	/* SEI takes effect after SLEEP, so no interrupt can slip in between */
+	sleep_enable();
+	sei();
+	sleep_cpu();
+	sleep_disable();
+}
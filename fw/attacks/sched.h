@@ -0,0 +1,43 @@
+/*
+ * fw/attacks/sched.h - Cooperative scheduling of attack steps
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef SCHED_H
+#define	SCHED_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+/*
+ * A task is one step of an attack. It runs to completion from the main loop
+ * once timer_read has reached "when", and re-queues itself if there is more
+ * to do. Tasks are queued from the main loop only, never from interrupts.
+ */
+
+struct task {
+	void (*fn)(void *user);
+	void *user;
+	uint64_t when;		/* deadline, in timer_read ticks */
+	bool queued;
+	struct task *next;
+};
+
+
+void task_at(struct task *task, uint64_t when);
+void task_in(struct task *task, uint32_t us);
+void task_cancel(struct task *task);
+
+/*
+ * sched_poll runs the first task that is due. If none is, it sleeps until
+ * the next deadline or any other interrupt, whichever comes first.
+ */
+
+void sched_poll(void);
+
+#endif /* !SCHED_H */
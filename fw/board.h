@@ -27,12 +27,17 @@
 #ifdef HULUSB
 #include "board_hulusb.h"
 #endif
+#ifdef HOST
+#include "board_host.h"
+#endif
 
+#ifndef HOST
 #define	SET_2(p, b)	PORT##p |= 1 << (b)
 #define	CLR_2(p, b)	PORT##p &= ~(1 << (b))
 #define	IN_2(p, b)	DDR##p &= ~(1 << (b))
 #define	OUT_2(p, b)	DDR##p |= 1 << (b)
 #define	PIN_2(p, b)	((PIN##p >> (b)) & 1)
+#endif
 
 #define	SET_1(p, b)	SET_2(p, b)
 #define	CLR_1(p, b)	CLR_2(p, b)
@@ -56,16 +61,23 @@
 
 #define	BOARD_MAX_mA	40
 
+#define	TIMER_TICKS_PER_US	8	/* Timer 1 runs at the 8 MHz CPU clock */
+
 #ifdef BOOT_LOADER
 #define	NUM_EPS	1
 #else
-#define	NUM_EPS	2
+#define	NUM_EPS	3
 #endif
 
 #define	HAS_BOARD_SERNUM
 
 extern uint8_t board_sernum[42];
 extern uint8_t irq_serial;
+extern uint16_t irq_tcnt;
+
+#ifdef SHADOW_CHECK
+extern uint16_t shadow_errors;
+#endif
 
 
 void reset_rf(void);
@@ -77,6 +89,11 @@ void led(bool on);
 void panic(void);
 
 uint64_t timer_read(void);
+uint64_t timer_extend(uint16_t t);
+void timer_at(uint64_t t, void (*fn)(void));
+void timer_cancel(void (*fn)(void));
+bool timer_pending(void (*fn)(void));
+void timer_wait(void (*fn)(void));
 void timer_init(void);
 
 bool gpio(uint8_t port, uint8_t data, uint8_t dir, uint8_t mask, uint8_t *res);
@@ -90,6 +107,10 @@ uint8_t reg_read(uint8_t reg);
 uint8_t subreg_read(uint8_t address, uint8_t mask, uint8_t position);
 void reg_write(uint8_t reg, uint8_t value);
 void subreg_write(uint8_t address, uint8_t mask, uint8_t position, uint8_t value);
+bool reg_cached(uint8_t reg);
+void regs_overwritten(void);
 void change_state(uint8_t new);
+bool change_state_wait(uint8_t cmd);
+bool tx_wait_done(void);
 
 #endif /* !BOARD_H */
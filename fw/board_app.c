@@ -14,14 +14,19 @@
  */
 
 
+#include <util/atomic.h>
+
 #include "attack.h"
+#include "frame.h"
+#include "classify.h"
+#include "stats.h"
 
 void detect_packet_type(void);
 void clear_flag(void);
-uint8_t save_incomming_packets(unsigned char* buf);
 
 static volatile uint32_t timer_h = 0;	/* 2^(16+32) / 8 MHz = ~1.1 years */
 uint8_t irq_serial;
+uint16_t irq_tcnt;		/* Timer 1 when the last RF interrupt came in */
 uint8_t rejoin_full_flag = 0;
 uint8_t beacon_request_flag = 0;
 uint8_t tc_rejoin_request_flag = 0;
@@ -86,16 +91,314 @@ uint64_t timer_read(void)
 }
 
 
+/*
+ * Turn the 16 bit Timer 1 value t, taken less than one overflow period
+ * (8.2 ms) ago, into a full timer_read value.
+ */
+
+uint64_t timer_extend(uint16_t t)
+{
+	uint64_t now = timer_read();
+
+	return now-(uint16_t) (now-t);
+}
+
+
+/* ----- Timed calls ------------------------------------------------------ */
+
+
+/*
+ * Each function can have one pending call, and a new one for the same
+ * function replaces it. TIMER_CALLS covers all users: tx_start and
+ * burst_send of the HardMAC, and slp_tr of send_zbee_cmd_at.
+ *
+ * The compare unit only sees the low 16 bits of the earliest deadline, so it
+ * matches once per overflow period. The interrupt checks the full time and
+ * keeps waiting until the deadline has really come.
+ */
+
+#define	TIMER_CALLS	4
+
+static struct timer_call {
+	uint64_t t;
+	void (*fn)(void);
+} timer_calls[TIMER_CALLS];
+
+
+static struct timer_call *timer_find(void (*fn)(void))
+{
+	struct timer_call *c;
+
+	for (c = timer_calls; c != timer_calls+TIMER_CALLS; c++)
+		if (c->fn == fn)
+			return c;
+	return NULL;
+}
+
+
+/* make the calls that are due, and set up the compare unit for the next */
+
+static void timer_run(void)
+{
+	struct timer_call *c, *next;
+	void (*fn)(void);
+
+	while (1) {
+		next = NULL;
+		for (c = timer_calls; c != timer_calls+TIMER_CALLS; c++)
+			if (c->fn && (!next || c->t < next->t))
+				next = c;
+		TIMSK1 &= ~(1 << OCIE1A);
+		if (!next)
+			return;
+		if (timer_read() < next->t) {
+			OCR1A = next->t;
+			TIFR1 = 1 << OCF1A;
+			TIMSK1 |= 1 << OCIE1A;
+			/* too late for the compare unit to catch it ? */
+			if (timer_read() < next->t)
+				return;
+			TIMSK1 &= ~(1 << OCIE1A);
+		}
+		fn = next->fn;
+		next->fn = NULL;
+		fn();
+	}
+}
+
+
+ISR(TIMER1_COMPA_vect)
+{
+	timer_run();
+}
+
+
+/*
+ * Call fn from the Timer 1 compare match interrupt when timer_read reaches t.
+ * A deadline that has already passed calls fn right away.
+ */
+
+void timer_at(uint64_t t, void (*fn)(void))
+{
+	struct timer_call *c;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		c = timer_find(fn);
+		if (!c)
+			c = timer_find(NULL);
+		if (c) {
+			c->t = t;
+			c->fn = fn;
+		}
+		timer_run();
+	}
+}
+
+
+void timer_cancel(void (*fn)(void))
+{
+	struct timer_call *c;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		c = timer_find(fn);
+		if (c)
+			c->fn = NULL;
+		timer_run();
+	}
+}
+
+
+bool timer_pending(void (*fn)(void))
+{
+	bool pending;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+		pending = timer_find(fn);
+	return pending;
+}
+
+
+/*
+ * Wait until the pending call of fn has happened. With interrupts disabled,
+ * e.g., in the RF interrupt, we poll the compare flag instead.
+ */
+
+void timer_wait(void (*fn)(void))
+{
+	while (timer_pending(fn)) {
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+			if (TIFR1 & (1 << OCF1A)) {
+				TIFR1 = 1 << OCF1A;
+				timer_run();
+			}
+		_delay_us(1);
+	}
+}
+
+
+/*
+ * Timed calls, the scheduler and the state waits all need Timer 1, on every
+ * board. We keep the input capture RZUSB has set up in board_app_init.
+ */
+
 void timer_init(void)
 {
 	/* configure timer 1 as a free-running CLK counter */
 
 	TCCR1A = 0;
-	TCCR1B = 1 << CS10;
+	TCCR1B |= 1 << CS10;
 
 	/* enable timer overflow interrupt */
 
-	TIMSK1 = 1 << TOIE1;
+	TIMSK1 |= 1 << TOIE1;
+}
+
+
+/* ----- State transitions ------------------------------------------------ */
+
+
+/*
+ * Transition times from the AT86RF231 data sheet, table 7-1. Leaving TRX_OFF
+ * means waiting for the PLL to settle; everything else is almost immediate.
+ * A frame being received or sent delays any command but the FORCE_ ones until
+ * it ends, which with CSMA-CA and ARET retries can take many frame times.
+ */
+
+#define	PLL_SETTLE_US		110	/* tTR4, tTR6 */
+#define	SWITCH_US		1	/* tTR8, tTR9, tTR12 to tTR14 */
+#define	SLACK_US		32	/* beyond twice the nominal time */
+#define	TX_MAX_US		80000	/* 4 attempts at a 127 byte frame */
+#define	POLL_US			1
+
+
+static uint8_t trx_status(void)
+{
+	return reg_read(REG_TRX_STATUS) & TRX_STATUS_MASK;
+}
+
+
+static bool trx_busy(uint8_t status)
+{
+	switch (status) {
+	case TRX_STATUS_BUSY_RX:
+	case TRX_STATUS_BUSY_TX:
+	case TRX_STATUS_BUSY_RX_AACK:
+	case TRX_STATUS_BUSY_TX_ARET:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+
+/*
+ * Like change_state in board.c, we count polls instead of reading Timer 1, so
+ * that no wait can outlast its timeout, whatever the timer does. Each poll
+ * takes at least POLL_US, so the timeouts are lower bounds.
+ *
+ * Don't look before the nominal time has passed, then poll TRX_STATUS until
+ * it shows one of the two states or we give up.
+ */
+
+static bool await(uint8_t a, uint8_t b, uint16_t nominal_us,
+    uint32_t timeout_us)
+{
+	uint32_t polls = timeout_us/POLL_US;
+	uint8_t status;
+
+	while (nominal_us >= POLL_US) {
+		_delay_us(POLL_US);
+		nominal_us -= POLL_US;
+	}
+	while (1) {
+		status = trx_status();
+		if (status == a || status == b)
+			return 1;
+		if (!polls--)
+			return 0;
+		_delay_us(POLL_US);
+	}
+}
+
+
+/*
+ * Command a state and wait until the transceiver is there, or busy receiving
+ * in it. Returns 0 if it doesn't get there in time.
+ */
+
+bool change_state_wait(uint8_t cmd)
+{
+	uint16_t polls = (2*PLL_SETTLE_US+SLACK_US)/POLL_US;
+	uint8_t from, want, alt;
+	uint16_t nominal;
+	uint32_t timeout;
+	bool force = 0;
+
+	/* finish a transition in progress first */
+	while ((from = trx_status()) == TRX_STATUS_TRANSITION) {
+		if (!polls--)
+			return 0;
+		_delay_us(POLL_US);
+	}
+
+	switch (cmd) {
+	case TRX_CMD_FORCE_TRX_OFF:
+		want = TRX_STATUS_TRX_OFF;
+		force = 1;
+		break;
+	case TRX_CMD_FORCE_PLL_ON:
+		want = TRX_STATUS_PLL_ON;
+		force = 1;
+		/* FORCE_PLL_ON is ignored in TRX_OFF */
+		if (from == TRX_STATUS_TRX_OFF)
+			cmd = TRX_CMD_PLL_ON;
+		break;
+	default:
+		want = cmd;
+		break;
+	}
+	switch (want) {
+	case TRX_STATUS_RX_ON:
+		alt = TRX_STATUS_BUSY_RX;
+		break;
+	case TRX_STATUS_RX_AACK_ON:
+		alt = TRX_STATUS_BUSY_RX_AACK;
+		break;
+	default:
+		alt = want;
+		break;
+	}
+	if (from == want || from == alt)
+		return 1;
+
+	nominal = from == TRX_STATUS_TRX_OFF ? PLL_SETTLE_US : SWITCH_US;
+	if (want == TRX_STATUS_TRX_OFF)
+		nominal = SWITCH_US;
+	timeout = 2*nominal+SLACK_US;
+	if (trx_busy(from) && !force)
+		timeout += TX_MAX_US;
+
+	reg_write(REG_TRX_STATE, cmd);
+	return await(want, alt, nominal, timeout);
+}
+
+
+/* wait until a transmission, if there is one, has ended */
+
+bool tx_wait_done(void)
+{
+	uint32_t polls = TX_MAX_US/POLL_US;
+	uint8_t status;
+
+	while (1) {
+		status = trx_status();
+		if (status != TRX_STATUS_BUSY_TX &&
+		    status != TRX_STATUS_BUSY_TX_ARET)
+			return 1;
+		if (!polls--)
+			return 0;
+		_delay_us(POLL_US);
+	}
 }
 
 
@@ -158,78 +461,6 @@ static void done(void *user)
 }
 
 
-/**
- * @brief  Save incomming packets into buf, and return the stroed packets.
- * @note   We omit the last two SCF bytes. It is used when we detect TX_END interrupt, and calling process_incoming_packets()
- * @param  Output: buf
- * @retval The length of contents in the packet, except for the SCF.
- */
-uint8_t save_incomming_packets(unsigned char* buf)
-{
-	int16_t pkt_len = 0;
-	spi_begin();
-	spi_io(AT86RF230_BUF_READ);
-
-	// Omit the last two bytes
-	pkt_len = spi_recv() - 2;
-	_delay_us(10);
-	assert(pkt_len > 0);
-	// Copy the packet into buf
-	spi_recv_block(buf, pkt_len);
-
-	spi_end();
-
-	return pkt_len;
-}
-
-/**
- * @brief  Parse incomming packets, and set flags used for attacks
- * @note   It is called when we detect TX_END interrupt.
- * @retval None
- */
-static void process_incomming_packets(void)
-{
-	unsigned char incomming_pkt[MAX_ZBEE_PKT_SIZE] = {};
-	int16_t pkt_len = 0;
-	// First save the incomming packets
-	pkt_len = save_incomming_packets(incomming_pkt);
-	// TODO: Below is ad-hoc packet identification techniques: ARE THEY PROVED?
-	// If the incomming packet is a TC Rejoin Response Command
-	if ((pkt_len == TC_REJOIN_RSP_PKT_SIZE) && (incomming_pkt[TC_REJOIN_RSP_PKT_SIZE- 4] == 0x07)) {
-		uint8_t rejoin_status = incomming_pkt[TC_REJOIN_RSP_PKT_SIZE - 1];
-		if (rejoin_status == 0x00) {
-			// This TC Rejoin Response shows success.
-			rejoin_full_flag = 0;
-		}
-		else if (rejoin_status == 0x01)
-		{
-			// This TC Rejoin Response shows PAN FULL
-			rejoin_full_flag = 1;
-		}
-	}
-	// If the incomming packet is a Beacon Request Command
-	else if ((pkt_len == BEACON_RQ_PKT_SIZE) && (incomming_pkt[BEACON_RQ_PKT_SIZE -1] == 0x07))
-	{
-		beacon_request_flag = 1;
-	}
-	// If the incomming packet is a Data Reuqest Command
-	else if ((pkt_len == DATA_RQ_PKT_SIZE) && (incomming_pkt[DATA_RQ_PKT_SIZE - 1] == 0x04))
-	{
-		data_request_flag = 1;
-	}
-	else if ((pkt_len == TC_REJOIN_REQ_PKT_SIZE))
-	{
-		uint8_t nwk_fcf_high = incomming_pkt[10];
-		if ((nwk_fcf_high & 0x02) == 0) // This packet is unencrypted.
-		{
-			if (incomming_pkt[TC_REJOIN_REQ_PKT_SIZE - 2] == 0x06)
-			{
-				tc_rejoin_request_flag = 1;
-			}
-		}
-	}
-}
-
 void clear_flag(void)
 {
 	rejoin_full_flag = 0;
@@ -238,27 +469,39 @@ void clear_flag(void)
 	data_request_flag = 0;
 }
 
-#if defined(ATUSB) || defined(HULUSB)
-ISR(INT0_vect)
-#endif
+static void rf_irq(void)
+{
+	uint8_t irq;
+
 #ifdef RZUSB
-ISR(TIMER1_CAPT_vect)
+	irq_tcnt = ICR1;	/* input capture latched the IRQ edge */
+#else
+	irq_tcnt = TCNT1;
 #endif
-{
-	uint8_t irq = reg_read(REG_IRQ_STATUS);
+	irq = reg_read(REG_IRQ_STATUS);
 
-	if (irq == IRQ_RX_START) {
+	/*
+	 * Reading the header as it arrives keeps us in the interrupt for its
+	 * airtime, so we only do it when the hijack has to answer right away.
+	 */
+	if ((irq & (IRQ_RX_START | IRQ_TRX_END)) == IRQ_RX_START) {
+		if (PROCESS_RX_PACKET && RX_START_TRIGGER &&
+		    attack_no == ATUSB_ATTACK_HIJACK)
+		{
+			classify_start();
+		}
 	}
 	if (irq == IRQ_AMI)
 	{
 	}
-	if (irq == IRQ_TRX_END) {
-		if (PROCESS_RX_PACKET)
+	if (irq & IRQ_TRX_END) {
+		/* not for the end of a frame the HardMAC sent, e.g., in a burst */
+		if (PROCESS_RX_PACKET && !mac_sending())
 		{
-			process_incomming_packets();
+			classify_frame();
 		}
 		// Implement Hijacking Attack
-		if (attack_no == 3)
+		if (attack_no == ATUSB_ATTACK_HIJACK)
 		{
 			ieee802154_addr fake_hub_addr = hub_addr;
 			aack_config.pass_ARET_check = 0;
@@ -301,7 +544,7 @@ ISR(TIMER1_CAPT_vect)
 		}
 	}
 	if (mac_irq) {
-		if (mac_irq())
+		if (mac_irq(irq))
 			return;
 	}
 	if (eps[1].state == EP_IDLE) {
@@ -309,3 +552,20 @@ ISR(TIMER1_CAPT_vect)
 		usb_send(&eps[1], &irq_serial, 1, done, NULL);
 	}
 }
+
+
+#if defined(ATUSB) || defined(HULUSB) || defined(HOST)
+ISR(INT0_vect)
+#endif
+#ifdef RZUSB
+ISR(TIMER1_CAPT_vect)
+#endif
+{
+	uint16_t t;
+
+	rf_irq();
+	t = TCNT1-irq_tcnt;
+	if (t > stats.irq_max)
+		stats.irq_max = t;
+	stats.irqs++;
+}
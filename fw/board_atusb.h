@@ -36,6 +36,7 @@
 #define	IRQ_RF_BIT	  0
 
 #define SPI_WAIT_DONE()	while (!(UCSR1A & 1 << RXC1))
+#define SPI_WAIT_READY()	while (!(UCSR1A & 1 << UDRE1))
 #define SPI_DATA	UDR1
 
 void set_clkm(void);
@@ -0,0 +1,377 @@
+/*
+ * fw/board_host.c - Board-specific functions of the host build
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * Stands in for board_atusb.c when the firmware runs on the build host. Pins
+ * and the USART that spi.c drives are wired to the transceiver model.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#define F_CPU   8000000UL
+#include <util/delay.h>
+
+#include "usb.h"
+#include "at86rf230.h"
+#include "board.h"
+#include "spi.h"
+#include "sim.h"
+#include "at86rf231.h"
+
+
+static bool spi_initialized = 0;
+static bool selected = 0;
+
+
+/* ----- USART ------------------------------------------------------------- */
+
+
+/*
+ * The USART in MSPI mode, modeled closely enough to run spi.c: a byte written
+ * to UDR1 starts shifting right away if the shifter is idle, and waits in the
+ * transmit buffer (UDRE1 clear) otherwise. Each byte received goes into a two
+ * byte FIFO (RXC1 set while it is not empty).
+ *
+ * Firmware code takes no simulated time, so each access is charged the
+ * instructions that come with it in spi.c's loops, as we expect avr-gcc -Os to
+ * emit them for ATUSB (UCSR1A and UDR1 are in extended I/O space):
+ *
+ *   poll		lds UCSR1A, sbrs, rjmp		5 cycles, 4 on exit
+ *   write		sts UDR1			2 cycles
+ *   read		lds UDR1, ld X+ or st X+,
+ *			subi, brne			7 cycles
+ *
+ * This gives 17 cycles per byte in spi_send_block and spi_recv_block, one more
+ * than it takes to shift a byte, and about 28 cycles for spi_io, where the
+ * call and return take the place of the loop instructions.
+ *
+ * These are counts of the expected code, not measurements: all figures the
+ * simulator derives from them are modeled.
+ */
+
+#define	SPI_BYTE_CYCLES		16	/* 8 bits at 4 MHz */
+#define	SPI_POLL_SAMPLE_CYCLES	2	/* lds, before the flag is sampled */
+#define	SPI_POLL_CYCLES		5	/* lds, sbrs, rjmp */
+#define	SPI_POLL_EXIT_CYCLES	2	/* sbrs skipping rjmp */
+#define	SPI_WRITE_CYCLES	2	/* sts */
+#define	SPI_READ_CYCLES		2	/* lds, before the FIFO is popped */
+#define	SPI_READ_AFTER_CYCLES	5	/* ld X+ or st X+, subi, brne */
+
+#define	UDR1_MARK		0x100
+
+
+static struct {
+	bool shifting;		/* a byte is in the shift register */
+	uint8_t shift;
+	uint64_t shift_end;	/* when it is done, in ns */
+	bool tx_full;		/* a byte waits in the transmit buffer */
+	uint8_t tx;
+	uint8_t rx[2];		/* receive FIFO */
+	uint8_t rx_n;
+	bool access;		/* UDR1 was handed out, not yet examined */
+} usart;
+
+static volatile uint16_t udr1_latch = UDR1_MARK;
+
+
+static void shift_start(uint8_t v)
+{
+	usart.shifting = 1;
+	usart.shift = v;
+	usart.shift_end = sim_now+SPI_BYTE_CYCLES*SIM_NS_PER_CYCLE;
+}
+
+
+static void shift_done(void)
+{
+	uint8_t v = trx_spi(usart.shift);
+
+	if (usart.rx_n == sizeof(usart.rx))
+		sim_fatal("SPI receive FIFO overrun");
+	usart.rx[usart.rx_n++] = v;
+	usart.shifting = 0;
+	if (usart.tx_full) {
+		usart.tx_full = 0;
+		shift_start(usart.tx);
+	}
+}
+
+
+/* let time pass, with the transceiver seeing each byte when it is done */
+
+static void spi_cycles(unsigned cycles)
+{
+	uint64_t t = sim_now+cycles*SIM_NS_PER_CYCLE;
+
+	while (usart.shifting && usart.shift_end <= t) {
+		sim_advance(usart.shift_end-sim_now);
+		shift_done();
+	}
+	sim_advance(t-sim_now);
+}
+
+
+/* the firmware cleared the marker, so it wrote UDR1; otherwise it read it */
+
+static void usart_sync(void)
+{
+	if (!usart.access)
+		return;
+	usart.access = 0;
+	if (!(udr1_latch & UDR1_MARK)) {
+		spi_cycles(SPI_WRITE_CYCLES);
+		if (usart.tx_full)
+			sim_fatal("SPI transmit buffer overrun");
+		if (usart.shifting) {
+			usart.tx_full = 1;
+			usart.tx = udr1_latch;
+		} else {
+			shift_start(udr1_latch);
+		}
+	} else {
+		spi_cycles(SPI_READ_CYCLES);
+		if (!usart.rx_n)
+			sim_fatal("SPI receive FIFO read while empty");
+		usart.rx[0] = usart.rx[1];
+		usart.rx_n--;
+		spi_cycles(SPI_READ_AFTER_CYCLES);
+	}
+}
+
+
+volatile uint16_t *sim_udr1(void)
+{
+	usart_sync();
+	udr1_latch = UDR1_MARK | usart.rx[0];
+	usart.access = 1;
+	return &udr1_latch;
+}
+
+
+static uint8_t ucsr1a(void)
+{
+	return !usart.tx_full << UDRE1 | (usart.rx_n != 0) << RXC1;
+}
+
+
+void sim_spi_wait(uint8_t flag)
+{
+	usart_sync();
+	while (1) {
+		spi_cycles(SPI_POLL_SAMPLE_CYCLES);
+		if (ucsr1a() & flag)
+			break;
+		if (!usart.shifting)
+			sim_fatal("SPI wait for 0x%02x never ends", flag);
+		spi_cycles(SPI_POLL_CYCLES-SPI_POLL_SAMPLE_CYCLES);
+	}
+	spi_cycles(SPI_POLL_EXIT_CYCLES);
+}
+
+
+/* ----- Pins -------------------------------------------------------------- */
+
+
+static volatile uint8_t *port(char p)
+{
+	switch (p) {
+	case 'B':
+		return &PORTB;
+	case 'C':
+		return &PORTC;
+	case 'D':
+		return &PORTD;
+	default:
+		sim_fatal("no port %c", p);
+	}
+}
+
+
+static volatile uint8_t *ddr(char p)
+{
+	switch (p) {
+	case 'B':
+		return &DDRB;
+	case 'C':
+		return &DDRC;
+	case 'D':
+		return &DDRD;
+	default:
+		sim_fatal("no port %c", p);
+	}
+}
+
+
+#define	STR_2(x)	#x
+#define	STR(x)		STR_2(x)
+#define	PORT_OF(n)	STR(n##_PORT)[0]
+#define	IS_PIN(n, p, b)	((p) == PORT_OF(n) && (b) == n##_BIT)
+
+
+void sim_gpio(char p, uint8_t bit, bool on)
+{
+	volatile uint8_t *reg = port(p);
+	bool old = *reg >> bit & 1;
+
+	if (on)
+		*reg |= 1 << bit;
+	else
+		*reg &= ~(1 << bit);
+	if (old == on)
+		return;
+
+	if (IS_PIN(nSS, p, bit)) {
+		if (!on) {
+			sim_lock();
+			trx_select();
+			selected = 1;
+		} else if (selected) {
+			usart_sync();
+			if (usart.shifting || usart.tx_full)
+				sim_fatal("nSS raised during an SPI byte");
+			trx_deselect();
+			selected = 0;
+			sim_unlock();
+		}
+	}
+	if (IS_PIN(SLP_TR, p, bit) && on)
+		trx_slp_tr();
+	if (IS_PIN(nRST_RF, p, bit) && on)
+		trx_reset();
+}
+
+
+void sim_gpio_dir(char p, uint8_t bit, bool out)
+{
+	volatile uint8_t *reg = ddr(p);
+
+	if (out)
+		*reg |= 1 << bit;
+	else
+		*reg &= ~(1 << bit);
+}
+
+
+uint8_t sim_pin(char p)
+{
+	uint8_t v = *port(p);
+
+	if (p == PORT_OF(IRQ_RF)) {
+		v &= ~(1 << IRQ_RF_BIT);
+		v |= trx_irq() << IRQ_RF_BIT;
+	}
+	return v;
+}
+
+
+static void irq_rf(bool level)
+{
+	if (sim_verbose)
+		sim_trace("irq %u", level);
+	if (level)
+		sim_raise(SIM_INT0);	/* INT0 triggers on the rising edge */
+}
+
+
+/* ----- SPI --------------------------------------------------------------- */
+
+
+void spi_begin(void)
+{
+	if (!spi_initialized)
+		spi_init();
+	CLR(nSS);
+}
+
+
+void spi_off(void)
+{
+	spi_initialized = 0;
+}
+
+
+void spi_init(void)
+{
+	SET(nSS);
+	OUT(nSS);
+	spi_initialized = 1;
+}
+
+
+/* ----- Board ------------------------------------------------------------- */
+
+
+void reset_rf(void)
+{
+	DDRB = 0;
+	DDRC = 0;
+	DDRD = 0;
+	PORTB = 0;
+	PORTC = 0;
+	PORTD = 0;
+
+	OUT(LED);
+	OUT(nRST_RF);
+	OUT(SLP_TR);
+
+	spi_init();
+	regs_overwritten();
+
+	CLR(nRST_RF);
+	_delay_us(2);
+	SET(nRST_RF);
+
+	_delay_us(2);
+
+	set_clkm();
+}
+
+
+void led(bool on)
+{
+	if (on)
+		SET(LED);
+	else
+		CLR(LED);
+}
+
+
+void set_clkm(void)
+{
+	spi_begin();
+	spi_send(AT86RF230_REG_WRITE | REG_TRX_CTRL_0);
+	spi_send(CLKM_CTRL_8MHz);
+	spi_end();
+}
+
+
+void board_init(void)
+{
+	trx_hooks.irq = irq_rf;
+	get_sernum();
+}
+
+
+void usb_init(void)
+{
+	ep_init();
+}
+
+
+void board_app_init(void)
+{
+	/* enable INT0, trigger on rising edge */
+	EICRA = 1 << 1 | 1 << 0;
+	EIMSK = 1 << 0;
+}
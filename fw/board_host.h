@@ -0,0 +1,56 @@
+/*
+ * fw/board_host.h - Board-specific definitions of the host build
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef BOARD_HOST_H
+#define	BOARD_HOST_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "sim.h"
+
+/* same wiring as ATUSB */
+
+#define	LED_PORT	B
+#define	LED_BIT		  6
+#define	nRST_RF_PORT	C
+#define	nRST_RF_BIT	  7
+#define	SLP_TR_PORT	B
+#define	SLP_TR_BIT	  4
+
+#define	nSS_PORT	D
+#define	nSS_BIT		  1
+#define	IRQ_RF_PORT	D
+#define	IRQ_RF_BIT	  0
+
+/* pin changes go through the simulator, so that the transceiver sees them */
+
+#define	SET_2(p, b)	sim_gpio(#p[0], b, 1)
+#define	CLR_2(p, b)	sim_gpio(#p[0], b, 0)
+#define	IN_2(p, b)	sim_gpio_dir(#p[0], b, 0)
+#define	OUT_2(p, b)	sim_gpio_dir(#p[0], b, 1)
+#define	PIN_2(p, b)	((sim_pin(#p[0]) >> (b)) & 1)
+
+/*
+ * The USART in MSPI mode, as on ATUSB. The wait loops are left to the
+ * simulator, which knows which flag they poll.
+ */
+
+#define	SPI_WAIT_DONE()		sim_spi_wait(1 << RXC1)
+#define	SPI_WAIT_READY()	sim_spi_wait(1 << UDRE1)
+#define	SPI_DATA		UDR1
+
+void set_clkm(void);
+void board_init(void);
+
+void spi_begin(void);
+void spi_off(void);
+void spi_init(void);
+
+#endif /* !BOARD_HOST_H */
@@ -48,6 +48,7 @@ void reset_rf(void)
 	OUT(SLP_TR);
 
 	spi_init();
+	regs_overwritten();
 
 	/* AT86RF212 data sheet, Appendix B, p166 Power-On Reset procedure */
 	/*-----------------------------------------------------------------*/
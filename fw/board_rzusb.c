@@ -45,6 +45,7 @@ void reset_rf(void)
 	OUT(SLP_TR);
 
 	spi_init();
+	regs_overwritten();
 
 	/* AT86RF231 data sheet, 12.4.13, reset pulse width: 625 ns (min) */
 
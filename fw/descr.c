@@ -29,7 +29,7 @@ const uint8_t device_descriptor[18] = {
 	USB_CLASS_VENDOR_SPEC,	/* bDeviceClass */
 	0x00,			/* bDeviceSubClass */
 	0x00,			/* bDeviceProtocol */
-	EP0_SIZE,		/* bMaxPacketSize */
+	APP_EP0_SIZE,		/* bMaxPacketSize */
 	LE(USB_VENDOR),		/* idVendor */
 	LE(USB_PRODUCT),	/* idProduct */
 	LE(0x0001),		/* bcdDevice */
@@ -54,9 +54,9 @@ const uint8_t config_descriptor[] = {
 	9,			/* bLength */
 	USB_DT_CONFIG,		/* bDescriptorType */
 #if 0
-	LE(9+9+7+7),		/* wTotalLength */
+	LE(9+9+7+7+7),		/* wTotalLength */
 #else
-	LE(9+9+7+9),		/* wTotalLength */
+	LE(9+9+7+7+9),		/* wTotalLength */
 #endif
 	2,			/* bNumInterfaces */
 	1,			/* bConfigurationValue (> 0 !) */
@@ -70,7 +70,7 @@ const uint8_t config_descriptor[] = {
 	USB_DT_INTERFACE,	/* bDescriptorType */
 	0,			/* bInterfaceNumber */
 	0,			/* bAlternateSetting */
-	1,			/* bNumEndpoints */
+	2,			/* bNumEndpoints */
 	USB_CLASS_VENDOR_SPEC,	/* bInterfaceClass */
 	0,			/* bInterfaceSubClass */
 	0,			/* bInterfaceProtocol */
@@ -98,6 +98,15 @@ const uint8_t config_descriptor[] = {
 	0,			/* bInterval */
 #endif
 
+	/* EP IN, TX events */
+
+	7,			/* bLength */
+	USB_DT_ENDPOINT,	/* bDescriptorType */
+	0x82,			/* bEndPointAddress */
+	0x03,			/* bmAttributes (interrupt) */
+	LE(EP2_SIZE),		/* wMaxPacketSize */
+	1,			/* bInterval (ms) */
+
 	/* Interface #1 */
 
 	DFU_ITF_DESCR(1, 0, dfu_proto_runtime, 0)
@@ -36,6 +36,9 @@
 #include "sernum.h"
 #include "spi.h"
 #include "mac.h"
+#include "stats.h"
+#include "frame.h"
+#include "target.h"
 
 #ifdef ATUSB
 #define	HW_TYPE		ATUSB_HW_TYPE_110131
@@ -49,6 +52,10 @@
 #define HW_TYPE		ATUSB_HW_TYPE_HULUSB
 #endif
 
+#ifdef HOST
+#define	HW_TYPE		ATUSB_HW_TYPE_110131
+#endif
+
 #ifdef DEBUG
 #include "uart.h"
 #include <stdio.h>
@@ -65,6 +72,15 @@ static uint8_t buf[MAX_PSDU+3]; /* command, PHDR, and LQI */
 static uint8_t size;
 
 
+static uint8_t target_role;	/* of the ATUSB_TARGET_WRITE in progress */
+
+
+static void do_target_write(void *user)
+{
+	target_write(target_role, buf, size);
+}
+
+
 static void do_eeprom_write(void *user)
 {
 	int i;
@@ -75,12 +91,12 @@ static void do_eeprom_write(void *user)
 
 static void do_buf_write(void *user)
 {
-	uint8_t i;
-
 	spi_begin();
-	for (i = 0; i != size; i++)
-		spi_send(buf[i]);
+	spi_send_block(buf, size);
 	spi_end();
+	frame_overwritten(MAX_PSDU);
+	if ((buf[0] & 0xc0) == AT86RF230_REG_WRITE)
+		regs_overwritten();
 }
 
 
@@ -127,6 +143,7 @@ static bool my_setup(const struct setup_request *setup)
 		debug("ATUSB_RF_RESET\n");
 		reset_rf();
 		mac_reset();
+		frame_overwritten(MAX_PSDU);
 		//ep_send_zlp(EP_CTRL);
 		return 1;
 
@@ -168,10 +185,7 @@ static bool my_setup(const struct setup_request *setup)
 
 	case ATUSB_TO_DEV(ATUSB_REG_WRITE):
 		debug("ATUSB_REG_WRITE\n");
-		spi_begin();
-		spi_send(AT86RF230_REG_WRITE | setup->wIndex);
-		spi_send(setup->wValue);
-		spi_end();
+		reg_write(setup->wIndex, setup->wValue);
 		//ep_send_zlp(EP_CTRL);
 		return 1;
 	case ATUSB_FROM_DEV(ATUSB_REG_READ):
@@ -205,8 +219,7 @@ static bool my_setup(const struct setup_request *setup)
 		size = spi_recv();
 		if (size >= setup->wLength)
 			size = setup->wLength-1;
-		for (i = 0; i != size+1; i++)
-			buf[i] = spi_recv();
+		spi_recv_block(buf, size+1);
 		spi_end();
 		usb_send(&eps[0], buf, size+1, NULL, NULL);
 		return 1;
@@ -231,8 +244,7 @@ static bool my_setup(const struct setup_request *setup)
 		spi_begin();
 		spi_send(AT86RF230_SRAM_READ);
 		spi_send(setup->wIndex);
-		for (i = 0; i != setup->wLength; i++)
-			buf[i] = spi_recv();
+		spi_recv_block(buf, setup->wLength);
 		spi_end();
 		usb_send(&eps[0], buf, setup->wLength, NULL, NULL);
 		return 1;
@@ -254,6 +266,9 @@ static bool my_setup(const struct setup_request *setup)
 		spi_send(setup->wValue);
 		spi_send(setup->wIndex);
 		spi_end();
+		frame_overwritten(MAX_PSDU);
+		if ((setup->wValue & 0xc0) == AT86RF230_REG_WRITE)
+			regs_overwritten();
 		buf[0] = irq_serial;
 		if (setup->wLength)
 			usb_send(&eps[0], buf, 1, NULL, NULL);
@@ -265,8 +280,7 @@ static bool my_setup(const struct setup_request *setup)
 		spi_send(setup->wValue);
 		if (req == ATUSB_FROM_DEV(ATUSB_SPI_READ2))
 			spi_send(setup->wIndex);
-		for (i = 0; i != setup->wLength; i++)
-			buf[i] = spi_recv();
+		spi_recv_block(buf, setup->wLength);
 		spi_end();
 		usb_send(&eps[0], buf, setup->wLength, NULL, NULL);
 		return 1;
@@ -275,6 +289,22 @@ static bool my_setup(const struct setup_request *setup)
 		return mac_rx(setup->wValue);
 	case ATUSB_TO_DEV(ATUSB_TX):
 		return mac_tx(setup->wValue, setup->wIndex, setup->wLength);
+	case ATUSB_FROM_DEV(ATUSB_RX_STATS):
+		debug("ATUSB_RX_STATS\n");
+		size = mac_rx_stats(buf, setup->wValue);
+		if (size > setup->wLength)
+			size = setup->wLength;
+		usb_send(&eps[0], buf, size, NULL, NULL);
+		return 1;
+	case ATUSB_TO_DEV(ATUSB_BURST):
+		return mac_burst(setup->wValue, setup->wIndex, setup->wLength);
+	case ATUSB_FROM_DEV(ATUSB_STATS):
+		debug("ATUSB_STATS\n");
+		size = stats_read(buf, setup->wValue);
+		if (size > setup->wLength)
+			size = setup->wLength;
+		usb_send(&eps[0], buf, size, NULL, NULL);
+		return 1;
 	case ATUSB_TO_DEV(ATUSB_EUI64_WRITE):
 		debug("ATUSB_EUI64_WRITE\n");
 		usb_recv(&eps[0], buf, setup->wLength, do_eeprom_write, NULL);
@@ -288,6 +318,32 @@ static bool my_setup(const struct setup_request *setup)
 		usb_send(&eps[0], buf, 8, NULL, NULL);
 		return 1;
 
+	case ATUSB_TO_DEV(ATUSB_TARGET_WRITE):
+		debug("ATUSB_TARGET_WRITE\n");
+		if (setup->wIndex >= ATUSB_TARGETS ||
+		    setup->wLength != ATUSB_TARGET_SIZE)
+			return 0;
+		target_role = setup->wIndex;
+		size = setup->wLength;
+		usb_recv(&eps[0], buf, size, do_target_write, NULL);
+		return 1;
+	case ATUSB_FROM_DEV(ATUSB_TARGET_READ):
+		debug("ATUSB_TARGET_READ\n");
+		if (!target_read(setup->wIndex, buf))
+			return 0;
+		size = setup->wLength;
+		if (size > ATUSB_TARGET_SIZE)
+			size = ATUSB_TARGET_SIZE;
+		usb_send(&eps[0], buf, size, NULL, NULL);
+		return 1;
+	case ATUSB_TO_DEV(ATUSB_TARGET_SAVE):
+		debug("ATUSB_TARGET_SAVE\n");
+		target_save(setup->wValue);
+		return 1;
+	case ATUSB_TO_DEV(ATUSB_ATTACK):
+		debug("ATUSB_ATTACK\n");
+		return attack_select(setup->wValue);
+
 	default:
 		error("Unrecognized SETUP: 0x%02x 0x%02x ...\n",
 		    setup->bmRequestType, setup->bRequest);
@@ -0,0 +1,20 @@
+/*
+ * fw/host/aes.h - AES-128 block encryption for the transceiver model
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef AES_H
+#define	AES_H
+
+#include <stdint.h>
+
+
+/* in and out may be the same buffer */
+
+void aes128_encrypt(const uint8_t *key, const uint8_t *in, uint8_t *out);
+
+#endif /* !AES_H */
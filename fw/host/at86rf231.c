@@ -0,0 +1,826 @@
+/*
+ * fw/host/at86rf231.c - Software model of the AT86RF231 transceiver
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * The model covers what the firmware uses: the register file, the SPI
+ * command set, the frame buffer, the basic and extended TRX state machines,
+ * IRQ_STATUS/IRQ_MASK with the IRQ line, and the AES engine. Timing follows
+ * the AT86RF231 data sheet where it matters for latency: PLL settling,
+ * transmission and reception airtime, ACK turnaround, the CSMA-CA backoff of
+ * TX_ARET, and AES processing.
+ *
+ * Simplifications:
+ * - SRAM address 0 is the first PSDU byte; the PHR is not part of the SRAM
+ * - SLP_TR during a transition towards PLL_ON or TX_ARET_ON is held until
+ *   the transition completes
+ * - no sleep, no CCA measurement, no dynamic frame buffer protection
+ * - the AES engine only encrypts (ECB and CBC), and reading the key returns
+ *   zeroes instead of the last round key
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "at86rf230.h"
+#include "sim.h"
+#include "aes.h"
+#include "at86rf231.h"
+
+
+#define	SHR_BYTES		5
+#define	PLL_SETTLE_NS		110000
+#define	TRANSITION_NS		1000
+#define	TX_START_NS		16000
+#define	TURNAROUND_NS		(12*TRX_SYMBOL_NS)
+#define	ACK_NS			((SHR_BYTES+1+5)*TRX_BYTE_NS)
+#define	ACK_WAIT_NS		(54*TRX_SYMBOL_NS)
+#define	CCA_NS			(8*TRX_SYMBOL_NS)
+#define	BACKOFF_NS		(20*TRX_SYMBOL_NS)
+#define	AES_NS			(AES_US*1000)
+
+
+struct trx_hooks trx_hooks;
+bool trx_peer_acks = 1;
+
+static uint8_t regs[0x40];
+static uint8_t status;		/* TRX_STATUS */
+static uint8_t target;		/* state at the end of the transition */
+static uint8_t deferred;	/* command waiting for the end of a busy state */
+static bool tx_held;		/* SLP_TR arrived during a transition */
+static uint8_t irq_status;
+static bool irq_line;
+
+static uint8_t fb[SRAM_SIZE];
+static uint8_t fb_len;		/* PHR */
+static uint8_t lqi;
+
+static uint8_t rx_frame[MAX_PSDU];
+static uint8_t rx_len;
+static uint8_t rx_lqi;
+static bool rx_fcs_ok;
+static bool rx_aack;
+static bool rx_accept, rx_ack, rx_data_req;
+static uint64_t rx_psdu_t0;	/* first PSDU byte starts arriving */
+
+static uint32_t csma_seed = 1;
+
+static uint8_t aes_ctrl;
+static uint8_t aes_key[AES_BLOCK_SIZE];
+static uint8_t aes_state[AES_BLOCK_SIZE];	/* input, then result */
+static uint8_t aes_prev[AES_BLOCK_SIZE];	/* last result, for CBC */
+static uint64_t aes_done_t;	/* when the current block is done */
+static bool aes_done;		/* AES_DONE */
+
+static uint8_t spi_pos, spi_cmd, spi_addr;
+static uint8_t spi_log[MAX_PSDU+4];
+
+
+/* ----- Helpers ----------------------------------------------------------- */
+
+
+static uint16_t fcs(const uint8_t *buf, uint8_t len)
+{
+	uint16_t crc = 0;
+	uint8_t i;
+
+	while (len--) {
+		crc ^= *buf++;
+		for (i = 0; i != 8; i++)
+			crc = crc & 1 ? (crc >> 1) ^ 0x8408 : crc >> 1;
+	}
+	return crc;
+}
+
+
+static void set_irq(uint8_t bits)
+{
+	uint8_t mask = regs[REG_IRQ_MASK];
+	bool line;
+
+	if (regs[REG_TRX_CTRL_1] & IRQ_MASK_MODE)
+		irq_status |= bits;
+	else
+		irq_status |= bits & mask;
+	line = irq_status & mask;
+	if (line != irq_line) {
+		irq_line = line;
+		if (trx_hooks.irq)
+			trx_hooks.irq(line);
+	}
+}
+
+
+static uint8_t read_irq_status(void)
+{
+	uint8_t res = irq_status;
+
+	irq_status = 0;
+	if (irq_line) {
+		irq_line = 0;
+		if (trx_hooks.irq)
+			trx_hooks.irq(0);
+	}
+	return res;
+}
+
+
+static bool busy(void)
+{
+	switch (status) {
+	case TRX_STATUS_BUSY_RX:
+	case TRX_STATUS_BUSY_TX:
+	case TRX_STATUS_BUSY_RX_AACK:
+	case TRX_STATUS_BUSY_TX_ARET:
+	case TRX_STATUS_TRANSITION:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+
+/* ----- State machine ----------------------------------------------------- */
+
+
+static void command(uint8_t cmd);
+static void start_tx(void);
+
+static void transition_done(void *user);
+static void tx_done(void *user);
+static void rx_start(void *user);
+static void rx_ami(void *user);
+static void rx_end(void *user);
+static void ack_done(void *user);
+
+static struct sim_event transition_ev = { .fn = transition_done };
+static struct sim_event tx_ev = { .fn = tx_done };
+static struct sim_event rx_start_ev = { .fn = rx_start };
+static struct sim_event rx_ami_ev = { .fn = rx_ami };
+static struct sim_event rx_end_ev = { .fn = rx_end };
+static struct sim_event ack_ev = { .fn = ack_done };
+
+
+static void idle(uint8_t state)
+{
+	uint8_t cmd = deferred;
+
+	status = state;
+	deferred = TRX_CMD_NOP;
+	if (cmd != TRX_CMD_NOP)
+		command(cmd);
+}
+
+
+static void transition_done(void *user)
+{
+	status = target;
+	if (user)
+		set_irq(IRQ_PLL_LOCK);
+	if (tx_held) {
+		tx_held = 0;
+		start_tx();
+		return;
+	}
+	idle(target);
+}
+
+
+static void go(uint8_t state)
+{
+	bool from_off = status == TRX_STATUS_TRX_OFF;
+
+	target = state;
+	status = TRX_STATUS_TRANSITION;
+	transition_ev.user = from_off && state != TRX_STATUS_TRX_OFF ?
+	    &transition_ev : NULL;
+	sim_schedule(&transition_ev,
+	    sim_now+(transition_ev.user ? PLL_SETTLE_NS : TRANSITION_NS));
+}
+
+
+static void abort_all(void)
+{
+	sim_cancel(&transition_ev);
+	sim_cancel(&tx_ev);
+	sim_cancel(&rx_start_ev);
+	sim_cancel(&rx_ami_ev);
+	sim_cancel(&rx_end_ev);
+	sim_cancel(&ack_ev);
+	deferred = TRX_CMD_NOP;
+	tx_held = 0;
+}
+
+
+static void command(uint8_t cmd)
+{
+	switch (cmd) {
+	case TRX_CMD_NOP:
+		return;
+	case TRX_CMD_TX_START:
+		trx_slp_tr();
+		return;
+	case TRX_CMD_FORCE_TRX_OFF:
+		abort_all();
+		go(TRX_STATUS_TRX_OFF);
+		return;
+	case TRX_CMD_FORCE_PLL_ON:
+		if (status == TRX_STATUS_TRX_OFF || status == TRX_STATUS_P_ON)
+			return;
+		abort_all();
+		go(TRX_STATUS_PLL_ON);
+		return;
+	case TRX_CMD_RX_ON:
+	case TRX_CMD_TRX_OFF:
+	case TRX_CMD_PLL_ON:
+	case TRX_CMD_RX_AACK_ON:
+	case TRX_CMD_TX_ARET_ON:
+		break;
+	default:
+		return;
+	}
+	if (busy()) {
+		deferred = cmd;
+		return;
+	}
+	if (status == cmd)
+		return;
+	go(cmd);
+}
+
+
+/* ----- Transmission ------------------------------------------------------ */
+
+
+static uint32_t csma_random(void)
+{
+	csma_seed = csma_seed*1103515245+12345;
+	return csma_seed >> 16;
+}
+
+
+static uint64_t csma_ns(void)
+{
+	uint8_t csma_retries =
+	    regs[REG_XAH_CTRL_0] >> MAX_CSMA_RETRIES_SHIFT &
+	    MAX_CSMA_RETRIES_MASK;
+	uint8_t min_be = regs[REG_CSMA_BE] >> MIN_BE_SHIFT & MIN_BE_MASK;
+
+	if (csma_retries == 7)
+		return 0;
+	return (csma_random() % (1 << min_be))*BACKOFF_NS+CCA_NS;
+}
+
+
+static void start_tx(void)
+{
+	bool aret = status == TRX_STATUS_TX_ARET_ON;
+	uint64_t airtime, t;
+	uint8_t retries, len = fb_len;
+	uint16_t crc;
+	bool ack_req;
+
+	if (len < 2)
+		len = 2;
+	if (regs[REG_TRX_CTRL_1] & TX_AUTO_CRC_ON) {
+		crc = fcs(fb, len-2);
+		fb[len-2] = crc;
+		fb[len-1] = crc >> 8;
+	}
+	if (trx_hooks.tx)
+		trx_hooks.tx(fb, len);
+
+	airtime = (SHR_BYTES+1+len)*(uint64_t) TRX_BYTE_NS;
+	t = sim_now+TX_START_NS;
+	if (!aret) {
+		status = TRX_STATUS_BUSY_TX;
+		sim_schedule(&tx_ev, t+airtime);
+		return;
+	}
+
+	status = TRX_STATUS_BUSY_TX_ARET;
+	ack_req = (fb[0] & 0x20) &&
+	    !((fb[1] & 0x0c) == 0x08 && fb[5] == 0xff && fb[6] == 0xff);
+	regs[REG_TRX_STATE] &= ~(TRAC_STATUS_MASK << TRAC_STATUS_SHIFT);
+	if (!ack_req) {
+		sim_schedule(&tx_ev, t+csma_ns()+airtime);
+		return;
+	}
+	if (trx_peer_acks) {
+		sim_schedule(&tx_ev,
+		    t+csma_ns()+airtime+TURNAROUND_NS+ACK_NS);
+		return;
+	}
+	retries = regs[REG_XAH_CTRL_0] >> MAX_FRAME_RETRIES_SHIFT &
+	    MAX_FRAME_RETRIES_MASK;
+	do t += csma_ns()+airtime+ACK_WAIT_NS;
+	while (retries--);
+	regs[REG_TRX_STATE] |= TRAC_STATUS_NO_ACK << TRAC_STATUS_SHIFT;
+	sim_schedule(&tx_ev, t);
+}
+
+
+static void tx_done(void *user)
+{
+	if (trx_hooks.tx_end)
+		trx_hooks.tx_end();
+	idle(status == TRX_STATUS_BUSY_TX_ARET ?
+	    TRX_STATUS_TX_ARET_ON : TRX_STATUS_PLL_ON);
+	set_irq(IRQ_TRX_END);
+}
+
+
+void trx_slp_tr(void)
+{
+	if (trx_hooks.slp_tr)
+		trx_hooks.slp_tr();
+	switch (status) {
+	case TRX_STATUS_PLL_ON:
+	case TRX_STATUS_TX_ARET_ON:
+		start_tx();
+		break;
+	case TRX_STATUS_TRANSITION:
+		if (target == TRX_STATUS_PLL_ON ||
+		    target == TRX_STATUS_TX_ARET_ON)
+			tx_held = 1;
+		break;
+	default:
+		break;
+	}
+}
+
+
+/* ----- Reception --------------------------------------------------------- */
+
+
+static bool addr_is(const uint8_t *p, uint8_t reg, uint8_t n)
+{
+	uint8_t i;
+
+	for (i = 0; i != n; i++)
+		if (p[i] != regs[reg+i])
+			return 0;
+	return 1;
+}
+
+
+static bool is_bcast(const uint8_t *p)
+{
+	return p[0] == 0xff && p[1] == 0xff;
+}
+
+
+/*
+ * Third-level frame filtering of RX_AACK. Also determines where the address
+ * fields end, whether the frame gets acknowledged, and whether it is a MAC
+ * Data Request command.
+ */
+
+static bool aack_accept(uint8_t *hdr, bool *ack, bool *data_req)
+{
+	const uint8_t *f = rx_frame;
+	uint16_t fcf = f[0] | f[1] << 8;
+	uint8_t type = fcf & 7;
+	uint8_t dst_mode = fcf >> 10 & 3;
+	uint8_t src_mode = fcf >> 14 & 3;
+	bool pan_comp = fcf & 0x40;
+	uint8_t pos = 3;
+	const uint8_t *dst_pan = NULL, *dst = NULL, *src_pan;
+
+	*hdr = pos;
+	*ack = 0;
+	*data_req = 0;
+	if (regs[REG_XAH_CTRL_1] & AACK_PROM_MODE)
+		return 1;
+	if (dst_mode) {
+		dst_pan = f+pos;
+		dst = f+pos+2;
+		pos += dst_mode == 3 ? 10 : 4;
+	}
+	src_pan = dst_pan && pan_comp ? dst_pan : f+pos;
+	if (src_mode) {
+		if (!(dst_pan && pan_comp))
+			pos += 2;
+		pos += src_mode == 3 ? 8 : 2;
+	}
+	if (pos > rx_len-2)
+		return 0;
+	*hdr = pos;
+
+	if (!dst_mode) {
+		if (type == 0)
+			return is_bcast(regs+REG_PAN_ID_0) ||
+			    addr_is(src_pan, REG_PAN_ID_0, 2);
+		if (!(regs[REG_CSMA_SEED_1] & I_AM_COORD))
+			return 0;
+		if (!addr_is(src_pan, REG_PAN_ID_0, 2))
+			return 0;
+	} else {
+		if (!is_bcast(dst_pan) && !addr_is(dst_pan, REG_PAN_ID_0, 2))
+			return 0;
+		if (dst_mode == 2 && !is_bcast(dst) &&
+		    !addr_is(dst, REG_SHORT_ADDR_0, 2))
+			return 0;
+		if (dst_mode == 3 && !addr_is(dst, REG_IEEE_ADDR_0, 8))
+			return 0;
+	}
+	*ack = (fcf & 0x20) && !(dst_mode == 2 && is_bcast(dst));
+	*data_req = type == 3 && pos < rx_len-2 && f[pos] == 0x04;
+	return 1;
+}
+
+
+static void rx_start(void *user)
+{
+	set_irq(IRQ_RX_START);
+}
+
+
+static void rx_ami(void *user)
+{
+	set_irq(IRQ_AMI);
+}
+
+
+static void rx_end(void *user)
+{
+	if (trx_hooks.rx_end)
+		trx_hooks.rx_end();
+	memcpy(fb, rx_frame, rx_len);
+	fb_len = rx_len;
+	lqi = rx_lqi;
+	if (rx_fcs_ok)
+		regs[REG_PHY_RSSI] |= RX_CRC_VALID;
+	else
+		regs[REG_PHY_RSSI] &= ~RX_CRC_VALID;
+	if (!rx_aack) {
+		idle(TRX_STATUS_RX_ON);
+		set_irq(IRQ_TRX_END);
+		return;
+	}
+	if (!rx_accept) {
+		idle(TRX_STATUS_RX_AACK_ON);
+		return;
+	}
+	set_irq(IRQ_TRX_END);
+	if (rx_ack && rx_fcs_ok &&
+	    !(regs[REG_CSMA_SEED_1] & AACK_DIS_ACK)) {
+		ack_ev.user = (void *) (uintptr_t) (rx_data_req &&
+		    (regs[REG_CSMA_SEED_1] & AACK_SET_PD));
+		sim_schedule(&ack_ev, sim_now+TURNAROUND_NS+ACK_NS);
+		return;
+	}
+	idle(TRX_STATUS_RX_AACK_ON);
+}
+
+
+static void ack_done(void *user)
+{
+	if (trx_hooks.ack)
+		trx_hooks.ack(rx_frame[2], user != NULL);
+	idle(TRX_STATUS_RX_AACK_ON);
+}
+
+
+bool trx_receive(const uint8_t *psdu, uint8_t len, uint8_t lqi_value,
+    bool fcs_ok)
+{
+	uint16_t crc;
+	uint8_t hdr;
+
+	if (len > MAX_PSDU-2)
+		return 0;
+	if (status != TRX_STATUS_RX_ON && status != TRX_STATUS_RX_AACK_ON)
+		return 0;
+	memcpy(rx_frame, psdu, len);
+	crc = fcs(psdu, len);
+	if (!fcs_ok)
+		crc = ~crc;
+	rx_frame[len] = crc;
+	rx_frame[len+1] = crc >> 8;
+	rx_len = len+2;
+	rx_lqi = lqi_value;
+	rx_fcs_ok = fcs_ok;
+	rx_aack = status == TRX_STATUS_RX_AACK_ON;
+	status = rx_aack ? TRX_STATUS_BUSY_RX_AACK : TRX_STATUS_BUSY_RX;
+	rx_psdu_t0 = sim_now+(SHR_BYTES+1)*(uint64_t) TRX_BYTE_NS;
+	sim_schedule(&rx_start_ev, rx_psdu_t0);
+	if (rx_aack) {
+		rx_accept = aack_accept(&hdr, &rx_ack, &rx_data_req);
+		if (rx_accept)
+			sim_schedule(&rx_ami_ev,
+			    rx_psdu_t0+hdr*(uint64_t) TRX_BYTE_NS);
+	}
+	sim_schedule(&rx_end_ev, rx_psdu_t0+rx_len*(uint64_t) TRX_BYTE_NS);
+	return 1;
+}
+
+
+/* ----- Frame buffer ------------------------------------------------------ */
+
+
+static bool receiving(void)
+{
+	return rx_end_ev.queued && sim_now >= rx_psdu_t0;
+}
+
+
+/* during reception, bytes appear in the frame buffer as they arrive */
+
+static uint8_t fb_read(uint8_t pos)
+{
+	if (pos >= SRAM_SIZE)
+		return 0;
+	if (receiving() && pos < rx_len &&
+	    sim_now >= rx_psdu_t0+(pos+1)*(uint64_t) TRX_BYTE_NS)
+		return rx_frame[pos];
+	return fb[pos];
+}
+
+
+static uint8_t buf_read(uint8_t pos)
+{
+	uint8_t len = receiving() ? rx_len : fb_len;
+
+	if (!pos)
+		return len;
+	pos--;
+	if (pos < len)
+		return fb_read(pos);
+	if (pos == len)
+		return lqi;
+	return 0;
+}
+
+
+/* ----- Registers --------------------------------------------------------- */
+
+
+static uint8_t reg_read(uint8_t reg)
+{
+	switch (reg) {
+	case REG_TRX_STATUS:
+		return status;
+	case REG_IRQ_STATUS:
+		return read_irq_status();
+	default:
+		return regs[reg];
+	}
+}
+
+
+static void reg_write(uint8_t reg, uint8_t value)
+{
+	switch (reg) {
+	case REG_TRX_STATUS:
+	case REG_IRQ_STATUS:
+	case REG_PART_NUM:
+	case REG_VERSION_NUM:
+	case REG_MAN_ID_0:
+	case REG_MAN_ID_1:
+		return;
+	case REG_TRX_STATE:
+		regs[reg] = (regs[reg] &
+		    ~(TRX_CMD_MASK << TRX_CMD_SHIFT)) | (value & TRX_CMD_MASK);
+		command(value & TRX_CMD_MASK);
+		return;
+	case REG_IRQ_MASK:
+		regs[reg] = value;
+		set_irq(0);
+		return;
+	default:
+		regs[reg] = value;
+	}
+}
+
+
+/* ----- AES engine -------------------------------------------------------- */
+
+
+static bool aes_busy(void)
+{
+	return aes_done_t && sim_now < aes_done_t;
+}
+
+
+static void aes_request(void)
+{
+	uint8_t mode = aes_ctrl >> AES_MODE_SHIFT & AES_MODE_MASK;
+	uint8_t i;
+
+	if (aes_ctrl & AES_DIR)
+		sim_fatal("AES decryption is not modeled");
+	switch (mode) {
+	case AES_MODE_ECB:
+		break;
+	case AES_MODE_CBC:
+		for (i = 0; i != AES_BLOCK_SIZE; i++)
+			aes_state[i] ^= aes_prev[i];
+		break;
+	default:
+		sim_fatal("AES request in mode %u", mode);
+	}
+	aes128_encrypt(aes_key, aes_state, aes_state);
+	memcpy(aes_prev, aes_state, AES_BLOCK_SIZE);
+	aes_done_t = sim_now+AES_NS;
+	aes_done = 0;
+}
+
+
+static uint8_t aes_read(uint8_t addr)
+{
+	switch (addr) {
+	case AES_STATUS:
+		if (!aes_busy() && aes_done_t)
+			aes_done = 1;
+		return aes_done ? AES_DONE : 0;
+	case AES_CTRL:
+	case AES_CTRL_MIRROR:
+		return aes_ctrl;
+	default:
+		if (addr < AES_STATE || addr >= AES_STATE+AES_BLOCK_SIZE)
+			return 0;
+		if ((aes_ctrl >> AES_MODE_SHIFT & AES_MODE_MASK) ==
+		    AES_MODE_KEY)
+			return 0;
+		if (aes_busy())
+			sim_fatal("AES_STATE read while the engine is busy");
+		return aes_state[addr-AES_STATE];
+	}
+}
+
+
+/*
+ * Like the chip, we return the previous content of the address, so that a
+ * block can be written while the result of the previous one is read.
+ */
+
+static uint8_t aes_write(uint8_t addr, uint8_t value)
+{
+	uint8_t res = aes_read(addr);
+
+	if (addr < AES_CTRL || addr > AES_CTRL_MIRROR)
+		return res;
+	if (aes_busy())
+		sim_fatal("AES engine written while busy");
+	if (addr == AES_CTRL || addr == AES_CTRL_MIRROR) {
+		aes_ctrl = value & ~AES_REQUEST;
+		if (value & AES_REQUEST)
+			aes_request();
+	} else if ((aes_ctrl >> AES_MODE_SHIFT & AES_MODE_MASK) ==
+	    AES_MODE_KEY) {
+		aes_key[addr-AES_STATE] = value;
+	} else {
+		aes_state[addr-AES_STATE] = value;
+	}
+	return res;
+}
+
+
+/* ----- SPI --------------------------------------------------------------- */
+
+
+static uint8_t phy_status(void)
+{
+	switch (regs[REG_TRX_CTRL_1] >> SPI_CMD_MODE_SHIFT &
+	    SPI_CMD_MODE_MASK) {
+	case SPI_CMD_MODE_TRX_STATUS:
+		return status;
+	case SPI_CMD_MODE_PHY_RSSI:
+		return regs[REG_PHY_RSSI];
+	case SPI_CMD_MODE_IRQ_STATUS:
+		return irq_status;
+	default:
+		return 0;
+	}
+}
+
+
+void trx_select(void)
+{
+	spi_pos = 0;
+}
+
+
+uint8_t trx_spi(uint8_t mosi)
+{
+	uint8_t pos = spi_pos, res = 0;
+
+	if (spi_pos != 0xff)
+		spi_pos++;
+	if (!pos) {
+		spi_cmd = mosi;
+		return phy_status();
+	}
+
+	if ((spi_cmd & 0xc0) == AT86RF230_REG_WRITE) {
+		if (pos == 1)
+			reg_write(spi_cmd & 0x3f, mosi);
+		res = mosi;
+	} else if ((spi_cmd & 0xc0) == AT86RF230_REG_READ) {
+		if (pos == 1)
+			res = reg_read(spi_cmd & 0x3f);
+	} else if ((spi_cmd & 0xe0) == AT86RF230_BUF_WRITE) {
+		if (pos == 1)
+			fb_len = mosi & 0x7f;
+		else if (pos-2 < MAX_PSDU)
+			fb[pos-2] = mosi;
+		res = mosi;
+	} else if ((spi_cmd & 0xe0) == AT86RF230_BUF_READ) {
+		res = buf_read(pos-1);
+	} else if (pos == 1) {
+		spi_addr = mosi;
+		res = mosi;
+	} else if ((spi_cmd & 0xe0) == AT86RF230_SRAM_WRITE) {
+		if (spi_addr >= SRAM_SIZE) {
+			res = aes_write(spi_addr, mosi);
+		} else {
+			fb[spi_addr] = mosi;
+			res = mosi;
+		}
+		spi_addr++;
+	} else if (spi_addr >= SRAM_SIZE) {
+		res = aes_read(spi_addr++);
+	} else {
+		res = fb_read(spi_addr++);
+	}
+
+	if (pos-1 < (int) sizeof(spi_log))
+		spi_log[pos-1] = res;
+	return res;
+}
+
+
+void trx_deselect(void)
+{
+	uint8_t len = spi_pos ? spi_pos-1 : 0;
+
+	if (trx_hooks.spi && spi_pos)
+		trx_hooks.spi(spi_cmd, spi_log,
+		    len < sizeof(spi_log) ? len : sizeof(spi_log));
+	spi_pos = 0;
+}
+
+
+/* ----- Pins -------------------------------------------------------------- */
+
+
+bool trx_irq(void)
+{
+	return irq_line;
+}
+
+
+uint8_t trx_state(void)
+{
+	return status;
+}
+
+
+void trx_reset(void)
+{
+	abort_all();
+	memset(regs, 0, sizeof(regs));
+	regs[REG_TRX_CTRL_0] = 0x19;
+	regs[REG_TRX_CTRL_1] = TX_AUTO_CRC_ON | IRQ_MASK_MODE;
+	regs[REG_PHY_TX_PWR] = 0xc0;
+	regs[REG_PHY_CC_CCA] = 0x2b;
+	regs[REG_CCA_THRES] = 0xc7;
+	regs[REG_RX_CTRL] = 0xb7;
+	regs[REG_SFD_VALUE] = 0xa7;
+	regs[REG_ANT_DIV] = 0x03;
+	regs[REG_VREG_CTRL] = AVDD_OK | DVDD_OK;
+	regs[REG_BATMON] = 0x02;
+	regs[REG_XOSC_CTRL] = 0xf0;
+	regs[REG_RX_SYN] = 0x08;
+	regs[REG_PART_NUM] = 0x03;
+	regs[REG_VERSION_NUM] = 0x02;
+	regs[REG_MAN_ID_0] = 0x1f;
+	regs[REG_SHORT_ADDR_0] = regs[REG_SHORT_ADDR_1] = 0xff;
+	regs[REG_PAN_ID_0] = regs[REG_PAN_ID_1] = 0xff;
+	regs[REG_XAH_CTRL_0] = 0x38;
+	regs[REG_CSMA_SEED_0] = 0xea;
+	regs[REG_CSMA_SEED_1] = 0x42;
+	regs[REG_CSMA_BE] = 0x53;
+	memset(fb, 0, sizeof(fb));
+	fb_len = 0;
+	aes_ctrl = 0;
+	aes_done_t = 0;
+	aes_done = 0;
+	lqi = 0;
+	irq_status = 0;
+	if (irq_line) {
+		irq_line = 0;
+		if (trx_hooks.irq)
+			trx_hooks.irq(0);
+	}
+	status = TRX_STATUS_TRX_OFF;
+	deferred = TRX_CMD_NOP;
+	spi_pos = 0;
+}
@@ -0,0 +1,52 @@
+/*
+ * fw/host/at86rf231.h - Software model of the AT86RF231 transceiver
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef AT86RF231_H
+#define	AT86RF231_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+#define	TRX_SYMBOL_NS	16000		/* 2.4 GHz O-QPSK, 62.5 ksymbol/s */
+#define	TRX_BYTE_NS	(2*TRX_SYMBOL_NS)
+
+
+/* what the transceiver does on its own, for the simulator to report */
+
+struct trx_hooks {
+	void (*irq)(bool level);
+	void (*tx)(const uint8_t *psdu, uint8_t len);
+	void (*ack)(uint8_t seq, bool pending);
+	void (*rx_end)(void);
+	void (*tx_end)(void);
+	void (*slp_tr)(void);
+	void (*spi)(uint8_t cmd, const uint8_t *buf, uint8_t len);
+};
+
+extern struct trx_hooks trx_hooks;
+
+/* the other end of the link: acknowledge our ARET frames ? */
+
+extern bool trx_peer_acks;
+
+
+void trx_reset(void);
+
+void trx_select(void);
+uint8_t trx_spi(uint8_t mosi);
+void trx_deselect(void);
+
+void trx_slp_tr(void);
+bool trx_irq(void);
+
+bool trx_receive(const uint8_t *psdu, uint8_t len, uint8_t lqi, bool fcs_ok);
+uint8_t trx_state(void);
+
+#endif /* !AT86RF231_H */
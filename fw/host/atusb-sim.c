@@ -0,0 +1,658 @@
+/*
+ * fw/host/atusb-sim.c - Run the ATUSB firmware against a simulated transceiver
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * The simulator takes the place of atusb.c: it initializes the firmware the
+ * same way, then plays the role of the USB host and of the other radios on
+ * the channel, following a script. Each script line is one command:
+ *
+ * reset			ATUSB_RF_RESET
+ * rx on [batch] [stamp] [events]|off
+ *				ATUSB_RX_MODE, optionally with ATUSB_RX_MODE_BATCH,
+ *				ATUSB_RX_MODE_TIMESTAMP, and
+ *				ATUSB_RX_MODE_TX_EVENTS
+ * rxstats [clear]		ATUSB_RX_STATS
+ * drops MAX			ATUSB_RX_STATS, fail if more than MAX frames were
+ *				dropped
+ * stats [clear]		ATUSB_STATS
+ * poll USEC [NAK_USEC]		set the EP1 IN token interval (-p) and, optionally,
+ *				the NAK retry interval (-n)
+ * reg ADDR [VALUE]		ATUSB_REG_READ, or ATUSB_REG_WRITE with VALUE
+ * tx SEQ HEX...		ATUSB_TX of the PSDU (without FCS)
+ * tx at USEC SEQ HEX...	same, with ATUSB_TX_AT, USEC microseconds after
+ *				reading ATUSB_TIMER
+ * burst COUNT GAP_USEC SEQ FIELDS|- HEX...
+ *				ATUSB_BURST of the PSDU (without FCS), with
+ *				FIELDS as OFFSET:SIZE[,OFFSET:SIZE...]
+ * burst stop			ATUSB_BURST with a count of 0
+ * frame HEX...			a frame arrives over the air
+ * badframe HEX...		same, but with an FCS error
+ * at USEC frame|badframe HEX...	same, USEC microseconds from now
+ * peer ack|noack		whether the peer acknowledges our ARET frames
+ * wait USEC			let time pass
+ * attack capacity|offline|hijack	run one of the attacks
+ * attack_no N			ATUSB_ATTACK, e.g., 3 for the hijacking path
+ * target hub|bulb|victim [HEX...]	ATUSB_TARGET_READ, or ATUSB_TARGET_WRITE
+ *				with HEX
+ * target save|erase		ATUSB_TARGET_SAVE
+ * bench NAME USEC [now|tx] [read|confirm]
+ *				measure the time from the end of the next
+ *				received frame (or from now, or from the end of
+ *				the next frame we transmit) to SLP_TR (or to
+ *				the end of reading the whole frame, or until the
+ *				host has the confirmation of a transmission), and
+ *				compare it with a budget of USEC microseconds
+ * expect HEX...		the next frame we transmit must be this PSDU
+ *				(without FCS)
+ * # ...			comment, also at the end of a line
+ *
+ * Everything the firmware does towards the outside is reported on standard
+ * output, prefixed with the simulated time in microseconds. The exit status
+ * is non-zero if any benchmark exceeded its budget, if we didn't transmit
+ * what a script expected, if we dropped more frames than it allowed, or,
+ * with SHADOW_CHECK, if a register read from the shadow didn't match the
+ * transceiver.
+ */
+
+#include <ctype.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "attack.h"
+#include "target.h"
+#include "sernum.h"
+#include "sim.h"
+#include "at86rf231.h"
+#include "usb_host.h"
+#include "bench.h"
+
+
+#define	MAX_LINE	1024
+
+
+extern uint8_t attack_no;
+extern ieee802154_addr hub_addr;
+extern ieee802154_addr victim_addr;
+
+
+/* normally provided by version.c */
+
+const char *build_date = "host build";
+const uint16_t build_number = 0;
+
+
+static const char *script_name;
+static unsigned line_no;
+
+static uint8_t expect_psdu[MAX_PSDU];
+static int expect_len = -1;	/* -1 if we don't expect anything */
+static unsigned expect_failures = 0;
+static unsigned drop_failures = 0;
+
+
+/* ----- Reporting --------------------------------------------------------- */
+
+
+static void report_tx(const uint8_t *psdu, uint8_t len)
+{
+	bool ok;
+
+	sim_trace_hex("air tx", psdu, len);
+	if (expect_len < 0)
+		return;
+
+	/* the PSDU includes the FCS the transceiver added */
+	ok = len == expect_len+2 && !memcmp(psdu, expect_psdu, expect_len);
+	printf("expect %u bytes: %s\n", expect_len, ok ? "PASS" : "FAIL");
+	if (!ok)
+		expect_failures++;
+	expect_len = -1;
+}
+
+
+static void report_ack(uint8_t seq, bool pending)
+{
+	sim_trace("air ack %02x%s", seq, pending ? " pending" : "");
+}
+
+
+static void report_spi(uint8_t cmd, const uint8_t *buf, uint8_t len)
+{
+	char what[16];
+
+	bench_spi(cmd, buf, len);
+	if (!sim_verbose)
+		return;
+	sprintf(what, "spi %02x:", cmd);
+	sim_trace_hex(what, buf, len);
+}
+
+
+/* in HardMAC mode, EP1 only sends single bytes to confirm a transmission */
+
+static void report_ep1(const uint8_t *buf, uint16_t len)
+{
+	sim_trace_hex("ep1", buf, len);
+	if (len == 1)
+		bench_confirm();
+}
+
+
+static void report_ep2(const uint8_t *buf, uint16_t len)
+{
+	sim_trace_hex("ep2", buf, len);
+	bench_confirm();
+}
+
+
+/* ----- Over the air ------------------------------------------------------ */
+
+
+struct air_frame {
+	struct sim_event ev;
+	uint8_t len;
+	bool fcs_ok;
+	uint8_t psdu[MAX_PSDU];
+};
+
+
+static void air_frame(void *user)
+{
+	struct air_frame *f = user;
+
+	sim_trace_hex(f->fcs_ok ? "air rx" : "air rx (bad FCS)",
+	    f->psdu, f->len);
+	if (!trx_receive(f->psdu, f->len, 0xff, f->fcs_ok))
+		sim_trace("air rx missed (state 0x%02x)", trx_state());
+	free(f);
+}
+
+
+/* ----- Script ------------------------------------------------------------ */
+
+
+static void __attribute__((noreturn)) script_error(const char *msg)
+{
+	fprintf(stderr, "%s:%u: %s\n", script_name, line_no, msg);
+	exit(1);
+}
+
+
+static unsigned long number(const char *s)
+{
+	unsigned long n;
+	char *end;
+
+	if (!s)
+		script_error("argument missing");
+	n = strtoul(s, &end, 0);
+	if (*end)
+		script_error("invalid number");
+	return n;
+}
+
+
+static uint8_t nibble(char c)
+{
+	if (!isxdigit((unsigned char) c))
+		script_error("invalid hex data");
+	return isdigit((unsigned char) c) ? c-'0' : tolower(c)-'a'+10;
+}
+
+
+/* hex data from this token to the end of the line, spaces are optional */
+
+static uint8_t hex(const char *tok, uint8_t *buf, uint8_t max)
+{
+	uint8_t len = 0;
+
+	for (; tok; tok = strtok(NULL, " \t\n"))
+		while (*tok) {
+			if (len == max)
+				script_error("too much data");
+			buf[len] = nibble(tok[0]) << 4;
+			buf[len++] |= nibble(tok[1]);
+			tok += 2;
+		}
+	return len;
+}
+
+
+static void schedule_frame(uint64_t delay, bool fcs_ok, const char *tok)
+{
+	struct air_frame *f;
+
+	f = malloc(sizeof(struct air_frame));
+	if (!f) {
+		perror("malloc");
+		exit(1);
+	}
+	f->ev.fn = air_frame;
+	f->ev.user = f;
+	f->ev.queued = 0;
+	f->fcs_ok = fcs_ok;
+	f->len = hex(tok, f->psdu, MAX_PSDU-2);
+	if (!f->len)
+		script_error("empty frame");
+	sim_schedule(&f->ev, sim_now+delay);
+	if (!delay)
+		sim_run_until(sim_now);
+}
+
+
+static void control(uint8_t type, uint8_t req, uint16_t value,
+    uint16_t index, uint8_t *buf, uint16_t len)
+{
+	if (usb_control(type, req, value, index, buf, len) < 0)
+		sim_trace("ep0 request 0x%02x stalled", req);
+}
+
+
+/*
+ * Like a host would, we read the device's clock and set the deadline
+ * relative to it.
+ */
+
+static void tx_at(unsigned long usec, uint8_t seq, const char *tok)
+{
+	uint8_t buf[6+MAX_PSDU];
+	uint64_t t = 0;
+	uint8_t len, i;
+
+	control(ATUSB_REQ_FROM_DEV, ATUSB_TIMER, 0, 0, buf, 6);
+	for (i = 6; i; i--)
+		t = t << 8 | buf[i-1];
+	t += (uint64_t) usec*TIMER_TICKS_PER_US;
+	for (i = 0; i != 6; i++)
+		buf[i] = t >> 8*i;
+	len = hex(tok, buf+6, MAX_PSDU-2);
+	sim_trace("tx deadline %.3f", (double) t/TIMER_TICKS_PER_US);
+	control(ATUSB_REQ_TO_DEV, ATUSB_TX, ATUSB_TX_AT, seq, buf, 6+len);
+}
+
+
+/*
+ * Fields are given as OFFSET:SIZE[,OFFSET:SIZE...], with PSDU offsets, or as
+ * "-" if there are none.
+ */
+
+static void burst(const char *arg)
+{
+	uint8_t buf[2+2*8+MAX_PSDU];
+	unsigned long count, gap;
+	const char *s;
+	char *end;
+	uint8_t len = 2;
+
+	if (arg && !strcmp(arg, "stop")) {
+		control(ATUSB_REQ_TO_DEV, ATUSB_BURST, 0, 0, NULL, 0);
+		return;
+	}
+	count = number(arg);
+	gap = number(strtok(NULL, " \t\n"));
+	buf[0] = number(strtok(NULL, " \t\n"));
+	buf[1] = 0;
+	s = strtok(NULL, " \t\n");
+	if (!s)
+		script_error("burst COUNT GAP_USEC SEQ FIELDS|- HEX...");
+	if (strcmp(s, "-"))
+		while (1) {
+			if (buf[1] == 8)
+				script_error("too many fields");
+			buf[len++] = strtoul(s, &end, 0);
+			if (*end != ':')
+				script_error("OFFSET:SIZE expected");
+			buf[len++] = strtoul(end+1, &end, 0);
+			buf[1]++;
+			if (!*end)
+				break;
+			if (*end != ',')
+				script_error("OFFSET:SIZE expected");
+			s = end+1;
+		}
+	len += hex(strtok(NULL, " \t\n"), buf+len, MAX_PSDU-2);
+	control(ATUSB_REQ_TO_DEV, ATUSB_BURST, count, gap, buf, len);
+}
+
+
+static void stats(const char *arg)
+{
+	uint8_t buf[30] = {};
+	uint16_t v[15];
+	uint8_t i;
+
+	if (arg && strcmp(arg, "clear"))
+		script_error("stats [clear]");
+	control(ATUSB_REQ_FROM_DEV, ATUSB_STATS, !!arg, 0, buf, sizeof(buf));
+	for (i = 0; i != 15; i++)
+		v[i] = buf[2*i] | buf[2*i+1] << 8;
+	sim_trace("irqs %u, longest %.3f us, rx %u (bad FCS %u, dropped %u)",
+	    v[0], (double) v[1]/TIMER_TICKS_PER_US, v[2], v[3], v[4]);
+	sim_trace("tx TRAC %u %u %u %u %u %u %u %u, injected %u",
+	    v[5], v[6], v[7], v[8], v[9], v[10], v[11], v[12], v[13]);
+#ifdef SHADOW_CHECK
+	sim_trace("shadow errors %u", v[14]);
+#endif
+}
+
+
+static void attack(const char *name)
+{
+	uint8_t res;
+
+	if (!name)
+		script_error("attack name missing");
+	if (!strcmp(name, "capacity"))
+		res = capacity_attack(&hub_addr, 0x15000000, 2);
+	else if (!strcmp(name, "offline"))
+		res = offline_attack(&hub_addr, &victim_addr, 0x15000000);
+	else if (!strcmp(name, "hijack"))
+		res = hijacking_attack(&hub_addr, &victim_addr, 0x15000000);
+	else
+		script_error("unknown attack");
+	sim_trace("attack %s returned %u", name, res);
+}
+
+
+static void target(const char *what)
+{
+	static const char *const roles[ATUSB_TARGETS] = {
+		[ATUSB_TARGET_HUB]	= "hub",
+		[ATUSB_TARGET_BULB]	= "bulb",
+		[ATUSB_TARGET_VICTIM]	= "victim",
+	};
+	uint8_t buf[ATUSB_TARGET_SIZE];
+	char *tok;
+	uint8_t role;
+
+	if (!what)
+		script_error("target hub|bulb|victim [HEX...] | save|erase");
+	if (!strcmp(what, "save") || !strcmp(what, "erase")) {
+		control(ATUSB_REQ_TO_DEV, ATUSB_TARGET_SAVE,
+		    !strcmp(what, "erase"), 0, NULL, 0);
+		/* what the main loop does next */
+		target_poll();
+		return;
+	}
+	for (role = 0; role != ATUSB_TARGETS; role++)
+		if (!strcmp(what, roles[role]))
+			break;
+	if (role == ATUSB_TARGETS)
+		script_error("unknown target");
+	tok = strtok(NULL, " \t\n");
+	if (tok) {
+		if (hex(tok, buf, sizeof(buf)) != sizeof(buf))
+			script_error("a target is 25 bytes");
+		control(ATUSB_REQ_TO_DEV, ATUSB_TARGET_WRITE, 0, role,
+		    buf, sizeof(buf));
+	} else {
+		control(ATUSB_REQ_FROM_DEV, ATUSB_TARGET_READ, 0, role,
+		    buf, sizeof(buf));
+		sim_trace_hex(what, buf, sizeof(buf));
+	}
+}
+
+
+static void command(char *line)
+{
+	uint8_t buf[MAX_PSDU];
+	char *cmd, *arg;
+	unsigned long n;
+	uint8_t len;
+
+	cmd = strchr(line, '#');
+	if (cmd)
+		*cmd = 0;
+	cmd = strtok(line, " \t\n");
+	if (!cmd)
+		return;
+	arg = strtok(NULL, " \t\n");
+
+	if (!strcmp(cmd, "reset")) {
+		control(ATUSB_REQ_TO_DEV, ATUSB_RF_RESET, 0, 0, NULL, 0);
+	} else if (!strcmp(cmd, "rx")) {
+		if (!arg || (strcmp(arg, "on") && strcmp(arg, "off")))
+			script_error("rx on [batch] [stamp] [events]|off");
+		n = strcmp(arg, "on") ? 0 : ATUSB_RX_MODE_ON;
+		while ((arg = strtok(NULL, " \t\n"))) {
+			if (n && !strcmp(arg, "batch"))
+				n |= ATUSB_RX_MODE_BATCH;
+			else if (n && !strcmp(arg, "stamp"))
+				n |= ATUSB_RX_MODE_TIMESTAMP;
+			else if (n && !strcmp(arg, "events"))
+				n |= ATUSB_RX_MODE_TX_EVENTS;
+			else
+				script_error("rx on [batch] [stamp] [events]|off");
+		}
+		control(ATUSB_REQ_TO_DEV, ATUSB_RX_MODE, n, 0, NULL, 0);
+	} else if (!strcmp(cmd, "rxstats")) {
+		if (arg && strcmp(arg, "clear"))
+			script_error("rxstats [clear]");
+		control(ATUSB_REQ_FROM_DEV, ATUSB_RX_STATS, !!arg, 0, buf, 6);
+		sim_trace("rx drops %u, high-water %u of %u bytes",
+		    buf[0] | buf[1] << 8, buf[2] | buf[3] << 8,
+		    buf[4] | buf[5] << 8);
+	} else if (!strcmp(cmd, "stats")) {
+		stats(arg);
+	} else if (!strcmp(cmd, "drops")) {
+		unsigned long drops;
+
+		n = number(arg);
+		control(ATUSB_REQ_FROM_DEV, ATUSB_RX_STATS, 0, 0, buf, 6);
+		drops = buf[0] | buf[1] << 8;
+		printf("drops %lu, max %lu: %s\n", drops, n,
+		    drops <= n ? "PASS" : "FAIL");
+		if (drops > n)
+			drop_failures++;
+	} else if (!strcmp(cmd, "poll")) {
+		usb_poll_ns = number(arg)*1000;
+		arg = strtok(NULL, " \t\n");
+		if (arg)
+			usb_nak_ns = number(arg)*1000;
+	} else if (!strcmp(cmd, "reg")) {
+		n = number(arg);
+		arg = strtok(NULL, " \t\n");
+		if (arg) {
+			control(ATUSB_REQ_TO_DEV, ATUSB_REG_WRITE,
+			    number(arg), n, NULL, 0);
+		} else {
+			control(ATUSB_REQ_FROM_DEV, ATUSB_REG_READ, 0, n,
+			    buf, 1);
+			sim_trace("reg 0x%02lx = 0x%02x", n, buf[0]);
+		}
+	} else if (!strcmp(cmd, "tx")) {
+		if (arg && !strcmp(arg, "at")) {
+			n = number(strtok(NULL, " \t\n"));
+			arg = strtok(NULL, " \t\n");
+			tx_at(n, number(arg), strtok(NULL, " \t\n"));
+		} else {
+			n = number(arg);
+			len = hex(strtok(NULL, " \t\n"), buf, MAX_PSDU-2);
+			control(ATUSB_REQ_TO_DEV, ATUSB_TX, 0, n, buf, len);
+		}
+	} else if (!strcmp(cmd, "burst")) {
+		burst(arg);
+	} else if (!strcmp(cmd, "frame") || !strcmp(cmd, "badframe")) {
+		schedule_frame(0, !strcmp(cmd, "frame"), arg);
+	} else if (!strcmp(cmd, "at")) {
+		n = number(arg);
+		cmd = strtok(NULL, " \t\n");
+		if (!cmd || (strcmp(cmd, "frame") && strcmp(cmd, "badframe")))
+			script_error("at USEC frame|badframe HEX...");
+		schedule_frame(n*1000, !strcmp(cmd, "frame"),
+		    strtok(NULL, " \t\n"));
+	} else if (!strcmp(cmd, "peer")) {
+		if (!arg || (strcmp(arg, "ack") && strcmp(arg, "noack")))
+			script_error("peer ack|noack");
+		trx_peer_acks = !strcmp(arg, "ack");
+	} else if (!strcmp(cmd, "wait")) {
+		sim_delay_ns(number(arg)*1000);
+	} else if (!strcmp(cmd, "attack")) {
+		attack(arg);
+	} else if (!strcmp(cmd, "attack_no")) {
+		control(ATUSB_REQ_TO_DEV, ATUSB_ATTACK, number(arg), 0,
+		    NULL, 0);
+	} else if (!strcmp(cmd, "target")) {
+		target(arg);
+	} else if (!strcmp(cmd, "bench")) {
+		enum bench_start from = BENCH_RX;
+		enum bench_end end = BENCH_SLP_TR;
+
+		if (!arg)
+			script_error("bench NAME USEC [now|tx] [read|confirm]");
+		n = number(strtok(NULL, " \t\n"));
+		while ((cmd = strtok(NULL, " \t\n"))) {
+			if (!strcmp(cmd, "now"))
+				from = BENCH_NOW;
+			else if (!strcmp(cmd, "tx"))
+				from = BENCH_TX;
+			else if (!strcmp(cmd, "read"))
+				end = BENCH_READ;
+			else if (!strcmp(cmd, "confirm"))
+				end = BENCH_CONFIRM;
+			else
+				script_error(
+				    "bench NAME USEC [now|tx] [read|confirm]");
+		}
+		bench_arm(arg, n*1000, from, end);
+	} else if (!strcmp(cmd, "expect")) {
+		expect_len = hex(arg, expect_psdu, MAX_PSDU-2);
+	} else {
+		script_error("unknown command");
+	}
+}
+
+
+/* ----- Firmware ---------------------------------------------------------- */
+
+
+/* same as atusb.c */
+
+static void firmware_init(void)
+{
+	board_init();
+	board_app_init();
+	reset_rf();
+
+	user_get_descriptor = sernum_get_descr;
+
+	usb_init();
+	ep0_init();
+	timer_init();
+
+	sei();
+
+	target_init();
+}
+
+
+/* ----- Command line ------------------------------------------------------ */
+
+
+static void __attribute__((noreturn)) usage(const char *name)
+{
+	fprintf(stderr,
+"usage: %s [-a attack_no] [-n nak_us] [-p poll_us] [-t limit_us] [-v] "
+    "[script]\n\n"
+"  -a attack_no  value of attack_no seen by the interrupt handler (default 0)\n"
+"  -n nak_us     when the host retries a NAKed EP1 IN token (default %llu)\n"
+"  -p poll_us    interval between EP1 IN tokens (default %llu)\n"
+"  -t limit_us   abort when simulated time exceeds this limit\n"
+"  -v            also report SPI transactions and the IRQ line\n\n"
+"Example:\n"
+"  printf 'reset\\nreg 0x0e 0xff\\nrx on\\nframe 4188010170ffff0000\\n"
+"wait 2000\\n' |\n"
+"    %s\n",
+	    name, (unsigned long long) usb_nak_ns/1000,
+	    (unsigned long long) usb_poll_ns/1000, name);
+	exit(1);
+}
+
+
+int main(int argc, char **argv)
+{
+	char line[MAX_LINE];
+	FILE *file = stdin;
+	uint8_t attack = ATUSB_ATTACK_NONE;
+	bool bad;
+	int c;
+
+	while ((c = getopt(argc, argv, "a:n:p:t:v")) != EOF)
+		switch (c) {
+		case 'a':
+			attack = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			usb_nak_ns = strtoull(optarg, NULL, 0)*1000;
+			break;
+		case 'p':
+			usb_poll_ns = strtoull(optarg, NULL, 0)*1000;
+			break;
+		case 't':
+			sim_limit = strtoull(optarg, NULL, 0)*1000;
+			break;
+		case 'v':
+			sim_verbose = 1;
+			break;
+		default:
+			usage(*argv);
+		}
+
+	switch (argc-optind) {
+	case 0:
+		script_name = "stdin";
+		break;
+	case 1:
+		script_name = argv[optind];
+		file = fopen(script_name, "r");
+		if (!file) {
+			perror(script_name);
+			return 1;
+		}
+		break;
+	default:
+		usage(*argv);
+	}
+
+	trx_hooks.tx = report_tx;
+	trx_hooks.ack = report_ack;
+	trx_hooks.spi = report_spi;
+	trx_hooks.rx_end = bench_rx_end;
+	trx_hooks.tx_end = bench_tx_end;
+	trx_hooks.slp_tr = bench_slp_tr;
+	usb_ep1_hook = report_ep1;
+	usb_ep2_hook = report_ep2;
+
+	sim_init();
+	firmware_init();
+	attack_no = attack;	/* the main loop isn't there to run rounds */
+
+	while (fgets(line, sizeof(line), file)) {
+		line_no++;
+		command(line);
+	}
+	bad = bench_finish();
+	if (expect_len >= 0) {
+		printf("expect %u bytes: nothing sent: FAIL\n", expect_len);
+		bad = 1;
+	}
+	if (expect_failures || drop_failures)
+		bad = 1;
+#ifdef SHADOW_CHECK
+	if (shadow_errors) {
+		printf("shadow: %u stale register reads\n", shadow_errors);
+		bad = 1;
+	}
+#endif
+	return bad;
+}
@@ -0,0 +1,25 @@
+/*
+ * fw/host/avr/eeprom.h - EEPROM access of the host build
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef HOST_AVR_EEPROM_H
+#define	HOST_AVR_EEPROM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+#define	E2END	1023
+
+
+uint8_t eeprom_read_byte(const uint8_t *addr);
+void eeprom_update_byte(uint8_t *addr, uint8_t value);
+void eeprom_read_block(void *dst, const void *src, size_t n);
+void eeprom_update_block(const void *src, void *dst, size_t n);
+
+#endif /* !HOST_AVR_EEPROM_H */
@@ -0,0 +1,26 @@
+/*
+ * fw/host/avr/interrupt.h - Interrupt handling of the host build
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * Interrupt handlers become plain functions that the simulator calls when
+ * the corresponding event is pending and interrupts are enabled.
+ */
+
+#ifndef HOST_AVR_INTERRUPT_H
+#define	HOST_AVR_INTERRUPT_H
+
+#include "sim.h"
+
+
+#define	ISR(vector)	void vector(void)
+
+#define	sei()		sim_sei()
+#define	cli()		sim_cli()
+
+#endif /* !HOST_AVR_INTERRUPT_H */
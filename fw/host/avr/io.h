@@ -0,0 +1,75 @@
+/*
+ * fw/host/avr/io.h - I/O registers of the host build
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * Only the registers touched by the code we build for the host exist here.
+ * Most of them are plain variables. Registers whose value depends on the
+ * simulated time or on the transceiver model are read through the
+ * simulator.
+ */
+
+#ifndef HOST_AVR_IO_H
+#define	HOST_AVR_IO_H
+
+#include <stdint.h>
+
+#include "sim.h"
+
+
+extern volatile uint8_t PORTB, PORTC, PORTD;
+extern volatile uint8_t DDRB, DDRC, DDRD;
+
+#define	PINB	sim_pin('B')
+#define	PINC	sim_pin('C')
+#define	PIND	sim_pin('D')
+
+extern volatile uint8_t EIMSK, EICRA;
+extern volatile uint8_t MCUSR, MCUCR, WDTCSR, CLKPR;
+
+extern volatile uint8_t TCCR1A, TCCR1B, TIMSK1;
+extern volatile uint16_t OCR1A, OCR1B;
+
+/*
+ * TIFR1 flags are cleared by writing a one. sim_tifr1 hands out a latch the
+ * simulator examines on its next access to tell writes from reads.
+ */
+
+#define	TIFR1	(*sim_tifr1())
+
+/*
+ * UDR1 is the USART's transmit buffer when written and its receive FIFO when
+ * read. sim_udr1 hands out a latch the way sim_tifr1 does, with a marker in
+ * the upper byte that a write clears.
+ */
+
+#define	UDR1	(*sim_udr1())
+
+#define	TCNT1L	((uint8_t) sim_tcnt1())
+#define	TCNT1H	((uint8_t) (sim_tcnt1() >> 8))
+#define	TCNT1	sim_tcnt1()
+
+#define	CS10	0
+#define	TOV1	0
+#define	OCF1A	1
+#define	OCF1B	2
+#define	TOIE1	0
+#define	OCIE1A	1
+#define	OCIE1B	2
+
+#define	UDRE1	5
+#define	RXC1	7
+
+#define	WDE	3
+#define	WDCE	4
+#define	IVCE	0
+#define	CLKPCE	7
+
+#define	INT0	0
+
+#endif /* !HOST_AVR_IO_H */
@@ -0,0 +1,23 @@
+/*
+ * fw/host/avr/pgmspace.h - Program memory access of the host build
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef HOST_AVR_PGMSPACE_H
+#define	HOST_AVR_PGMSPACE_H
+
+#include <string.h>
+
+
+/* the host has a single address space */
+
+#define	PROGMEM
+
+#define	pgm_read_byte(addr)	(*(const uint8_t *) (addr))
+#define	memcpy_P(dst, src, n)	memcpy(dst, src, n)
+
+#endif /* !HOST_AVR_PGMSPACE_H */
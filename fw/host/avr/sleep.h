@@ -0,0 +1,21 @@
+/*
+ * fw/host/avr/sleep.h - Sleep modes of the host build
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef HOST_AVR_SLEEP_H
+#define	HOST_AVR_SLEEP_H
+
+#include "sim.h"
+
+
+#define	sleep_enable()
+#define	sleep_disable()
+#define	sleep_cpu()	sim_sleep()
+#define	sleep_mode()	sim_sleep()
+
+#endif /* !HOST_AVR_SLEEP_H */
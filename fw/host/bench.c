@@ -0,0 +1,209 @@
+/*
+ * fw/host/bench.c - Latency measurements on the simulated transceiver
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * Time is attributed to stages by the SPI transactions the firmware makes:
+ * each transaction is charged with the time since the end of the previous
+ * one, which includes any busy waiting before it. Time after the last
+ * transaction goes to "other". Since only SPI, delays and the radio advance
+ * the simulated clock, CPU work between SPI accesses (e.g., computing frame
+ * fields) is not included, and the figures are lower bounds.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "at86rf230.h"
+#include "sim.h"
+#include "bench.h"
+
+
+enum stage {
+	STAGE_IRQ,
+	STAGE_READ,
+	STAGE_UPLOAD,
+	STAGE_STATE,
+	STAGE_REG,
+	STAGE_AES,
+	STAGE_OTHER,
+	STAGES
+};
+
+static const char *stage_name[STAGES] = {
+	[STAGE_IRQ]	= "IRQ_STATUS read",
+	[STAGE_READ]	= "frame buffer read",
+	[STAGE_UPLOAD]	= "frame build and upload",
+	[STAGE_STATE]	= "state transitions",
+	[STAGE_REG]	= "other registers",
+	[STAGE_AES]	= "AES engine",
+	[STAGE_OTHER]	= "other",
+};
+
+
+static enum {
+	BENCH_IDLE,
+	BENCH_ARMED,
+	BENCH_RUNNING,
+} state = BENCH_IDLE;
+
+static char name[64];
+static enum bench_start from;
+static enum bench_end until;
+static uint64_t budget;
+static uint64_t t_start, t_last;
+static uint64_t stage_ns[STAGES];
+static unsigned failures = 0;
+
+
+static enum stage classify(uint8_t cmd, const uint8_t *buf, uint8_t len)
+{
+	uint8_t reg = cmd & 0x3f;
+
+	switch (cmd & 0xc0) {
+	case AT86RF230_REG_READ:
+		if (reg == REG_IRQ_STATUS)
+			return STAGE_IRQ;
+		/* fall through */
+	case AT86RF230_REG_WRITE:
+		if (reg == REG_TRX_STATUS || reg == REG_TRX_STATE)
+			return STAGE_STATE;
+		return STAGE_REG;
+	default:
+		/* SRAM_WRITE 010 and SRAM_READ 000 beyond the frame buffer */
+		if (!(cmd & 0x20) && len && buf[0] >= SRAM_SIZE)
+			return STAGE_AES;
+		/* BUF_WRITE 011, SRAM_WRITE 010, BUF_READ 001, SRAM_READ 000 */
+		return cmd & 0x40 ? STAGE_UPLOAD : STAGE_READ;
+	}
+}
+
+
+static void start(void)
+{
+	state = BENCH_RUNNING;
+	t_start = t_last = sim_now;
+	memset(stage_ns, 0, sizeof(stage_ns));
+}
+
+
+static void report(void)
+{
+	uint64_t total = sim_now-t_start;
+	bool pass = total <= budget;
+	enum stage s;
+
+	printf("bench %s: %.3f us (%llu cycles), budget %.3f us: %s\n",
+	    name, total/1000.0,
+	    (unsigned long long) total/SIM_NS_PER_CYCLE,
+	    budget/1000.0, pass ? "PASS" : "FAIL");
+	for (s = 0; s != STAGES; s++)
+		if (stage_ns[s])
+			printf("  %-24s %10.3f us %8llu cycles\n",
+			    stage_name[s], stage_ns[s]/1000.0,
+			    (unsigned long long) stage_ns[s]/SIM_NS_PER_CYCLE);
+	if (!pass)
+		failures++;
+}
+
+
+static const char *end_name[] = {
+	[BENCH_SLP_TR]	= "SLP_TR",
+	[BENCH_READ]	= "frame read",
+	[BENCH_CONFIRM]	= "TX confirmation",
+};
+
+
+void bench_arm(const char *bench_name, uint64_t budget_ns,
+    enum bench_start start_at, enum bench_end end)
+{
+	if (state != BENCH_IDLE)
+		bench_finish();
+	snprintf(name, sizeof(name), "%s", bench_name);
+	budget = budget_ns;
+	from = start_at;
+	until = end;
+	state = BENCH_ARMED;
+	if (from == BENCH_NOW)
+		start();
+}
+
+
+/* buf holds the bytes read after the command byte, i.e., PHR, PSDU, ... */
+
+void bench_spi(uint8_t cmd, const uint8_t *buf, uint8_t len)
+{
+	if (state != BENCH_RUNNING)
+		return;
+	stage_ns[classify(cmd, buf, len)] += sim_now-t_last;
+	t_last = sim_now;
+	if (until == BENCH_READ && cmd == AT86RF230_BUF_READ && len &&
+	    len > buf[0]) {
+		report();
+		state = BENCH_IDLE;
+	}
+}
+
+
+void bench_rx_end(void)
+{
+	if (state == BENCH_ARMED && from == BENCH_RX)
+		start();
+}
+
+
+void bench_tx_end(void)
+{
+	if (state == BENCH_ARMED && from == BENCH_TX)
+		start();
+}
+
+
+static void stop(enum bench_end what)
+{
+	if (state != BENCH_RUNNING || until != what)
+		return;
+	stage_ns[STAGE_OTHER] += sim_now-t_last;
+	report();
+	state = BENCH_IDLE;
+}
+
+
+void bench_slp_tr(void)
+{
+	stop(BENCH_SLP_TR);
+}
+
+
+void bench_confirm(void)
+{
+	stop(BENCH_CONFIRM);
+}
+
+
+unsigned bench_finish(void)
+{
+	switch (state) {
+	case BENCH_ARMED:
+		printf("bench %s: not triggered: FAIL\n", name);
+		failures++;
+		break;
+	case BENCH_RUNNING:
+		printf("bench %s: no %s after %.3f us: FAIL\n", name,
+		    end_name[until],
+		    (sim_now-t_start)/1000.0);
+		failures++;
+		break;
+	default:
+		break;
+	}
+	state = BENCH_IDLE;
+	return failures;
+}
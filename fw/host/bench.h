@@ -0,0 +1,50 @@
+/*
+ * fw/host/bench.h - Latency measurements on the simulated transceiver
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef BENCH_H
+#define	BENCH_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+/*
+ * A measurement starts at the end of the next received frame, i.e., when
+ * the transceiver raises IRQ_TRX_END, at the end of the next frame we
+ * transmit, or immediately. It ends at the next rising edge of SLP_TR, at
+ * the end of the next frame buffer read that fetches the whole frame, or
+ * when the host gets the confirmation of a transmission.
+ */
+
+enum bench_start {
+	BENCH_RX,
+	BENCH_TX,
+	BENCH_NOW,
+};
+
+enum bench_end {
+	BENCH_SLP_TR,
+	BENCH_READ,
+	BENCH_CONFIRM,
+};
+
+void bench_arm(const char *name, uint64_t budget_ns, enum bench_start from,
+    enum bench_end end);
+
+void bench_spi(uint8_t cmd, const uint8_t *buf, uint8_t len);
+void bench_rx_end(void);
+void bench_tx_end(void);
+void bench_slp_tr(void);
+void bench_confirm(void);
+
+/* reports unfinished measurements, returns the number of failures */
+
+unsigned bench_finish(void);
+
+#endif /* !BENCH_H */
@@ -0,0 +1,484 @@
+/*
+ * fw/host/sim.c - Simulation core of the host build
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * The firmware runs natively. Only operations with a known duration on the
+ * real hardware advance the simulated clock: SPI transfers, with the
+ * instructions around each USART access (see board_host.c), busy waits, and
+ * the transceiver's own activities. Code in between takes no time at all, so
+ * all figures derived from the simulated clock are lower bounds dominated by
+ * SPI and radio time.
+ */
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <avr/io.h>
+#include <avr/eeprom.h>
+
+#include "sim.h"
+
+
+#define	ISR_ENTRY_CYCLES	10	/* vector, jump, minimal prologue */
+#define	ISR_EXIT_CYCLES		10	/* minimal epilogue, reti */
+
+#define	TIFR1_MARK		0x80	/* unused bit in TIFR1 */
+
+
+uint64_t sim_now = 0;
+uint64_t sim_limit = UINT64_MAX;
+bool sim_in_isr = 0;
+bool sim_verbose = 0;
+
+
+/* ----- MCU registers ----------------------------------------------------- */
+
+
+volatile uint8_t PORTB, PORTC, PORTD;
+volatile uint8_t DDRB, DDRC, DDRD;
+volatile uint8_t EIMSK, EICRA;
+volatile uint8_t MCUSR, MCUCR, WDTCSR, CLKPR;
+volatile uint8_t TCCR1A, TCCR1B, TIMSK1;
+volatile uint16_t OCR1A, OCR1B;
+
+static uint8_t tifr1;
+static volatile uint8_t tifr1_latch = TIFR1_MARK;
+
+
+static void tifr1_sync(void)
+{
+	/* the firmware cleared the marker, so it wrote ones to clear flags */
+	if (!(tifr1_latch & TIFR1_MARK))
+		tifr1 &= ~tifr1_latch;
+	tifr1_latch = tifr1 | TIFR1_MARK;
+}
+
+
+volatile uint8_t *sim_tifr1(void)
+{
+	tifr1_sync();
+	return &tifr1_latch;
+}
+
+
+uint16_t sim_tcnt1(void)
+{
+	return sim_now/SIM_NS_PER_CYCLE;
+}
+
+
+/* ----- EEPROM ------------------------------------------------------------ */
+
+
+static uint8_t eeprom[E2END+1];
+static bool eeprom_ready = 0;
+
+
+static uint8_t *eeprom_ptr(const void *addr, size_t n)
+{
+	uintptr_t a = (uintptr_t) addr;
+
+	if (!eeprom_ready) {
+		memset(eeprom, 0xff, sizeof(eeprom));
+		eeprom_ready = 1;
+	}
+	if (a+n > sizeof(eeprom))
+		sim_fatal("EEPROM access 0x%lx+%zu", (unsigned long) a, n);
+	return eeprom+a;
+}
+
+
+uint8_t eeprom_read_byte(const uint8_t *addr)
+{
+	return *eeprom_ptr(addr, 1);
+}
+
+
+void eeprom_update_byte(uint8_t *addr, uint8_t value)
+{
+	*eeprom_ptr(addr, 1) = value;
+}
+
+
+void eeprom_read_block(void *dst, const void *src, size_t n)
+{
+	memcpy(dst, eeprom_ptr(src, n), n);
+}
+
+
+void eeprom_update_block(const void *src, void *dst, size_t n)
+{
+	memcpy(eeprom_ptr(dst, n), src, n);
+}
+
+
+/* ----- Events ------------------------------------------------------------ */
+
+
+static struct sim_event *events = NULL;
+
+
+void sim_schedule(struct sim_event *ev, uint64_t t)
+{
+	struct sim_event **anchor;
+
+	if (ev->queued)
+		sim_cancel(ev);
+	ev->t = t;
+	for (anchor = &events; *anchor; anchor = &(*anchor)->next)
+		if ((*anchor)->t > t)
+			break;
+	ev->next = *anchor;
+	*anchor = ev;
+	ev->queued = 1;
+}
+
+
+void sim_cancel(struct sim_event *ev)
+{
+	struct sim_event **anchor;
+
+	for (anchor = &events; *anchor; anchor = &(*anchor)->next)
+		if (*anchor == ev) {
+			*anchor = ev->next;
+			break;
+		}
+	ev->queued = 0;
+}
+
+
+static void timer1_ovf(void *user);
+
+static struct sim_event timer1_ovf_ev = { .fn = timer1_ovf };
+
+
+static void timer1_ovf(void *user)
+{
+	tifr1_sync();
+	tifr1 |= 1 << TOV1;
+	tifr1_latch = tifr1 | TIFR1_MARK;
+	sim_schedule(&timer1_ovf_ev,
+	    sim_now+(uint64_t) 0x10000*SIM_NS_PER_CYCLE);
+}
+
+
+/*
+ * OCR1A and OCR1B are plain variables. Since firmware code takes no simulated
+ * time, it is enough to pick up changes whenever time is about to advance.
+ */
+
+struct compare {
+	volatile uint16_t *ocr;
+	uint8_t flag;		/* OCF1x */
+	uint16_t scheduled;	/* OCR1x the event is scheduled for */
+	struct sim_event ev;
+};
+
+static void timer1_comp(void *user);
+
+static struct compare compare[] = {
+	{ .ocr = &OCR1A, .flag = 1 << OCF1A,
+	    .ev = { .fn = timer1_comp, .user = compare } },
+	{ .ocr = &OCR1B, .flag = 1 << OCF1B,
+	    .ev = { .fn = timer1_comp, .user = compare+1 } },
+};
+
+#define	N_COMPARE	(sizeof(compare)/sizeof(*compare))
+
+
+static void comp_schedule(struct compare *c)
+{
+	uint64_t cycle = sim_now/SIM_NS_PER_CYCLE;
+	uint32_t ahead = (uint16_t) (*c->ocr-cycle);
+
+	if (!ahead)
+		ahead = 0x10000;
+	c->scheduled = *c->ocr;
+	sim_schedule(&c->ev, (cycle+ahead)*SIM_NS_PER_CYCLE);
+}
+
+
+static void timer1_comp(void *user)
+{
+	struct compare *c = user;
+
+	tifr1_sync();
+	tifr1 |= c->flag;
+	tifr1_latch = tifr1 | TIFR1_MARK;
+	comp_schedule(c);
+}
+
+
+static void timer1_sync(void)
+{
+	struct compare *c;
+
+	for (c = compare; c != compare+N_COMPARE; c++)
+		if (*c->ocr != c->scheduled)
+			comp_schedule(c);
+}
+
+
+static void run_events(uint64_t until)
+{
+	struct sim_event *ev;
+
+	while (events && events->t <= until) {
+		ev = events;
+		events = ev->next;
+		ev->queued = 0;
+		if (ev->t > sim_now)
+			sim_now = ev->t;
+		ev->fn(ev->user);
+	}
+}
+
+
+void sim_advance(uint64_t ns)
+{
+	uint64_t until = sim_now+ns;
+
+	timer1_sync();
+	run_events(until);
+	sim_now = until;
+	if (sim_now > sim_limit)
+		sim_fatal("simulated time limit reached");
+}
+
+
+void sim_init(void)
+{
+	struct compare *c;
+
+	sim_schedule(&timer1_ovf_ev, (uint64_t) 0x10000*SIM_NS_PER_CYCLE);
+	for (c = compare; c != compare+N_COMPARE; c++)
+		comp_schedule(c);
+}
+
+
+/* ----- Interrupts -------------------------------------------------------- */
+
+
+static bool sreg_i = 0;
+static unsigned locked = 0;
+static bool pending[SIM_VECTS];
+
+
+void sim_sei(void)
+{
+	sreg_i = 1;
+	sim_deliver();
+}
+
+
+void sim_cli(void)
+{
+	sreg_i = 0;
+}
+
+
+bool sim_irq_save(void)
+{
+	bool i = sreg_i;
+
+	sreg_i = 0;
+	return i;
+}
+
+
+void sim_irq_restore(bool i)
+{
+	if (i)
+		sim_sei();
+}
+
+
+void sim_raise(enum sim_vect vect)
+{
+	pending[vect] = 1;
+}
+
+
+void sim_lock(void)
+{
+	locked++;
+}
+
+
+void sim_unlock(void)
+{
+	if (!--locked)
+		sim_deliver();
+}
+
+
+static void (*const vectors[SIM_VECTS])(void) = {
+	[SIM_INT0]		= INT0_vect,
+	[SIM_USB_COM]		= USB_COM_vect,
+	[SIM_TIMER1_CAPT]	= TIMER1_CAPT_vect,
+	[SIM_TIMER1_COMPA]	= TIMER1_COMPA_vect,
+	[SIM_TIMER1_COMPB]	= TIMER1_COMPB_vect,
+	[SIM_TIMER1_OVF]	= TIMER1_OVF_vect,
+};
+
+/* TIFR1 flag and TIMSK1 enable of the Timer 1 vectors */
+
+static const uint8_t timer1_bit[SIM_VECTS] = {
+	[SIM_TIMER1_CAPT]	= 1 << 5,	/* ICF1, ICIE1 */
+	[SIM_TIMER1_COMPA]	= 1 << 1,	/* OCF1A, OCIE1A */
+	[SIM_TIMER1_COMPB]	= 1 << 2,	/* OCF1B, OCIE1B */
+	[SIM_TIMER1_OVF]	= 1 << 0,	/* TOV1, TOIE1 */
+};
+
+
+static bool take(enum sim_vect vect)
+{
+	uint8_t bit = timer1_bit[vect];
+
+	if (!bit) {
+		if (!pending[vect])
+			return 0;
+		if (vect == SIM_INT0 && !(EIMSK & 1 << INT0))
+			return 0;
+		pending[vect] = 0;
+		return 1;
+	}
+	tifr1_sync();
+	if (!(tifr1 & TIMSK1 & bit))
+		return 0;
+	/* executing the vector clears the flag */
+	tifr1 &= ~bit;
+	tifr1_latch = tifr1 | TIFR1_MARK;
+	return 1;
+}
+
+
+void sim_deliver(void)
+{
+	enum sim_vect vect;
+
+	while (sreg_i && !sim_in_isr && !locked) {
+		for (vect = 0; vect != SIM_VECTS; vect++)
+			if (take(vect))
+				break;
+		if (vect == SIM_VECTS)
+			return;
+		sim_in_isr = 1;
+		sreg_i = 0;
+		sim_advance(ISR_ENTRY_CYCLES*SIM_NS_PER_CYCLE);
+		vectors[vect]();
+		sim_advance(ISR_EXIT_CYCLES*SIM_NS_PER_CYCLE);
+		sim_in_isr = 0;
+		sreg_i = 1;
+	}
+}
+
+
+/*
+ * Vectors the firmware may not have. Like on the real chip, enabling one of
+ * them without a handler is a bug.
+ */
+
+#define	UNHANDLED(vect)					\
+	__attribute__((weak)) void vect(void)		\
+	{						\
+		sim_fatal("unhandled " #vect);		\
+	}
+
+UNHANDLED(INT0_vect)
+UNHANDLED(TIMER1_CAPT_vect)
+UNHANDLED(TIMER1_COMPA_vect)
+UNHANDLED(TIMER1_COMPB_vect)
+UNHANDLED(TIMER1_OVF_vect)
+
+
+/* ----- Busy waiting and sleeping ----------------------------------------- */
+
+
+/*
+ * Interrupts stretch a busy wait, just like a cycle-counting delay loop on
+ * the real CPU.
+ */
+
+void sim_delay_ns(uint64_t ns)
+{
+	uint64_t end = sim_now+ns;
+	uint64_t next;
+
+	sim_deliver();
+	do {
+		timer1_sync();
+		next = end;
+		if (events && events->t <= end)
+			next = events->t > sim_now ? events->t : sim_now;
+		sim_advance(next-sim_now);
+		sim_deliver();
+	}
+	while (sim_now < end);
+}
+
+
+void sim_sleep(void)
+{
+	timer1_sync();
+	if (!events)
+		sim_fatal("sleeping without any pending event");
+	sim_advance(events->t > sim_now ? events->t-sim_now : 0);
+	sim_deliver();
+}
+
+
+void sim_run_until(uint64_t t)
+{
+	sim_delay_ns(t > sim_now ? t-sim_now : 0);
+}
+
+
+/* ----- Tracing ----------------------------------------------------------- */
+
+
+void sim_trace(const char *fmt, ...)
+{
+	va_list ap;
+
+	printf("%12.3f ", sim_now/1000.0);
+	va_start(ap, fmt);
+	vprintf(fmt, ap);
+	va_end(ap);
+	putchar('\n');
+}
+
+
+void sim_trace_hex(const char *what, const uint8_t *buf, unsigned len)
+{
+	unsigned i;
+
+	printf("%12.3f %s", sim_now/1000.0, what);
+	for (i = 0; i != len; i++)
+		printf(" %02x", buf[i]);
+	putchar('\n');
+}
+
+
+void sim_fatal(const char *fmt, ...)
+{
+	va_list ap;
+
+	fflush(stdout);
+	fprintf(stderr, "%.3f us: ", sim_now/1000.0);
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	fputc('\n', stderr);
+	exit(1);
+}
@@ -0,0 +1,129 @@
+/*
+ * fw/host/sim.h - Simulation core of the host build
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef SIM_H
+#define	SIM_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+#define	SIM_NS_PER_CYCLE	125	/* 8 MHz */
+
+
+/* ----- Time and events --------------------------------------------------- */
+
+
+struct sim_event {
+	uint64_t t;
+	void (*fn)(void *user);
+	void *user;
+	bool queued;
+	struct sim_event *next;
+};
+
+
+extern uint64_t sim_now;	/* simulated time, in ns */
+extern uint64_t sim_limit;	/* abort when sim_now passes this */
+
+
+void sim_init(void);
+void sim_schedule(struct sim_event *ev, uint64_t t);
+void sim_cancel(struct sim_event *ev);
+
+/*
+ * sim_advance lets time pass without giving interrupts a chance to run.
+ * sim_delay_ns is what the firmware's busy waits end up in: time passes and
+ * pending interrupts are delivered as if the CPU had been executing a loop.
+ */
+
+void sim_advance(uint64_t ns);
+void sim_delay_ns(uint64_t ns);
+void sim_sleep(void);
+void sim_run_until(uint64_t t);
+
+
+/* ----- Interrupts -------------------------------------------------------- */
+
+
+enum sim_vect {
+	SIM_INT0,
+	SIM_USB_COM,
+	SIM_TIMER1_CAPT,
+	SIM_TIMER1_COMPA,
+	SIM_TIMER1_COMPB,
+	SIM_TIMER1_OVF,
+	SIM_VECTS
+};
+
+
+extern bool sim_in_isr;
+
+void sim_sei(void);
+void sim_cli(void);
+bool sim_irq_save(void);
+void sim_irq_restore(bool i);
+void sim_raise(enum sim_vect vect);
+void sim_deliver(void);
+
+/*
+ * Code that must not be interrupted, e.g., an ongoing SPI transaction,
+ * brackets itself with sim_lock/sim_unlock. Interrupts raised meanwhile stay
+ * pending.
+ */
+
+void sim_lock(void);
+void sim_unlock(void);
+
+
+/* ----- Timer 1 ----------------------------------------------------------- */
+
+
+uint16_t sim_tcnt1(void);
+volatile uint8_t *sim_tifr1(void);
+
+
+/* ----- Provided by the board --------------------------------------------- */
+
+
+uint8_t sim_pin(char port);
+void sim_gpio(char port, uint8_t bit, bool on);
+void sim_gpio_dir(char port, uint8_t bit, bool out);
+volatile uint16_t *sim_udr1(void);
+void sim_spi_wait(uint8_t flag);
+
+
+/* ----- Provided by the firmware ------------------------------------------ */
+
+
+void INT0_vect(void);
+void TIMER1_CAPT_vect(void);
+void TIMER1_COMPA_vect(void);
+void TIMER1_COMPB_vect(void);
+void TIMER1_OVF_vect(void);
+
+
+/* ----- Provided by the USB emulation ------------------------------------- */
+
+
+void USB_COM_vect(void);
+
+
+/* ----- Tracing ----------------------------------------------------------- */
+
+
+extern bool sim_verbose;
+
+void sim_trace(const char *fmt, ...)
+    __attribute__((format(printf, 1, 2)));
+void sim_trace_hex(const char *what, const uint8_t *buf, unsigned len);
+void sim_fatal(const char *fmt, ...)
+    __attribute__((format(printf, 1, 2), noreturn));
+
+#endif /* !SIM_H */
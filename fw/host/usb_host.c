@@ -0,0 +1,318 @@
+/*
+ * fw/host/usb_host.c - USB device controller emulation of the host build
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * Replaces usb/atu2.c. Endpoint handling follows the ATmega32U2 driver: data
+ * moves in packets of up to the endpoint size, a short packet ends the
+ * transfer, and completion callbacks run in USB_COM_vect.
+ *
+ * EP1 has EP1_BANKS banks. USB_COM_vect fills free banks, like atu2.c does
+ * on TXINI, and the host takes one bank per IN token. While the host finds
+ * data, its tokens come usb_poll_ns apart. A token that finds no data is
+ * NAKed, and the host tries again at the start of the next frame, every
+ * usb_nak_ns. So if the firmware doesn't refill a bank in time, e.g.,
+ * because it is busy reading a frame from the transceiver, the transfer
+ * stalls until the next frame.
+ *
+ * EP2 is an interrupt endpoint with a single bank, which the host polls at
+ * the start of every frame (bInterval 1).
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "usb.h"
+#include "board.h"
+#include "sim.h"
+#include "usb_host.h"
+
+
+#define	FIFO_NS_PER_BYTE	(4*SIM_NS_PER_CYCLE)	/* ld, sts, loop */
+#define	MAX_TRANSFER		256
+#define	EP2_INTERVAL_NS		1000000
+
+
+struct ep_descr eps[NUM_EPS];
+
+uint64_t usb_poll_ns = 50000;	/* about one 64 byte packet at 12 Mbps */
+uint64_t usb_nak_ns = 1000000;	/* full-speed frame */
+void (*usb_ep1_hook)(const uint8_t *buf, uint16_t len);
+void (*usb_ep2_hook)(const uint8_t *buf, uint16_t len);
+
+static const struct setup_request *ctrl_setup;
+static uint8_t *ctrl_buf;
+static int ctrl_res;
+static bool ctrl_pending = 0;
+
+static uint8_t ep1_bank[EP1_BANKS][EP1_SIZE];
+static uint8_t ep1_bank_len[EP1_BANKS];
+static uint8_t ep1_first = 0;		/* oldest filled bank */
+static uint8_t ep1_filled = 0;
+static uint64_t ep1_next = 0;		/* when the host sends its next token */
+static uint8_t ep1_data[MAX_TRANSFER];
+static uint16_t ep1_len = 0;
+static uint8_t ep2_bank[EP2_SIZE];
+static uint8_t ep2_bank_len;
+static bool ep2_filled = 0;
+static uint8_t ep2_data[MAX_TRANSFER];
+static uint16_t ep2_len = 0;
+
+
+/* ----- Endpoint 1 -------------------------------------------------------- */
+
+
+static void ep1_token(void *user);
+
+static struct sim_event ep1_ev = { .fn = ep1_token };
+
+
+/*
+ * If the host's last token found data, it sends the next one at ep1_next.
+ * If that one comes before the bank is filled, it is NAKed and the host
+ * retries at the next frame.
+ */
+
+static void ep1_schedule(void)
+{
+	uint64_t t = ep1_next;
+
+	if (ep1_ev.queued || !ep1_filled)
+		return;
+	if (sim_now > t)
+		t = usb_nak_ns ?
+		    (sim_now+usb_nak_ns-1)/usb_nak_ns*usb_nak_ns : sim_now;
+	sim_schedule(&ep1_ev, t);
+}
+
+
+static void ep1_token(void *user)
+{
+	uint8_t len = ep1_bank_len[ep1_first];
+
+	if (ep1_len+len > MAX_TRANSFER)
+		sim_fatal("EP1 transfer too long");
+	memcpy(ep1_data+ep1_len, ep1_bank[ep1_first], len);
+	ep1_len += len;
+	ep1_first = (ep1_first+1) % EP1_BANKS;
+	ep1_filled--;
+	ep1_next = sim_now+usb_poll_ns;
+	if (len != EP1_SIZE) {
+		if (usb_ep1_hook)
+			usb_ep1_hook(ep1_data, ep1_len);
+		ep1_len = 0;
+	}
+	sim_raise(SIM_USB_COM);		/* TXINI */
+	ep1_schedule();
+}
+
+
+static void ep1_tx(void)
+{
+	struct ep_descr *ep = eps+1;
+	uint8_t bank, size;
+
+	while (ep->state == EP_TX && ep1_filled != EP1_BANKS) {
+		size = ep->end-ep->buf;
+		if (size > ep->size)
+			size = ep->size;
+		sim_advance(size*FIFO_NS_PER_BYTE);
+		bank = (ep1_first+ep1_filled) % EP1_BANKS;
+		memcpy(ep1_bank[bank], ep->buf, size);
+		ep1_bank_len[bank] = size;
+		ep1_filled++;
+		ep->buf += size;
+		ep1_schedule();
+		if (size == ep->size)
+			continue;
+		ep->state = EP_IDLE;
+		if (ep->callback)
+			ep->callback(ep->user);
+	}
+}
+
+
+/* ----- Endpoint 2 -------------------------------------------------------- */
+
+
+static void ep2_token(void *user);
+
+static struct sim_event ep2_ev = { .fn = ep2_token };
+
+
+static void ep2_token(void *user)
+{
+	if (ep2_len+ep2_bank_len > MAX_TRANSFER)
+		sim_fatal("EP2 transfer too long");
+	memcpy(ep2_data+ep2_len, ep2_bank, ep2_bank_len);
+	ep2_len += ep2_bank_len;
+	ep2_filled = 0;
+	if (ep2_bank_len != EP2_SIZE) {
+		if (usb_ep2_hook)
+			usb_ep2_hook(ep2_data, ep2_len);
+		ep2_len = 0;
+	}
+	sim_raise(SIM_USB_COM);		/* TXINI */
+}
+
+
+static void ep2_tx(void)
+{
+	struct ep_descr *ep = eps+2;
+	uint8_t size;
+
+	if (ep->state != EP_TX || ep2_filled)
+		return;
+	size = ep->end-ep->buf;
+	if (size > ep->size)
+		size = ep->size;
+	sim_advance(size*FIFO_NS_PER_BYTE);
+	memcpy(ep2_bank, ep->buf, size);
+	ep2_bank_len = size;
+	ep2_filled = 1;
+	ep->buf += size;
+	sim_schedule(&ep2_ev, (sim_now/EP2_INTERVAL_NS+1)*EP2_INTERVAL_NS);
+	if (size == ep->size)
+		return;
+	ep->state = EP_IDLE;
+	if (ep->callback)
+		ep->callback(ep->user);
+}
+
+
+/* ----- Endpoint 0 -------------------------------------------------------- */
+
+
+static int ep0_in(void)
+{
+	struct ep_descr *ep = eps;
+	uint16_t len = 0;
+	uint8_t size;
+
+	while (ep->state == EP_TX) {
+		size = ep->end-ep->buf;
+		if (size > ep->size)
+			size = ep->size;
+		if (len+size > ctrl_setup->wLength)
+			sim_fatal("EP0 sends more than requested");
+		sim_advance(size*FIFO_NS_PER_BYTE);
+		if (ctrl_buf)
+			memcpy(ctrl_buf+len, ep->buf, size);
+		len += size;
+		ep->buf += size;
+		if (size == ep->size)
+			continue;
+		ep->state = EP_IDLE;
+		if (ep->callback)
+			ep->callback(ep->user);
+	}
+	return len;
+}
+
+
+static int ep0_out(void)
+{
+	struct ep_descr *ep = eps;
+	uint16_t len = ctrl_setup->wLength;
+
+	if (!len)
+		return 0;
+	if (ep->state != EP_RX)
+		return -1;
+	if (len > ep->end-ep->buf)
+		return -1;
+	sim_advance(len*FIFO_NS_PER_BYTE);
+	memcpy(ep->buf, ctrl_buf, len);
+	ep->buf += len;
+	if (ep->buf == ep->end) {
+		ep->state = EP_IDLE;
+		if (ep->callback)
+			ep->callback(ep->user);
+	}
+	return len;
+}
+
+
+static int ep0_setup(void)
+{
+	eps[0].state = EP_IDLE;
+	if (!handle_setup(ctrl_setup))
+		return -1;
+	if (ctrl_setup->bmRequestType & 0x80)
+		return ep0_in();
+	return ep0_out();
+}
+
+
+int usb_control(uint8_t type, uint8_t req, uint16_t value, uint16_t index,
+    uint8_t *buf, uint16_t len)
+{
+	const struct setup_request setup = {
+		.bmRequestType	= type,
+		.bRequest	= req,
+		.wValue		= value,
+		.wIndex		= index,
+		.wLength	= len,
+	};
+
+	ctrl_setup = &setup;
+	ctrl_buf = buf;
+	ctrl_pending = 1;
+	sim_raise(SIM_USB_COM);
+	sim_deliver();
+	while (ctrl_pending)
+		sim_delay_ns(1000);
+	return ctrl_res;
+}
+
+
+/* ----- Controller -------------------------------------------------------- */
+
+
+void usb_ep_change(struct ep_descr *ep)
+{
+	if (ep == eps+1 && ep->state == EP_TX && ep1_filled != EP1_BANKS)
+		sim_raise(SIM_USB_COM);		/* TXINI */
+	if (ep == eps+2 && ep->state == EP_TX && !ep2_filled)
+		sim_raise(SIM_USB_COM);
+}
+
+
+void set_addr(uint8_t addr)
+{
+	usb_send(&eps[0], NULL, 0, NULL, NULL);
+}
+
+
+void ep_init(void)
+{
+	eps[0].state = EP_IDLE;
+	eps[0].size = APP_EP0_SIZE;
+	eps[1].state = EP_IDLE;
+	eps[1].size = EP1_SIZE;
+	eps[2].state = EP_IDLE;
+	eps[2].size = EP2_SIZE;
+}
+
+
+void usb_reset(void)
+{
+	sim_delay_ns(1000000);
+}
+
+
+void USB_COM_vect(void)
+{
+	if (ctrl_pending) {
+		ctrl_res = ep0_setup();
+		ctrl_pending = 0;
+	}
+	ep1_tx();
+	ep2_tx();
+}
@@ -0,0 +1,38 @@
+/*
+ * fw/host/usb_host.h - USB device controller emulation of the host build
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef USB_HOST_H
+#define	USB_HOST_H
+
+#include <stdint.h>
+
+
+/*
+ * Time between IN tokens while the host gets data from EP1, and the frame
+ * time after which it retries when it doesn't.
+ */
+
+extern uint64_t usb_poll_ns;
+extern uint64_t usb_nak_ns;
+
+/* called with each completed EP1 or EP2 transfer */
+
+extern void (*usb_ep1_hook)(const uint8_t *buf, uint16_t len);
+extern void (*usb_ep2_hook)(const uint8_t *buf, uint16_t len);
+
+
+/*
+ * Performs a control transfer on EP0. Returns the number of bytes
+ * transferred in the data stage, or -1 if the device stalled the request.
+ */
+
+int usb_control(uint8_t type, uint8_t req, uint16_t value, uint16_t index,
+    uint8_t *buf, uint16_t len);
+
+#endif /* !USB_HOST_H */
@@ -0,0 +1,30 @@
+/*
+ * fw/host/util/atomic.h - Atomic blocks of the host build
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * Only ATOMIC_RESTORESTATE: the block disables interrupts and restores the
+ * previous state when it ends.
+ */
+
+#ifndef HOST_UTIL_ATOMIC_H
+#define	HOST_UTIL_ATOMIC_H
+
+#include <stdbool.h>
+
+#include "sim.h"
+
+
+#define	ATOMIC_RESTORESTATE	0
+
+#define	ATOMIC_BLOCK(type)						\
+	for (bool sim_atomic_i = sim_irq_save(), sim_atomic_once = 1;	\
+	    sim_atomic_once;						\
+	    sim_irq_restore(sim_atomic_i), sim_atomic_once = 0)
+
+#endif /* !HOST_UTIL_ATOMIC_H */
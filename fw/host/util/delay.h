@@ -0,0 +1,23 @@
+/*
+ * fw/host/util/delay.h - Busy-wait delays of the host build
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * Delays advance the simulated time instead of burning host CPU.
+ */
+
+#ifndef HOST_UTIL_DELAY_H
+#define	HOST_UTIL_DELAY_H
+
+#include "sim.h"
+
+
+#define	_delay_us(us)	sim_delay_ns((uint64_t) ((us)*1000.0))
+#define	_delay_ms(ms)	sim_delay_ns((uint64_t) ((ms)*1000000.0))
+
+#endif /* !HOST_UTIL_DELAY_H */
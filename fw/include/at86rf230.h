@@ -399,4 +399,33 @@ enum {
 #define	CONT_TX_M500K		0x80	/* f_CH-0.5 MHz */
 #define	CONT_TX_P500K		0xc0	/* f_CH+0.5 MHz */
 
+/* --- AES engine, in SRAM space (231 only) -------------------------------- */
+
+#define	AES_STATUS		0x82
+#define	AES_CTRL		0x83
+#define	AES_STATE		0x84	/* AES_STATE_KEY_0 ... _15 */
+#define	AES_CTRL_MIRROR		0x94
+
+#define	AES_BLOCK_SIZE		16
+#define	AES_US			24	/* processing time */
+
+/* AES_STATUS */
+
+#define	AES_ER			(1 << 7)
+#define	AES_DONE		(1 << 0)
+
+/* AES_CTRL */
+
+#define	AES_REQUEST		(1 << 7)
+#define	AES_DIR			(1 << 3)	/* decryption */
+
+#define	AES_MODE_SHIFT		4
+#define	AES_MODE_MASK		7
+
+enum {
+	AES_MODE_ECB		= 0,
+	AES_MODE_KEY		= 1,
+	AES_MODE_CBC		= 2,
+};
+
 #endif /* !AT86RF230_H */
@@ -46,8 +46,15 @@ enum atusb_requests {
 	ATUSB_SPI_WRITE2_SYNC,
 	ATUSB_RX_MODE			= 0x40, /* HardMAC group */
 	ATUSB_TX,
+	ATUSB_RX_STATS,
+	ATUSB_BURST,
+	ATUSB_STATS,
 	ATUSB_EUI64_WRITE		= 0x50, /* Parameter in EEPROM grp */
 	ATUSB_EUI64_READ,
+	ATUSB_TARGET_WRITE		= 0x60,	/* attack group */
+	ATUSB_TARGET_READ,
+	ATUSB_TARGET_SAVE,
+	ATUSB_ATTACK,
 };
 
 enum {
@@ -85,12 +92,123 @@ enum {
  * ->host	ATUSB_SPI_READ2		byte0		byte1	#bytes
  * ->host	ATUSB_SPI_WRITE2_SYNC	byte0		byte1	0/1
  *
- * host->	ATUSB_RX_MODE		on		-	0
+ * host->	ATUSB_RX_MODE		mode		-	0
  * host->	ATUSB_TX		flags		ack_seq	#bytes
+ * ->host	ATUSB_RX_STATS		clear		-	#bytes (6)
+ * host->	ATUSB_BURST		count		gap_us	#bytes
+ * ->host	ATUSB_STATS		clear		-	#bytes (28)
  * host->	ATUSB_EUI64_WRITE	-		-	#bytes (8)
  * ->host	ATUSB_EUI64_READ	-		-	#bytes (8)
+ *
+ * host->	ATUSB_TARGET_WRITE	-		role	#bytes (25)
+ * ->host	ATUSB_TARGET_READ	-		role	#bytes (25)
+ * host->	ATUSB_TARGET_SAVE	erase		-	0
+ * host->	ATUSB_ATTACK		attack		-	0
+ */
+
+/* ATUSB_RX_MODE */
+
+#define ATUSB_RX_MODE_ON	1	/* HardMAC receives, frames go to EP1 */
+#define ATUSB_RX_MODE_BATCH	2	/* pack several frames per EP1 transfer */
+#define ATUSB_RX_MODE_TIMESTAMP	4	/* append the time of reception */
+#define ATUSB_RX_MODE_TX_EVENTS	8	/* report TX completion on EP2 */
+
+/*
+ * With ATUSB_RX_MODE_TIMESTAMP, frames received from then on have bit 7 of
+ * their PHR byte set, and six more bytes follow the LQI: the ATUSB_TIMER
+ * value when the transceiver signaled RX_START, little-endian. This is when
+ * the PHR has been received, (5+1)*2 symbols after the start of the frame.
+ *
+ * Without ATUSB_RX_MODE_TX_EVENTS, the end of each ATUSB_TX is reported as
+ * a one-byte EP1 transfer with its ack_seq, which waits behind the received
+ * frames EP1 has queued. With it, it is reported on EP2, an interrupt IN
+ * endpoint of its own, as an eight-byte event: the ack_seq, the TRAC_STATUS
+ * of the transmission (0 success, 1 success with data pending, 3 channel
+ * access failure, 5 no ACK), and the ATUSB_TIMER value at which it ended
+ * (for TRAC_STATUS 7, when the firmware gave up), little-endian. The firmware
+ * queues a few events if the host falls behind.
+ */
+
+/* ATUSB_TX */
+
+#define ATUSB_TX_AT		1	/* send at an ATUSB_TIMER deadline */
+
+/*
+ * With ATUSB_TX_AT, the data begins with the 48 bit ATUSB_TIMER value at
+ * which the transmission is to start, little-endian, and the PSDU follows.
+ * The frame is uploaded right away, so the deadline only needs to leave time
+ * for that. A deadline that has already passed sends immediately.
+ *
+ * With ATUSB_RX_MODE_TX_EVENTS, the host doesn't have to wait for one frame
+ * to be sent before submitting the next: the firmware queues up to eight
+ * frames and sends them back to back. ATUSB_TX stalls while the queue is
+ * full. The queue is emptied when the HardMAC is turned off. A frame that
+ * could not be sent at all is reported with TRAC_STATUS 7.
+ */
+
+/*
+ * ATUSB_RX_STATS returns three little-endian 16 bit values: frames dropped
+ * because the RX ring was full, the most bytes the ring ever held, and the
+ * size of the ring. A non-zero wValue clears the first two after reading.
+ * The drop counter is the one ATUSB_STATS returns, so it wraps around, and
+ * clearing either clears it.
+ */
+
+/*
+ * ATUSB_BURST sends the same frame count times, gap_us microseconds apart
+ * (from the end of one frame to the start of the next, 0 for back to back),
+ * without the host in the loop. The data is the ack_seq, the number of
+ * fields (up to eight), each field's PSDU offset and size (1 to 8 bytes), and
+ * the PSDU without FCS, at most 71 bytes. After each frame, every field is
+ * incremented by one as a little-endian number.
+ *
+ * The burst is reported once, at its end, like an ATUSB_TX frame, with the
+ * TRAC_STATUS of its last frame. A burst needs the HardMAC on and no
+ * ATUSB_TX frame queued, and ATUSB_TX stalls while it runs. ATUSB_BURST with
+ * a count of 0 and no data stops the running burst after its current frame.
+ * An invalid template is reported with TRAC_STATUS 7.
+ */
+
+/*
+ * ATUSB_STATS returns fourteen little-endian 16 bit counters, which wrap
+ * around: RF interrupts, the longest time from the IRQ to the end of its
+ * handler in ATUSB_TIMER ticks, frames the HardMAC received, how many of them
+ * had a bad FCS, frames dropped because the RX ring was full, eight counters
+ * of ATUSB_TX and ATUSB_BURST frames by TRAC_STATUS (0 to 7), and frames the
+ * attacks sent. A non-zero wValue clears them all after reading.
+ */
+
+/* ATUSB_TARGET_WRITE, ATUSB_TARGET_READ */
+
+enum {
+	ATUSB_TARGET_HUB,	/* the coordinator we attack */
+	ATUSB_TARGET_BULB,	/* a router in its network */
+	ATUSB_TARGET_VICTIM,	/* the end device we take over */
+	ATUSB_TARGETS
+};
+
+#define ATUSB_TARGET_SIZE	25
+
+/*
+ * A target is sent as its PAN ID (2 bytes), extended PAN ID (8), short
+ * address (2), IEEE address (8), polling type, device type, RX on when idle,
+ * beacon update ID, and coordinator flag, multi-byte fields little-endian.
+ * ATUSB_TARGET_WRITE takes effect right away.
+ *
+ * ATUSB_TARGET_SAVE stores the table and the selected attack in EEPROM,
+ * after the EUI-64, so that they survive a reset. A non-zero wValue erases
+ * them instead, and the built-in defaults return with the next reset.
  */
 
+/* ATUSB_ATTACK */
+
+enum {
+	ATUSB_ATTACK_NONE	= 0,
+	ATUSB_ATTACK_CAPACITY	= 1,	/* fill up the hub's tables, in rounds */
+	ATUSB_ATTACK_OFFLINE	= 2,	/* keep the victim from rejoining */
+	ATUSB_ATTACK_HIJACK	= 3,	/* answer the victim's rejoin for the hub */
+};
+
 #define ATUSB_REQ_FROM_DEV	(USB_TYPE_VENDOR | USB_DIR_IN)
 #define ATUSB_REQ_TO_DEV	(USB_TYPE_VENDOR | USB_DIR_OUT)
 
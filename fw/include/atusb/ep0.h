@@ -27,10 +27,29 @@
  * 	Support to run the firmware on Atmel Raven USB dongles
  * 	Remove FCS frame check from firmware and leave it to the driver
  * 	Use extended operation mode for TX for automatic ACK handling
+ * 0.4	ATUSB_RX_MODE_BATCH, ATUSB_RX_MODE_TIMESTAMP, ATUSB_RX_STATS,
+ *	ATUSB_TX_AT, ATUSB_TARGET_WRITE/READ/SAVE, ATUSB_ATTACK
+ * 0.5	EP0 max packet size 32 bytes (was 64), EP1 double-banked
+ *	ATUSB_RX_MODE_TX_EVENTS: the end of each ATUSB_TX is reported on
+ *	interrupt IN EP2 as an 8 byte event (ack_seq, TRAC_STATUS, 48 bit
+ *	ATUSB_TIMER), instead of as the one byte ack_seq on EP1, and up to
+ *	eight ATUSB_TX frames can be queued
+ *	ATUSB_BURST: wValue frames from one template, wIndex us apart (0 for
+ *	back to back). The data is ack_seq, the number n of fields (up to 8),
+ *	n pairs of PSDU offset and size (1-8 bytes), and the PSDU without FCS
+ *	(up to 71 bytes). Each field is incremented as a little-endian number
+ *	after every frame. The burst is reported once, with the TRAC_STATUS
+ *	of its last frame. wValue 0 and no data stop a running burst.
+ *	ATUSB_STATS: 14 little-endian 16 bit counters (28 bytes): RF
+ *	interrupts, longest interrupt in Timer 1 ticks, frames received, of
+ *	those with a bad FCS, frames dropped, HardMAC frames sent by
+ *	TRAC_STATUS 0-7, and frames injected by attacks. A non-zero wValue
+ *	clears them after reading. Firmware built with SHADOW_CHECK adds a
+ *	15th word, the number of register reads the shadow got wrong.
  */
 
 #define EP0ATUSB_MAJOR	0	/* EP0 protocol, major revision */
-#define EP0ATUSB_MINOR	3	/* EP0 protocol, minor revision */
+#define EP0ATUSB_MINOR	5	/* EP0 protocol, minor revision */
 
 
 /*
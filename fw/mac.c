@@ -23,69 +23,191 @@
 #include "spi.h"
 #include "board.h"
 #include "attack.h"
+#include "frame.h"
+#include "stats.h"
 #include "mac.h"
 
-#define	RX_BUFS	3
+/* Timer 1 runs at 8 MHz, one byte takes two 16 us symbols */
+#define	RX_TICKS_PER_BYTE	256
 
+#define	TX_AT_SIZE		6	/* ATUSB_TX_AT deadline */
 
-bool (*mac_irq)(void) = NULL;
+#ifndef RX_RING_SIZE
+#define	RX_RING_SIZE	384	/* bytes; as much as three MAX_PSDU buffers */
+#endif
+
+#ifndef TX_RING_SIZE
+#define	TX_RING_SIZE	256	/* bytes; about eight Rejoin Requests */
+#endif
+
+
+bool (*mac_irq)(uint8_t irq) = NULL;
 
 
-static uint8_t rx_buf[RX_BUFS][MAX_PSDU+2]; /* PHDR+payload+LQ */
-static uint8_t tx_buf[MAX_PSDU];
-static uint8_t tx_size = 0;
+static uint8_t rx_ring[RX_RING_SIZE];
+static uint8_t tx_ring[TX_RING_SIZE];
+static bool rx_batch = 0;
+static bool rx_stamping = 0;
+static bool rx_stamped = 0;
+static bool tx_events = 0;
+static uint64_t rx_stamp;		/* time of the last RX_START */
 static bool txing = 0;
 static bool queued_tx_ack = 0;
-static uint8_t next_seq, this_seq, queued_seq;
+static uint8_t this_seq, queued_seq;
 
 // uint8_t stat = INIT_STATE;
 
-/* ----- Receive buffer management ----------------------------------------- */
+/* ----- Ring buffers ------------------------------------------------------ */
+
 
+/*
+ * Records are stored back to back. A record never wraps around the end of
+ * the ring, so that it, and the ones following it, can be used straight from
+ * the ring. If a record doesn't fit at the end, it goes to the beginning and
+ * "end" marks where the data stops.
+ */
 
-static uint8_t rx_in = 0, rx_out = 0;
+struct ring {
+	uint8_t *buf;
+	uint16_t size;
+	uint16_t head;		/* where the next record goes */
+	uint16_t tail;		/* oldest record */
+	uint16_t end;		/* end of the data before head wrapped */
+	bool wrapped;
+};
 
 
-static inline void next_buf(uint8_t *index)
+static uint8_t *ring_alloc(struct ring *r, uint8_t size)
 {
-	*index = (*index+1) % RX_BUFS;
+	uint16_t pos = r->head;
+
+	if (r->wrapped) {
+		if (r->head+size > r->tail)
+			return NULL;
+	} else if (r->head+size > r->size) {
+		if (size > r->tail)
+			return NULL;
+		r->end = r->head;
+		r->wrapped = 1;
+		pos = 0;
+	}
+	r->head = pos+size;
+	return r->buf+pos;
 }
 
 
-/* ----- Interrupt handling ------------------------------------------------ */
+static void ring_free(struct ring *r, uint16_t size)
+{
+	r->tail += size;
+	if (r->wrapped && r->tail == r->end) {
+		r->tail = 0;
+		r->wrapped = 0;
+	}
+	if (!r->wrapped && r->tail == r->head)
+		r->tail = r->head = 0;
+}
 
 
-static void rx_done(void *user);
-static void tx_ack_done(void *user);
+static uint16_t ring_used(const struct ring *r)
+{
+	return r->wrapped ? r->end-r->tail+r->head : r->head-r->tail;
+}
 
 
-static void usb_next(void)
+static void ring_reset(struct ring *r)
 {
-	const uint8_t *buf;
+	r->head = r->tail = 0;
+	r->wrapped = 0;
+}
 
-	if (rx_in != rx_out) {
-		buf = rx_buf[rx_out];
-		// led(1);
-		usb_send(&eps[1], buf, buf[0]+2, rx_done, NULL);
-	}
 
-	if (queued_tx_ack) {
-		usb_send(&eps[1], &queued_seq, 1, tx_ack_done, NULL);
-		queued_tx_ack = 0;	
-	}
+/* ----- Receive buffer management ----------------------------------------- */
+
+
+/*
+ * Received frames are stored as PHR, PSDU, and LQI, plus the timestamp if
+ * bit 7 of the PHR byte is set (ATUSB_RX_MODE_TIMESTAMP). EP1 sends them
+ * straight from the ring.
+ */
+
+static struct ring rx = {
+	.buf	= rx_ring,
+	.size	= RX_RING_SIZE,
+};
+
+static uint16_t rx_sending = 0;		/* bytes at rx.tail handed to EP1 */
+
+static uint16_t rx_high = 0;		/* most bytes ever queued */
+
+
+#define	RX_STAMP_SIZE	6	/* bytes of timer_read value */
+
+
+static uint8_t rx_record(uint8_t phr)
+{
+	if (phr & 0x80)
+		return (phr & 0x7f)+2+RX_STAMP_SIZE;
+	return phr+2;
+}
+
+
+static uint8_t *rx_alloc(uint8_t size)
+{
+	uint8_t *buf;
+	uint16_t used;
+
+	buf = ring_alloc(&rx, size);
+	if (!buf)
+		return NULL;
+	used = ring_used(&rx);
+	if (used > rx_high)
+		rx_high = used;
+	return buf;
 }
 
 
-static void tx_ack_done(void *user)
+/* ----- EP1 stream -------------------------------------------------------- */
+
+
+/*
+ * EP1 carries a queued TX acknowledgement first, then the received frames,
+ * straight from the ring. In batch mode, a transfer takes as many queued
+ * frames as fit into one EP1 packet. A frame that is larger than that still
+ * goes alone.
+ *
+ * Frames leave the ring as soon as EP1 has copied them into a bank, so with
+ * two banks, the next transfer is loaded while the host reads the previous
+ * one.
+ */
+
+static uint8_t ep1_more(const uint8_t **buf)
 {
-	usb_next();
+	uint16_t end = rx.wrapped ? rx.end : rx.head;
+	uint16_t size;
+
+	if (queued_tx_ack) {
+		queued_tx_ack = 0;
+		*buf = &queued_seq;
+		return 1;
+	}
+	if (rx.tail == end)
+		return 0;
+	size = rx_record(rx_ring[rx.tail]);
+	while (rx_batch && rx.tail+size != end &&
+	    size+rx_record(rx_ring[rx.tail+size]) <= EP1_SIZE)
+		size += rx_record(rx_ring[rx.tail+size]);
+	rx_sending = size;
+	*buf = rx_ring+rx.tail;
+	return size;
 }
 
-static void rx_done(void *user)
+
+static void ep1_done(uint8_t size)
 {
-	// led(0);
-	next_buf(&rx_out);
-	usb_next();
+	if (!rx_sending)
+		return;		/* TX acknowledgement */
+	ring_free(&rx, rx_sending);
+	rx_sending = 0;
 #ifdef AT86RF230
 	/* slap at86rf230 - reduce fragmentation issue */
 	change_state(TRX_STATUS_RX_AACK_ON);
@@ -93,41 +215,157 @@ static void rx_done(void *user)
 }
 
 
+static struct usb_stream ep1_stream = {
+	.ep	= eps+1,
+	.more	= ep1_more,
+	.done	= ep1_done,
+};
+
+
+/* ----- EP2 TX events ----------------------------------------------------- */
+
+
+/*
+ * mac_tx only accepts a frame if there is room for its event, so no event is
+ * ever lost, and the number of events limits how many frames can be queued.
+ */
+
+#define	TX_EVENTS	8
+#define	TX_EVENT_SIZE	8	/* ack_seq, TRAC_STATUS, 48 bit time */
+
+static uint8_t tx_event[TX_EVENTS][TX_EVENT_SIZE];
+static uint8_t tx_event_first = 0;
+static uint8_t tx_event_count = 0;
+
+
+static uint8_t ep2_more(const uint8_t **buf)
+{
+	if (!tx_event_count)
+		return 0;
+	*buf = tx_event[tx_event_first];
+	return TX_EVENT_SIZE;
+}
+
+
+static void ep2_done(uint8_t size)
+{
+	if (!tx_event_count)
+		return;		/* mac_reset emptied the queue */
+	tx_event_first = (tx_event_first+1) % TX_EVENTS;
+	tx_event_count--;
+}
+
+
+static struct usb_stream ep2_stream = {
+	.ep	= eps+2,
+	.more	= ep2_more,
+	.done	= ep2_done,
+};
+
+
+/* t is when it happened: the TRX_END interrupt, or the failure */
+
+static void tx_event_add(uint8_t seq, uint8_t trac, uint64_t t)
+{
+	uint8_t *ev;
+	uint8_t i;
+
+	ev = tx_event[(tx_event_first+tx_event_count) % TX_EVENTS];
+	ev[0] = seq;
+	ev[1] = trac;
+	for (i = 2; i != TX_EVENT_SIZE; i++) {
+		ev[i] = t;
+		t >>= 8;
+	}
+	tx_event_count++;
+	usb_stream_kick(&ep2_stream);
+}
+
+
+/* the end of our frame, for the host, with TRAC_STATUS if it has events */
+
+static void tx_report(uint8_t seq, uint8_t trac, uint64_t t)
+{
+	if (tx_events) {
+		tx_event_add(seq, trac, t);
+	} else {
+		queued_tx_ack = 1;
+		queued_seq = seq;
+		usb_stream_kick(&ep1_stream);
+	}
+}
+
+
+/* ----- Interrupt handling ------------------------------------------------ */
+
+
+static void tx_sent(void);
+
 static void receive_frame(void)
 {
-	uint8_t size;
+	uint8_t status, size, phr;
 	uint8_t *buf;
+	uint64_t t;
+	uint8_t i;
 
 	spi_begin();
-	spi_io(AT86RF230_BUF_READ);
+	status = spi_io(AT86RF230_BUF_READ);
 
 	size = spi_recv();
 	if (!size || (size & 0x80)) {
 		spi_end();
 		return;
 	}
+	stats.rx_frames++;
+	if (!(status & RX_CRC_VALID))
+		stats.rx_crc_errors++;
 
-	buf = rx_buf[rx_in];
+	phr = rx_stamping ? size | 0x80 : size;
+	buf = rx_alloc(rx_record(phr));
+	if (!buf) {
+		spi_end();
+		stats.rx_drops++;
+		rx_stamped = 0;
+		return;
+	}
 	spi_recv_block(buf+1, size+1);
 	spi_end();
 
-	buf[0] = size;
-	next_buf(&rx_in);
+	buf[0] = phr;
+
+	if (rx_stamping) {
+		/*
+		 * Without a separate RX_START, work back from TRX_END, which
+		 * comes at the end of the PSDU.
+		 */
+		if (rx_stamped)
+			t = rx_stamp;
+		else
+			t = timer_extend(irq_tcnt)-
+			    (uint32_t) size*RX_TICKS_PER_BYTE;
+		for (i = 0; i != RX_STAMP_SIZE; i++) {
+			buf[size+2+i] = t;
+			t >>= 8;
+		}
+	}
+	rx_stamped = 0;
 
-	if (eps[1].state == EP_IDLE)
-		usb_next();
+	usb_stream_kick(&ep1_stream);
 }
 
 
-static bool handle_irq(void)
+static bool handle_irq(uint8_t irq)
 {
-	uint8_t irq = reg_read(REG_IRQ_STATUS);
-
 	//if (irq & IRQ_RX_START)
 	//{
 		//attack(&stat);
 		//return 1;
 	//}
+	/* if TRX_END came along, we don't know when RX_START happened */
+	if ((irq & (IRQ_RX_START | IRQ_TRX_END)) == IRQ_RX_START) {
+		rx_stamp = timer_extend(irq_tcnt);
+		rx_stamped = 1;
+	}
 	if (!(irq & IRQ_TRX_END))
 		return 1;
 
@@ -136,18 +374,13 @@ static bool handle_irq(void)
 	// initiate_attack(&stat);
 
 	if (txing) {
-		if (eps[1].state == EP_IDLE) {
-			usb_send(&eps[1], &this_seq, 1, tx_ack_done, NULL);
-		} else {
-			queued_tx_ack = 1;
-			queued_seq = this_seq;
-		}
 		txing = 0;
+		tx_sent();
+		/* TRX_END of our own frame, nothing was received */
+		return 1;
 	}
 
-	/* likely */
-	if (eps[1].state == EP_IDLE || rx_in != rx_out)
-		receive_frame();
+	receive_frame();
 
 	return 1;
 }
@@ -156,34 +389,58 @@ static bool handle_irq(void)
 /* ----- TX/RX ------------------------------------------------------------- */
 
 
-bool mac_rx(int on)
+/*
+ * Frames wait in the TX ring until the transceiver is free, each as its
+ * length, with bit 7 set for ATUSB_TX_AT, its ack_seq, the deadline if
+ * ATUSB_TX_AT, and the PSDU. tx_frames includes the one EP0 may still be
+ * receiving, which is always the last.
+ */
+
+#define	TX_HDR_SIZE	2
+
+static struct ring tx = {
+	.buf	= tx_ring,
+	.size	= TX_RING_SIZE,
+};
+
+static uint8_t tx_frames = 0;		/* in the ring */
+static uint8_t tx_ready = 0;		/* of which EP0 has delivered */
+static bool tx_busy = 0;		/* the oldest one is being sent */
+
+
+static uint8_t tx_record(uint8_t hdr)
 {
-	if (on) {
-		mac_irq = handle_irq;
-		reg_read(REG_IRQ_STATUS);
-		change_state(TRX_CMD_RX_AACK_ON);
-	} else {
-		mac_irq = NULL;
-		change_state(TRX_CMD_FORCE_TRX_OFF);
-		txing = 0;
-	}
-	return 1;
+	if (hdr & 0x80)
+		return TX_HDR_SIZE+TX_AT_SIZE+(hdr & 0x7f);
+	return TX_HDR_SIZE+hdr;
 }
 
 
-static void do_tx(void *user)
+static void tx_start(void)
 {
-	uint16_t timeout = 0xffff;
-	uint8_t status;
-	uint8_t i;
+	slp_tr();
+
+	txing = 1;
 
 	/*
-	 * If we time out here, the host driver will time out waiting for the
-	 * TRX_END acknowledgement.
+	 * Wait until we reach BUSY_TX_ARET, so that we command the transition to
+	 * RX_AACK_ON which will be executed upon TX completion.
 	 */
+	change_state(TRX_CMD_PLL_ON);
+	change_state(TRX_CMD_RX_AACK_ON);
+}
+
+
+/* bring the transceiver to PLL_ON, for uploading the frame */
+
+static bool tx_prepare(void)
+{
+	uint16_t timeout = 0xffff;
+	uint8_t status;
+
 	do {
 		if (!--timeout)
-			return;
+			return 0;
 		status = reg_read(REG_TRX_STATUS) & TRX_STATUS_MASK;
 	}
 	while (status != TRX_STATUS_RX_ON && status != TRX_STATUS_RX_AACK_ON);
@@ -212,49 +469,374 @@ static void do_tx(void *user)
 	reg_write(REG_TRX_STATE, TRX_CMD_FORCE_PLL_ON);
 #endif
 
-	handle_irq();
+	handle_irq(reg_read(REG_IRQ_STATUS));
+	return 1;
+}
+
+
+static void tx_done(void);
+
+static void tx_next(void)
+{
+	const uint8_t *rec = tx_ring+tx.tail;
+	bool at = rec[0] & 0x80;
+	uint8_t size = rec[0] & 0x7f;
+	const uint8_t *psdu = rec+TX_HDR_SIZE+(at ? TX_AT_SIZE : 0);
+	uint64_t t = 0;
+	uint8_t i;
+
+	tx_busy = 1;
+	this_seq = rec[1];
+
+	/*
+	 * If we time out here, we drop the frame. With TX events, the host
+	 * gets TRAC_STATUS_INVALID. Otherwise, it will time out waiting for the
+	 * TRX_END acknowledgement.
+	 */
+	if (!tx_prepare()) {
+		stats.tx_trac[TRAC_STATUS_INVALID]++;
+		if (tx_events)
+			tx_event_add(this_seq, TRAC_STATUS_INVALID,
+			    timer_read());
+		tx_done();
+		return;
+	}
 
 	spi_begin();
 	spi_send(AT86RF230_BUF_WRITE);
-	spi_send(tx_size+2); /* CRC */
-	for (i = 0; i != tx_size; i++)
-		spi_send(tx_buf[i]);
+	spi_send(size+2); /* CRC */
+	spi_send_block(psdu, size);
 	spi_end();
+	frame_overwritten(size+2);
 
 	change_state(TRX_STATUS_TX_ARET_ON);
 
-	slp_tr();
+	if (at) {
+		for (i = TX_AT_SIZE; i; i--)
+			t = t << 8 | rec[TX_HDR_SIZE+i-1];
+		timer_at(t, tx_start);
+	} else {
+		tx_start();
+	}
+}
 
-	txing = 1;
-	this_seq = next_seq;
 
-	/*
-	 * Wait until we reach BUSY_TX_ARET, so that we command the transition to
-	 * RX_AACK_ON which will be executed upon TX completion.
-	 */
-	change_state(TRX_CMD_PLL_ON);
+/* TRX_END of our own frame: drop it from the ring and send the next one */
+
+static void tx_done(void)
+{
+	ring_free(&tx, tx_record(tx_ring[tx.tail]));
+	tx_frames--;
+	tx_ready--;
+	tx_busy = 0;
+	if (tx_ready)
+		tx_next();
+}
+
+
+static void tx_received(void *user)
+{
+	tx_ready++;
+	if (!tx_busy)
+		tx_next();
+}
+
+
+static void tx_flush(void)
+{
+	ring_reset(&tx);
+	tx_frames = tx_ready = 0;
+	tx_busy = 0;
+	txing = 0;
+}
+
+
+/* ----- Bursts ------------------------------------------------------------ */
+
+
+/*
+ * A burst sends one frame over and over, adding one to each of its fields
+ * (sequence numbers, addresses, ...) after every frame. The template borrows
+ * the otherwise empty TX ring, as ack_seq, the number of fields, their
+ * offsets and sizes, and the PSDU. We turn it into PHR and PSDU in place.
+ *
+ * The transceiver stays in TX_ARET_ON until the burst ends. Nothing else
+ * writes the frame buffer in the meantime, so frame_stage only uploads the
+ * bytes the fields changed.
+ */
+
+#define	BURST_HDR_SIZE	2	/* ack_seq, number of fields */
+#define	BURST_FIELDS	8
+#define	BURST_FIELD_MAX	8	/* bytes */
+
+static struct {
+	uint8_t *frame;		/* PHR and PSDU, without FCS */
+	uint8_t size;
+	uint8_t seq;
+	uint8_t fields;
+	struct {
+		uint8_t offset;	/* in frame, i.e., PSDU offset plus one */
+		uint8_t size;
+	} field[BURST_FIELDS];
+	uint16_t left;		/* frames still to send; 0 if idle */
+	uint16_t gap;		/* us from TRX_END to the next SLP_TR */
+	uint16_t len;		/* of the request */
+	uint8_t trac;		/* TRAC_STATUS of the last frame */
+	bool stop;
+} burst;
+
+
+static void burst_end(uint64_t t)
+{
+	tx_report(burst.seq, burst.trac, t);
+	burst.left = 0;
+	burst.stop = 0;
+	ring_reset(&tx);
+	frame_overwritten(MAX_PSDU);
 	change_state(TRX_CMD_RX_AACK_ON);
 }
 
 
+static void burst_send(void)
+{
+	if (burst.stop) {
+		burst_end(timer_read());
+		return;
+	}
+	frame_stage(burst.frame, burst.size);
+	slp_tr();
+	txing = 1;
+}
+
+
+static void burst_next(void)
+{
+	uint8_t i, j;
+	uint8_t *p;
+
+	if (!--burst.left || burst.stop) {
+		burst_end(timer_extend(irq_tcnt));
+		return;
+	}
+	for (i = 0; i != burst.fields; i++) {
+		p = burst.frame+burst.field[i].offset;
+		for (j = burst.field[i].size; j; j--)
+			if (++*p++)
+				break;
+	}
+	if (burst.gap)
+		timer_at(timer_extend(irq_tcnt)+
+		    (uint32_t) burst.gap*TIMER_TICKS_PER_US, burst_send);
+	else
+		burst_send();
+}
+
+
+static bool burst_parse(const uint8_t *rec)
+{
+	uint8_t psdu_len, offset, size;
+	uint8_t i;
+
+	burst.seq = rec[0];
+	burst.fields = rec[1];
+	if (burst.fields > BURST_FIELDS)
+		return 0;
+	if (burst.len < BURST_HDR_SIZE+2*burst.fields+1)
+		return 0;
+	psdu_len = burst.len-BURST_HDR_SIZE-2*burst.fields;
+	if (1+psdu_len > FRAME_MAX)
+		return 0;
+	for (i = 0; i != burst.fields; i++) {
+		offset = rec[BURST_HDR_SIZE+2*i];
+		size = rec[BURST_HDR_SIZE+2*i+1];
+		if (!size || size > BURST_FIELD_MAX)
+			return 0;
+		/* check the PSDU offset before it can wrap to the PHR */
+		if (offset >= psdu_len || size > psdu_len-offset)
+			return 0;
+		burst.field[i].offset = offset+1;
+		burst.field[i].size = size;
+	}
+
+	/* the PHR goes right in front of the PSDU, over the last field size */
+	burst.frame = (uint8_t *) rec+BURST_HDR_SIZE+2*burst.fields-1;
+	burst.frame[0] = psdu_len+2; /* CRC */
+	burst.size = 1+psdu_len;
+	return 1;
+}
+
+
+static void burst_received(void *user)
+{
+	const uint8_t *rec = tx_ring+tx.tail;
+
+	if (!burst_parse(rec) || !tx_prepare()) {
+		stats.tx_trac[TRAC_STATUS_INVALID]++;
+		tx_report(rec[0], TRAC_STATUS_INVALID, timer_read());
+		burst.left = 0;
+		ring_reset(&tx);
+		return;
+	}
+	frame_stage(burst.frame, burst.size);
+	change_state(TRX_STATUS_TX_ARET_ON);
+	burst_send();
+}
+
+
+static void burst_flush(void)
+{
+	burst.left = 0;
+	burst.stop = 0;
+}
+
+
+/* TRX_END of our own frame, sent from the ring or as part of a burst */
+
+static void tx_sent(void)
+{
+	uint8_t trac;
+
+	trac = reg_read(REG_TRX_STATE) >> TRAC_STATUS_SHIFT & TRAC_STATUS_MASK;
+	stats.tx_trac[trac]++;
+	if (burst.left) {
+		burst.trac = trac;
+		burst_next();
+	} else {
+		tx_report(this_seq, trac, timer_extend(irq_tcnt));
+		tx_done();
+	}
+}
+
+
+bool mac_sending(void)
+{
+	return txing;
+}
+
+
+bool mac_rx(uint16_t mode)
+{
+	rx_batch = mode & ATUSB_RX_MODE_BATCH;
+	rx_stamping = mode & ATUSB_RX_MODE_TIMESTAMP;
+	rx_stamped = 0;
+	tx_events = mode & ATUSB_RX_MODE_TX_EVENTS;
+	if (mode & ATUSB_RX_MODE_ON) {
+		mac_irq = handle_irq;
+		if (rx_stamping)
+			reg_write(REG_IRQ_MASK,
+			    reg_read(REG_IRQ_MASK) | IRQ_RX_START);
+		reg_read(REG_IRQ_STATUS);
+		change_state(TRX_CMD_RX_AACK_ON);
+	} else {
+		mac_irq = NULL;
+		timer_cancel(tx_start);
+		timer_cancel(burst_send);
+		change_state(TRX_CMD_FORCE_TRX_OFF);
+		tx_flush();
+		burst_flush();
+	}
+	return 1;
+}
+
+
+/*
+ * Without ATUSB_RX_MODE_TX_EVENTS, EP1 can only hold one acknowledgement, so
+ * the host has to wait for it before sending the next frame. With events,
+ * it can queue as many frames as the ring and the event queue hold, and
+ * ATUSB_TX stalls when they are full.
+ */
+
 bool mac_tx(uint16_t flags, uint8_t seq, uint16_t len)
 {
+	bool at = flags & ATUSB_TX_AT;
+	uint8_t *rec;
+
+	if (at) {
+		if (len < TX_AT_SIZE)
+			return 0;
+		len -= TX_AT_SIZE;
+	}
 	if (len > MAX_PSDU)
 		return 0;
-	tx_size = len;
-	next_seq = seq;
-	usb_recv(&eps[0], tx_buf, len, do_tx, NULL);
+	if (burst.left)
+		return 0;
+	if (tx_events ? tx_frames+tx_event_count == TX_EVENTS : tx_frames)
+		return 0;
+	rec = ring_alloc(&tx, TX_HDR_SIZE+(at ? TX_AT_SIZE : 0)+len);
+	if (!rec)
+		return 0;
+	rec[0] = at ? len | 0x80 : len;
+	rec[1] = seq;
+	tx_frames++;
+	usb_recv(&eps[0], rec+TX_HDR_SIZE, at ? TX_AT_SIZE+len : len,
+	    tx_received, NULL);
+	return 1;
+}
+
+
+/*
+ * A burst needs the TX ring to itself, and an event for its end. With count
+ * 0, we stop the burst that is running after its current frame.
+ */
+
+bool mac_burst(uint16_t count, uint16_t gap, uint16_t len)
+{
+	uint8_t *rec;
+
+	if (!count) {
+		if (!burst.left || len)
+			return 0;
+		burst.stop = 1;
+		return 1;
+	}
+	if (burst.left || tx_frames)
+		return 0;
+	if (tx_events && tx_event_count == TX_EVENTS)
+		return 0;
+	if (len > BURST_HDR_SIZE+2*BURST_FIELDS+FRAME_MAX-1)
+		return 0;
+	rec = ring_alloc(&tx, len);
+	if (!rec)
+		return 0;
+	burst.left = count;
+	burst.gap = gap;
+	burst.len = len;
+	usb_recv(&eps[0], rec, len, burst_received, NULL);
 	return 1;
 }
 
 
+uint8_t mac_rx_stats(uint8_t *buf, bool clear)
+{
+	buf[0] = stats.rx_drops;
+	buf[1] = stats.rx_drops >> 8;
+	buf[2] = rx_high;
+	buf[3] = rx_high >> 8;
+	buf[4] = RX_RING_SIZE & 0xff;
+	buf[5] = RX_RING_SIZE >> 8;
+	if (clear) {
+		stats.rx_drops = 0;
+		rx_high = 0;
+	}
+	return 6;
+}
+
+
 void mac_reset(void)
 {
 	mac_irq = NULL;
-	txing = 0;
+	timer_cancel(tx_start);
+	timer_cancel(burst_send);
+	tx_flush();
+	burst_flush();
 	queued_tx_ack = 0;
-	rx_in = rx_out = 0;
-	next_seq = this_seq = queued_seq = 0;
+	ring_reset(&rx);
+	rx_sending = 0;
+	rx_batch = 0;
+	rx_stamping = rx_stamped = 0;
+	tx_events = 0;
+	tx_event_count = 0;
+	this_seq = queued_seq = 0;
 
 	/* enable CRC and PHY_RSSI (with RX_CRC_VALID) in SPI status return */
 	reg_write(REG_TRX_CTRL_1,
@@ -17,10 +17,18 @@
 #include <stdint.h>
 
 
-extern bool (*mac_irq)(void);
+/* the interrupt handler passes the IRQ_STATUS it read */
 
-bool mac_rx(int on);
+extern bool (*mac_irq)(uint8_t irq);
+
+/* whether the TRX_END to come is that of a frame the HardMAC sent */
+
+bool mac_sending(void);
+
+bool mac_rx(uint16_t mode);
 bool mac_tx(uint16_t flags, uint8_t seq, uint16_t len);
+bool mac_burst(uint16_t count, uint16_t gap, uint16_t len);
+uint8_t mac_rx_stats(uint8_t *buf, bool clear);
 void mac_reset(void);
 
 #endif /* !MAC_H */
@@ -13,6 +13,7 @@
 
 #include <stdbool.h>
 #include <stdint.h>
+#include <stddef.h>
 
 #include <avr/io.h>
 
@@ -36,16 +37,73 @@ void spi_end(void)
 }
 
 
-void spi_recv_block(uint8_t *buf, uint8_t n)
+/* ----- Block transfers --------------------------------------------------- */
+
+
+#ifdef SPI_WAIT_READY
+
+/*
+ * The USART in MSPI mode has a double-buffered transmitter, so we queue the
+ * next byte while the current one is being shifted, and the bytes go out back
+ * to back. At most one received byte waits in the receive FIFO. out and in
+ * are constants in each of the callers below, so the compiler drops the tests
+ * and the loop is two polls, an sts, an lds, one pointer access and the
+ * counter: 17 cycles, one more than a byte takes at 4 MHz. The SPI clock thus
+ * idles for about one cycle between bytes, against some twelve with spi_io.
+ */
+
+static inline __attribute__((always_inline)) void xfer(const uint8_t *out,
+    uint8_t *in, uint8_t n)
 {
+	uint8_t v;
+
 	if (!n)
 		return;
-	SPI_DATA = 0;
+	SPI_DATA = out ? *out++ : 0;
 	while (--n) {
+		SPI_WAIT_READY();
+		SPI_DATA = out ? *out++ : 0;
 		SPI_WAIT_DONE();
-		*buf++ = SPI_DATA;
-		SPI_DATA = 0;
+		v = SPI_DATA;
+		if (in)
+			*in++ = v;
 	}
 	SPI_WAIT_DONE();
-	*buf++ = SPI_DATA;
+	v = SPI_DATA;
+	if (in)
+		*in = v;
+}
+
+#else /* SPI_WAIT_READY */
+
+static inline __attribute__((always_inline)) void xfer(const uint8_t *out,
+    uint8_t *in, uint8_t n)
+{
+	uint8_t v;
+
+	while (n--) {
+		v = spi_io(out ? *out++ : 0);
+		if (in)
+			*in++ = v;
+	}
+}
+
+#endif /* !SPI_WAIT_READY */
+
+
+void spi_send_block(const uint8_t *buf, uint8_t n)
+{
+	xfer(buf, NULL, n);
+}
+
+
+void spi_recv_block(uint8_t *buf, uint8_t n)
+{
+	xfer(NULL, buf, n);
+}
+
+
+void spi_xfer_block(const uint8_t *out, uint8_t *in, uint8_t n)
+{
+	xfer(out, in, n);
 }
@@ -25,6 +25,13 @@ void spi_init(void);
 #define	spi_send(v)	(void) spi_io(v)
 #define	spi_recv(v)	spi_io(0)
 
+/*
+ * Block transfers keep the SPI busy without gaps where the hardware allows.
+ * spi_xfer_block sends out and receives into in at the same time.
+ */
+
+void spi_send_block(const uint8_t *buf, uint8_t n);
 void spi_recv_block(uint8_t *buf, uint8_t n);
+void spi_xfer_block(const uint8_t *out, uint8_t *in, uint8_t n);
 
 #endif /* !SPI_H */
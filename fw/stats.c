@@ -0,0 +1,45 @@
+/*
+ * fw/stats.c - Runtime counters
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "board.h"
+#include "stats.h"
+
+
+struct stats stats;
+
+
+/*
+ * All members are uint16_t, so we can send them as an array. With
+ * SHADOW_CHECK, the register shadow's mismatch count follows them.
+ */
+
+uint8_t stats_read(uint8_t *buf, bool clear)
+{
+	const uint16_t *p = (const uint16_t *) &stats;
+	uint8_t size = sizeof(stats);
+	uint8_t i;
+
+	for (i = 0; i != sizeof(stats)/2; i++) {
+		buf[2*i] = p[i];
+		buf[2*i+1] = p[i] >> 8;
+	}
+	if (clear)
+		memset(&stats, 0, sizeof(stats));
+#ifdef SHADOW_CHECK
+	buf[size++] = shadow_errors;
+	buf[size++] = shadow_errors >> 8;
+	if (clear)
+		shadow_errors = 0;
+#endif
+	return size;
+}
@@ -0,0 +1,38 @@
+/*
+ * fw/stats.h - Runtime counters
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef STATS_H
+#define	STATS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+/*
+ * All counters are 16 bits, so that updating one costs only a few cycles on
+ * the AVR, and they wrap around. ATUSB_STATS returns them in this order, and
+ * with SHADOW_CHECK, shadow_errors after them.
+ */
+
+struct stats {
+	uint16_t irqs;		/* RF interrupts */
+	uint16_t irq_max;	/* longest, in Timer 1 ticks from the IRQ */
+	uint16_t rx_frames;	/* received by the HardMAC */
+	uint16_t rx_crc_errors;	/* of those, with a bad FCS */
+	uint16_t rx_drops;	/* not received because the RX ring was full */
+	uint16_t tx_trac[8];	/* HardMAC frames sent, by TRAC_STATUS */
+	uint16_t injected;	/* frames attacks sent with send_zbee_cmd */
+};
+
+
+extern struct stats stats;
+
+uint8_t stats_read(uint8_t *buf, bool clear);
+
+#endif /* !STATS_H */
@@ -180,12 +180,24 @@ stall:
 }
 
 
+/* EPSIZE field of UECFG1X: 8 << n bytes */
+
+#define	EPSIZE(bytes)	((bytes) == 8 ? 0 : (bytes) == 16 ? 1 : \
+			    (bytes) == 32 ? 2 : 3)
+
+#ifdef BOOT_LOADER
+#define	EP0_BYTES	EP0_SIZE
+#else
+#define	EP0_BYTES	APP_EP0_SIZE
+#endif
+
+
 void ep_init(void)
 {
 	UENUM = 0;
 	UECONX = (1 << RSTDT) | (1 << EPEN);	/* enable */
 	UECFG0X = 0;	/* control, direction is ignored */
-	UECFG1X = 3 << EPSIZE0;	/* 64 bytes */
+	UECFG1X = EPSIZE(EP0_BYTES) << EPSIZE0;
 	UECFG1X |= 1 << ALLOC;
 
 	while (!(UESTA0X & (1 << CFGOK)));
@@ -194,14 +206,21 @@ void ep_init(void)
 	    (1 << RXSTPE) | (1 << RXOUTE) | (1 << STALLEDE) | (1 << TXINE);
 
 	eps[0].state = EP_IDLE;
-	eps[0].size = 64;
+	eps[0].size = EP0_BYTES;
 
 #ifndef BOOT_LOADER
 
+	/*
+	 * With two banks, TXINI comes back as soon as we've handed one bank
+	 * to the controller, and ep_tx fills the other one while the host is
+	 * still reading the first.
+	 */
 	UENUM = 1;
 	UECONX = (1 << RSTDT) | (1 << EPEN);	/* enable */
 	UECFG0X = (1 << EPTYPE1) | (1 << EPDIR); /* bulk IN */
-	UECFG1X = 3 << EPSIZE0;	/* 64 bytes */
+	UECFG1X = EPSIZE(EP1_SIZE) << EPSIZE0;
+	if (EP1_BANKS == 2)
+		UECFG1X |= 1 << EPBK0;
 	UECFG1X |= 1 << ALLOC;
 
 	while (!(UESTA0X & (1 << CFGOK)));
@@ -209,7 +228,21 @@ void ep_init(void)
 	UEIENX = (1 << STALLEDE) | (1 << TXINE);
 
 	eps[1].state = EP_IDLE;
-	eps[1].size = 64;
+	eps[1].size = EP1_SIZE;
+
+	UENUM = 2;
+	UECONX = (1 << RSTDT) | (1 << EPEN);	/* enable */
+	/* interrupt IN */
+	UECFG0X = (1 << EPTYPE1) | (1 << EPTYPE0) | (1 << EPDIR);
+	UECFG1X = EPSIZE(EP2_SIZE) << EPSIZE0;
+	UECFG1X |= 1 << ALLOC;
+
+	while (!(UESTA0X & (1 << CFGOK)));
+
+	UEIENX = (1 << STALLEDE) | (1 << TXINE);
+
+	eps[2].state = EP_IDLE;
+	eps[2].size = EP2_SIZE;
 
 #endif
 }
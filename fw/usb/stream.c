@@ -0,0 +1,39 @@
+/*
+ * fw/usb/stream.c - Keep an IN endpoint busy with data from a producer
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * Only the application streams, so this isn't part of usb.c, which the boot
+ * loader shares.
+ */
+
+#include <stdint.h>
+
+#include "usb.h"
+
+
+static void stream_done(void *user)
+{
+	struct usb_stream *s = user;
+
+	s->done(s->size);
+	s->size = 0;
+	usb_stream_kick(s);
+}
+
+
+void usb_stream_kick(struct usb_stream *s)
+{
+	const uint8_t *buf;
+
+	if (s->ep->state != EP_IDLE)
+		return;
+	s->size = s->more(&buf);
+	if (s->size)
+		usb_send(s->ep, buf, s->size, stream_done, s);
+}
